@@ -1,162 +1,145 @@
+#include "appcore.h"
 #include "cfg.h"
+#include "config.h"
 #include "types.h"
 #include "util.h"
 #include <assert.h>
 #include <errno.h>
-#include <semaphore.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/shm.h>
 #include <time.h>
 #include <unistd.h>
 
 // Shared memory segment between apps and kernel
-static int *shm;
-// App ID received from kernelsim
-static int app_id;
-// Internal program counter to demonstrate context switching
-static int counter = 0;
-// Pipe fds for sending a syscall request to kernelsim
-static int syscall_pipe_fd[2];
-// Semaphore to avoid a syscall while the dispatcher is making a decision
-static sem_t *dispatch_sem;
-// Used to differentiate kernel unpause SIGCONT from timesharing SIGCONT
-static volatile sig_atomic_t app_waiting_syscall_block = false;
+static shm_t *shm;
+// App ID received from kernelsim, and the program counter to demonstrate
+// context switching
+static app_t app = {.counter = 0};
+// Eventfd for waking up kernelsim after submitting a syscall request
+static int doorbell_fd;
+// Our context slot and handshake, inside shm
+static app_ctx_t *app_ctx;
+// Whether the kernel switches us by parking instead of with signals
+static bool fast_switch = false;
 
 // Called when app receives SIGUSR1 from kernelsim
 // Saves context in shm and raises SIGSTOP
-static void handle_kernel_stop(int signum) {
-  msg("App %d stopped at counter %d", app_id + 1, counter);
-
-  app_waiting_syscall_block = false;
-
-  // Save program counter state to shm
-  set_app_counter(shm, app_id, counter);
-
-  // Simulate data loss
-  counter = 0;
-
-  // Wait for continue from kernelsim
-  raise(SIGSTOP);
-}
-
-// Generate a random syscall from options (D1/D2 + R/W/X)
-static inline syscall_t rand_syscall(void) {
-  int r = rand();
-
-  switch (r % 6) {
-  case 0:
-    return SYSCALL_D1_R;
-  case 1:
-    return SYSCALL_D1_W;
-  case 2:
-    return SYSCALL_D1_X;
-  case 3:
-    return SYSCALL_D2_R;
-  case 4:
-    return SYSCALL_D2_W;
-  case 5:
-    return SYSCALL_D2_X;
-  default:
-    fprintf(stderr, "rand_syscall error\n");
-    exit(5);
-  }
-}
+static void handle_kernel_stop(int signum) { stop_app_process(&app, shm); }
 
 // Called when app receives SIGCONT from kernelsim
 // Restores state from shm
-static void handle_kernel_cont(int signum) {
-  // Check if it's a SIGCONT from a kernel unpause
-  if (app_waiting_syscall_block) {
-    dmsg("App %d resumed waiting for syscall block", app_id + 1);
-
-    // pause app and don't block SIGCONT
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigsuspend(&mask);
-    return;
-  }
-
-  // Restore program counter state from shm
-  counter = get_app_counter(shm, app_id);
-
-  msg("App %d resumed at counter %d", app_id + 1, counter);
-
-  // Restore syscall state from shm
-  sem_wait(dispatch_sem);
-  if (get_app_syscall(shm, app_id) != SYSCALL_NONE) {
-    // announce syscall completed and change status to none
-    dmsg("App %d completed syscall: %s", app_id + 1,
-         SYSCALL_STR[get_app_syscall(shm, app_id)]);
-    set_app_syscall(shm, app_id, SYSCALL_NONE);
-  }
-  sem_post(dispatch_sem);
-}
+static void handle_kernel_cont(int signum) { continue_app_process(&app, shm); }
 
 // Called by parent on Ctrl+C.
 // Cleanup and exit
 static void handle_sigterm(int signum) {
-  dmsg("App %d stopping from SIGTERM", app_id + 1);
+  dmsg("App %d stopping from SIGTERM", app.app_id + 1);
 
   // cleanup
-  close(syscall_pipe_fd[PIPE_WRITE]); // close write
-  shmdt(shm);
-  sem_close(dispatch_sem);
+  close(doorbell_fd);
+  detach_shm(shm);
   exit(0);
 }
 
 // Sends a syscall request to kernelsim
-static void send_syscall(syscall_t call) {
-  // There should be no pending syscalls
-  assert(get_app_syscall(shm, app_id) == SYSCALL_NONE);
+static void send_syscall(void *arg, syscall_t call) {
+  send_app_syscall(&app, shm, doorbell_fd, fast_switch, call);
+}
+
+// Sleeps for the given time, the remaining time is restored after being
+// stopped and continued
+static void sleep_app(void *arg, uint64_t duration_ns) {
+  struct timespec time_total, time_remaining;
+
+  if (fast_switch) {
+    // Sleeping is our safe point, a park request wakes us up early and
+    // the remaining time is restored after being resumed
+    uint64_t remaining_ns = duration_ns;
+
+    while (remaining_ns > 0) {
+      uint64_t begin_ns = get_time_ns();
+      time_total.tv_sec = remaining_ns / 1000000000ULL;
+      time_total.tv_nsec = remaining_ns % 1000000000ULL;
 
-  dmsg("App %d started syscall: %s", app_id + 1, SYSCALL_STR[call]);
+      bool park = wait_park_request(app_ctx, &time_total);
+      uint64_t slept_ns = get_time_ns() - begin_ns;
+      remaining_ns = slept_ns < remaining_ns ? remaining_ns - slept_ns : 0;
 
-  // Set desired syscall and send request to kernelsim
-  set_app_syscall(shm, app_id, call);
-  write(syscall_pipe_fd[PIPE_WRITE], &app_id, sizeof(int));
+      if (park) {
+        park_app_at_safe_point(&app, shm);
+      }
+    }
+    return;
+  }
+
+  time_total.tv_sec = duration_ns / 1000000000ULL;
+  time_total.tv_nsec = duration_ns % 1000000000ULL;
 
-  // Wait for SIGUSR1->SIGSTOP
-  sem_post(dispatch_sem);
-  app_waiting_syscall_block = true;
-  pause();
+  while (nanosleep(&time_total, &time_remaining) == -1) {
+    if (errno == EINTR) {
+      // Restore remaining sleep time after a signal
+      time_total = time_remaining;
+    } else {
+      fprintf(stderr, "Nanosleep error\n");
+      exit(13);
+    }
+  }
+}
+
+// Tells kernelsim we finished, waking it up if needed
+static void finish_app(void *arg) {
+  if (submit_app_finished(&app, shm, fast_switch)) {
+    ring_syscall_doorbell(doorbell_fd);
+  }
 }
 
+// Engine of app processes, switched by kernelsim with signals or futexes
+static const app_engine_t process_engine = {
+    .sleep = sleep_app,
+    .send_syscall = send_syscall,
+    .finish = finish_app,
+};
+
 // Called on segfault, necessary in order to show a messsage if it happens
 static void handle_sigsegv(int signum) {
-  dmsg("App %d segmentation fault!", app_id + 1);
+  dmsg("App %d segmentation fault!", app.app_id + 1);
 
   // cleanup
-  close(syscall_pipe_fd[PIPE_WRITE]); // close write
-  shmdt(shm);
-  sem_close(dispatch_sem);
+  close(doorbell_fd);
+  detach_shm(shm);
 
   exit(12);
 }
 
 int main(int argc, char **argv) {
-  assert(argc == 5);
+  log_init();
+  assert(argc == 7);
 
-  srand(time(NULL) ^ (getpid() << 16)); // reset seed
-
-  // Get IDs from command line
-  int shm_id = atoi(argv[1]);
-  app_id = atoi(argv[2]);
+  // Get shm name, ID, base seed and configuration from command line
+  if (!config_parse(argv[6])) {
+    exit(16);
+  }
+  const char *shm_name = argv[1];
+  app.app_id = atoi(argv[2]);
+  seed_app_prng(&app, strtoul(argv[4], NULL, 10));
 
-  dmsg("App %d booting", app_id + 1);
+  cdmsg(LOG_CAT_APP, "App %d booting", app.app_id + 1);
 
-  // Pipe setup
-  syscall_pipe_fd[PIPE_READ] = atoi(argv[3]);
-  syscall_pipe_fd[PIPE_WRITE] = atoi(argv[4]);
-  close(syscall_pipe_fd[PIPE_READ]); // close read
+  // Doorbell inherited from kernelsim
+  doorbell_fd = atoi(argv[3]);
 
-  // Register signal callbacks
-  if (signal(SIGUSR1, handle_kernel_stop) == SIG_ERR) {
-    fprintf(stderr, "Signal error\n");
-    exit(4);
-  }
-  if (signal(SIGCONT, handle_kernel_cont) == SIG_ERR) {
+  // Attach to kernelsim shm
+  shm = attach_shm(shm_name);
+  app_ctx = &shm->ctxs[app.app_id];
+  fast_switch = shm->switch_mode == SWITCH_FUTEX;
+  load_app_workload(&app, shm);
+  init_app_context(&app, shm);
+
+  // Register signal callbacks, the kernel only signals us to switch
+  // outside of fast-switch mode
+  if (!fast_switch && (signal(SIGUSR1, handle_kernel_stop) == SIG_ERR ||
+                       signal(SIGCONT, handle_kernel_cont) == SIG_ERR)) {
     fprintf(stderr, "Signal error\n");
     exit(4);
   }
@@ -169,66 +152,22 @@ int main(int argc, char **argv) {
     exit(4);
   }
 
-  // Attach to kernelsim shm
-  shm = (int *)shmat(shm_id, NULL, 0);
-
-  // Get semaphore created by kernelsim
-  dispatch_sem = sem_open(DISPATCH_SEM_NAME, 0);
-  if (dispatch_sem == SEM_FAILED) {
-    fprintf(stderr, "Semaphore error\n");
-    exit(11);
-  }
-
-  // Begin paused
-  raise(SIGSTOP);
-
-  dmsg("App %d running", app_id + 1);
-
-  // Main application loop
-  while (counter < APP_MAX_PC) {
-    sem_wait(dispatch_sem);
-    if (rand() % 100 < APP_SYSCALL_PROB) {
-      send_syscall(rand_syscall());
-    } else {
-      sem_post(dispatch_sem);
-    }
-
-    counter++;
-    dmsg("App %d counter increased to %d", app_id + 1, counter);
-
-    // Sleep according to time set at cfg.h,
-    // Remaining time is restored after a signal is handled
-    struct timespec time_total, time_remaining;
-    time_total.tv_sec = APP_SLEEP_TIME_MS / 1000;
-    time_total.tv_nsec = (APP_SLEEP_TIME_MS % 1000) * 1000000L;
-
-    while (nanosleep(&time_total, &time_remaining) == -1) {
-      if (errno == EINTR) {
-        // Restore remaining sleep time after a signal
-        time_total = time_remaining;
-      } else {
-        fprintf(stderr, "Nanosleep error\n");
-        exit(13);
-      }
-    }
+  // Begin paused, the kernel waits for us to be stopped or parked before
+  // continuing us
+  signal_child_ready(atoi(argv[5]));
+  if (fast_switch) {
+    park_app(app_ctx);
+  } else {
+    raise(SIGSTOP);
   }
 
-  msg("App %d left main loop", app_id + 1);
-
-  // update context before exiting
-  // write to notify that app finished
-  sem_wait(dispatch_sem);
-  set_app_syscall(shm, app_id, SYSCALL_APP_FINISHED);
-  set_app_counter(shm, app_id, counter);
-  write(syscall_pipe_fd[PIPE_WRITE], &app_id, sizeof(int));
-  sem_post(dispatch_sem);
+  run_app_loop(&app, &process_engine, NULL);
 
   // cleanup
-  close(syscall_pipe_fd[PIPE_WRITE]); // close read
-  shmdt(shm);
-  sem_close(dispatch_sem);
+  close(doorbell_fd);
+  detach_shm(shm);
 
-  msg("App %d finished", app_id + 1);
+  cmsg(LOG_CAT_APP, "App %d finished", app.app_id + 1);
 
   return 0;
 }
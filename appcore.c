@@ -0,0 +1,185 @@
+#include "appcore.h"
+#include "config.h"
+#include "util.h"
+#include <assert.h>
+#include <stdlib.h>
+
+void seed_app_prng(app_t *app, unsigned int base_seed) {
+  prng_seed(&app->prng, base_seed, PRNG_STREAM_APPS + app->app_id);
+}
+
+void load_app_workload(app_t *app, shm_t *shm) {
+  app->workload = shm->ctxs[app->app_id].workload;
+  app->profile = workload_profile(app->workload);
+}
+
+void init_app_context(app_t *app, shm_t *shm) {
+  context_init(&app->context, shm, app->app_id, config.app_context_zero_copy);
+}
+
+void run_app_loop(app_t *app, const app_engine_t *engine, void *arg) {
+  if (app->run_steps == 0) {
+    app->run_steps = workload_run_steps(app->profile, &app->prng);
+
+    cdmsg(LOG_CAT_APP, "App %d running %s workload for %d steps",
+          app->app_id + 1, WORKLOAD_STR[app->workload], app->run_steps);
+  }
+
+  // Main application loop
+  while (app->counter < app->run_steps) {
+    if (!app->in_syscall &&
+        workload_wants_syscall(app->profile, app->counter, &app->prng)) {
+      app->in_syscall = true;
+      engine->send_syscall(arg, workload_pick_syscall(app->profile,
+                                                      &app->prng));
+    }
+
+    app->in_syscall = false;
+    app->counter++;
+    context_step(&app->context, app->counter, config.app_context_touches);
+    cdmsg(LOG_CAT_APP, "App %d counter increased to %d", app->app_id + 1,
+          app->counter);
+
+    // Sleep according to the configured time
+    engine->sleep(arg, config.app_sleep_time_ms * 1000000ULL);
+  }
+
+  cmsg(LOG_CAT_APP, "App %d left main loop", app->app_id + 1);
+
+  engine->finish(arg);
+}
+
+void save_app_context(app_t *app, shm_t *shm) {
+  cmsg(LOG_CAT_APP, "App %d stopped at counter %d", app->app_id + 1,
+       app->counter);
+
+  // Save program counter state to shm
+  set_app_counter(shm, app->app_id, app->counter);
+
+  // Simulate data loss
+  app->counter = 0;
+  context_save(&app->context);
+}
+
+void restore_app_context(app_t *app, shm_t *shm) {
+  // Restore program counter state from shm
+  app->counter = get_app_counter(shm, app->app_id);
+  context_restore(&app->context);
+
+  cmsg(LOG_CAT_APP, "App %d resumed at counter %d", app->app_id + 1,
+       app->counter);
+
+  // Restore syscall state from shm. The kernel already released the
+  // handshake, and won't read it until we submit another syscall
+  if (get_app_syscall(shm, app->app_id) != SYSCALL_NONE) {
+    // announce syscall completed and change status to none
+    cdmsg(LOG_CAT_SYSCALL, "App %d completed syscall: %s", app->app_id + 1,
+          SYSCALL_STR[get_app_syscall(shm, app->app_id)]);
+    set_app_syscall(shm, app->app_id, SYSCALL_NONE);
+  }
+}
+
+void park_app_at_safe_point(app_t *app, shm_t *shm) {
+  save_app_context(app, shm);
+  park_app(&shm->ctxs[app->app_id]);
+  restore_app_context(app, shm);
+}
+
+void claim_app_syscall(app_t *app, shm_t *shm, bool fast_switch) {
+  app_ctx_t *ctx = &shm->ctxs[app->app_id];
+
+  if (!fast_switch) {
+    begin_app_syscall(ctx);
+    return;
+  }
+
+  while (!try_begin_app_syscall(ctx)) {
+    park_app_at_safe_point(app, shm);
+  }
+}
+
+bool submit_app_finished(app_t *app, shm_t *shm, bool fast_switch) {
+  // update context before exiting
+  // write to notify that app finished
+  claim_app_syscall(app, shm, fast_switch);
+  set_app_syscall(shm, app->app_id, SYSCALL_APP_FINISHED);
+  set_app_counter(shm, app->app_id, app->counter);
+
+  return push_syscall_request(get_syscall_ring(shm), app->app_id,
+                              SYSCALL_APP_FINISHED);
+}
+
+volatile sig_atomic_t app_waiting_syscall_block = false;
+
+void stop_app_process(app_t *app, shm_t *shm) {
+  app_waiting_syscall_block = false;
+
+  save_app_context(app, shm);
+
+  // Wait for continue from kernelsim
+  raise(SIGSTOP);
+}
+
+bool continue_app_process(app_t *app, shm_t *shm) {
+  // Check if it's a SIGCONT from a kernel unpause,
+  // send_app_syscall keeps waiting for the block in that case
+  if (app_waiting_syscall_block) {
+    cdmsg(LOG_CAT_SYSCALL, "App %d resumed waiting for syscall block",
+          app->app_id + 1);
+    return false;
+  }
+
+  restore_app_context(app, shm);
+  return true;
+}
+
+void send_app_syscall(app_t *app, shm_t *shm, int doorbell_fd,
+                      bool fast_switch, syscall_t call) {
+  syscall_ring_t *syscall_ring = get_syscall_ring(shm);
+
+  // Keep the dispatcher from preempting us until the request is handled
+  claim_app_syscall(app, shm, fast_switch);
+
+  // There should be no pending syscalls
+  assert(get_app_syscall(shm, app->app_id) == SYSCALL_NONE);
+
+  cdmsg(LOG_CAT_SYSCALL, "App %d started syscall: %s", app->app_id + 1,
+        SYSCALL_STR[call]);
+
+  if (fast_switch) {
+    // Submit, then park once the kernel blocks us
+    set_app_syscall(shm, app->app_id, call);
+    if (push_syscall_request(syscall_ring, app->app_id, call)) {
+      ring_syscall_doorbell(doorbell_fd);
+    }
+
+    while (!wait_park_request(&shm->ctxs[app->app_id], NULL))
+      ;
+    park_app_at_safe_point(app, shm);
+    return;
+  }
+
+  // Hold SIGUSR1 until we're waiting for it, as the kernel may block us
+  // right after the request is published
+  sigset_t usr1_mask, orig_mask, wait_mask;
+  sigemptyset(&usr1_mask);
+  sigaddset(&usr1_mask, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &usr1_mask, &orig_mask);
+  app_waiting_syscall_block = true;
+
+  // Set desired syscall and send request to kernelsim
+  set_app_syscall(shm, app->app_id, call);
+  if (push_syscall_request(syscall_ring, app->app_id, call)) {
+    ring_syscall_doorbell(doorbell_fd);
+  }
+
+  // Wait for SIGUSR1->SIGSTOP, a SIGCONT from a kernel unpause
+  // doesn't end the wait
+  wait_mask = orig_mask;
+  sigdelset(&wait_mask, SIGUSR1);
+  while (app_waiting_syscall_block) {
+    sigsuspend(&wait_mask);
+  }
+
+  sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "context.h"
+#include "prng.h"
+#include "types.h"
+#include "workload.h"
+#include <signal.h>
+#include <stdbool.h>
+
+// App state shared by the process and coroutine engines
+typedef struct {
+  int app_id;                        // Index of the app's context slot in shm
+  int counter;                       // Program counter, lost when stopped
+  prng_t prng;                       // Random decisions of the app
+  workload_t workload;               // Profile assigned by the kernel
+  const workload_profile_t *profile; // What the app loop does
+  app_context_t context;             // Registers and working set
+  int run_steps;                     // Run length, 0 until drawn at boot
+  bool in_syscall;                   // Inside send_syscall
+} app_t;
+
+// What the app loop needs from the engine running it
+typedef struct {
+  // Sleeps for the given time, during which the app may be stopped
+  void (*sleep)(void *arg, uint64_t duration_ns);
+  // Submits a syscall, returns once the kernel blocked and continued us
+  void (*send_syscall)(void *arg, syscall_t call);
+  // Tells the kernel the app finished, the loop returns right after
+  void (*finish)(void *arg);
+} app_engine_t;
+
+// Sets the app's workload profile from the one the kernel stored in its
+// context slot
+void load_app_workload(app_t *app, shm_t *shm);
+
+// Sets up the app's register file and working set, saved in its shm area
+void init_app_context(app_t *app, shm_t *shm);
+
+// Seeds the app's PRNG with its own stream of the kernel's base seed, so a
+// whole run is reproducible from a single number
+void seed_app_prng(app_t *app, unsigned int base_seed);
+
+// Runs the app until its counter reaches the run length of its workload
+// profile, sleeping and sending random syscalls through the engine. Picks
+// up where the app's state says it was, so a restored coroutine app can
+// start over from it
+void run_app_loop(app_t *app, const app_engine_t *engine, void *arg);
+
+// Saves the program counter and the large context in shm before being
+// stopped, and loses them
+void save_app_context(app_t *app, shm_t *shm);
+
+// Restores the program counter and the large context from shm after being
+// continued, and acknowledges a completed syscall
+void restore_app_context(app_t *app, shm_t *shm);
+
+// Fast-switch mode: parks at a safe point after the kernel asked us to,
+// saving and restoring context the same way the signal handlers do
+void park_app_at_safe_point(app_t *app, shm_t *shm);
+
+// Claims the handshake before submitting a syscall. If the kernel is
+// preempting us at the same time, waits until continued, or parks right
+// away in fast-switch mode
+void claim_app_syscall(app_t *app, shm_t *shm, bool fast_switch);
+
+// Publishes SYSCALL_APP_FINISHED along with the final counter.
+// Returns whether the kernel must be woken up through the doorbell
+bool submit_app_finished(app_t *app, shm_t *shm, bool fast_switch);
+
+// Whether an app process switched with signals is waiting in
+// send_app_syscall for the kernel to block it. A SIGCONT from a kernel
+// unpause doesn't end the wait
+extern volatile sig_atomic_t app_waiting_syscall_block;
+
+// Body of an app process's SIGUSR1 handler: saves context in shm and
+// stops until the kernel continues us
+void stop_app_process(app_t *app, shm_t *shm);
+
+// Body of an app process's SIGCONT handler: restores context from shm.
+// Returns false for a kernel unpause while waiting for a syscall block,
+// which leaves the context as is
+bool continue_app_process(app_t *app, shm_t *shm);
+
+// Submits a syscall through the ring, waking the kernel through the
+// doorbell if needed, and returns once the kernel blocked and continued
+// us, by signals or by parking in fast-switch mode
+void send_app_syscall(app_t *app, shm_t *shm, int doorbell_fd,
+                      bool fast_switch, syscall_t call);
@@ -0,0 +1,403 @@
+#include "appcore.h"
+#include "cfg.h"
+#include "hist.h"
+#include "types.h"
+#include "util.h"
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Apps taking part in the benchmarks, two are enough to switch between
+#define BENCH_APP_AMOUNT 2
+
+// State shared between the bench kernel and its children
+typedef struct {
+  _Atomic uint32_t conts;      // SIGCONT handlers run by the apps
+  _Atomic uint32_t dispatches; // Dispatches completed by the kernel
+  uint64_t cont_ns;            // When the last SIGCONT handler ran
+  hist_t syscall_block;        // Recorded by the app, single writer
+} bench_shared_t;
+
+// Shared memory segment between apps and kernel
+static shm_t *shm;
+// Bench state, mapped before forking
+static bench_shared_t *shared;
+// Iterations of each benchmark
+static long iterations = BENCH_ITERATIONS;
+
+// Tells the bench kernel the app restored its context
+static void acknowledge_cont(void) {
+  shared->cont_ns = get_time_ns();
+  atomic_fetch_add(&shared->conts, 1);
+  futex_wake(&shared->conts);
+}
+
+// App side, running the same paths as app.c without the app loop
+static app_t app = {.counter = 0};
+static uint64_t app_submit_ns;
+
+// Called when app receives SIGUSR1, notes when a syscall got blocked
+static void handle_kernel_stop(int signum) {
+  if (app_waiting_syscall_block) {
+    hist_record(&shared->syscall_block, get_time_ns() - app_submit_ns);
+  }
+
+  stop_app_process(&app, shm);
+}
+
+// Called when app receives SIGCONT, acknowledges a restored context
+static void handle_kernel_cont(int signum) {
+  if (continue_app_process(&app, shm)) {
+    acknowledge_cont();
+  }
+}
+
+// Forks an app that starts stopped. With doorbell_fd != -1 it submits
+// syscalls in a loop, otherwise it just waits to be switched
+static pid_t spawn_app(int id, int doorbell_fd) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Fork error\n");
+    exit(2);
+  }
+  if (pid > 0)
+    return pid;
+
+  app.app_id = id;
+  init_app_context(&app, shm);
+  if (signal(SIGUSR1, handle_kernel_stop) == SIG_ERR ||
+      signal(SIGCONT, handle_kernel_cont) == SIG_ERR) {
+    fprintf(stderr, "Signal error\n");
+    exit(4);
+  }
+
+  raise(SIGSTOP);
+
+  if (doorbell_fd != -1) {
+    for (long i = 0; i < iterations; i++) {
+      app_submit_ns = get_time_ns();
+      send_app_syscall(&app, shm, doorbell_fd, false, SYSCALL_D1_R);
+    }
+    _exit(0); // don't flush the parent's buffered stdout again
+  }
+
+  for (;;) {
+    pause();
+  }
+}
+
+// Waits until an app has stopped itself, like kernelsim does before
+// continuing it
+static void wait_app_stopped(pid_t pid) {
+  siginfo_t info;
+
+  while (waitid(P_PID, pid, &info, WSTOPPED | WNOWAIT) == -1 &&
+         errno == EINTR)
+    ;
+}
+
+// Waits until a futex counter moves past the given value
+static void wait_counter(_Atomic uint32_t *addr, uint32_t value) {
+  while (atomic_load(addr) == value) {
+    futex_wait(addr, value, NULL);
+  }
+}
+
+// Continues an app from the kernel side, releasing its handshake
+static void continue_app(int id, pid_t pid) {
+  wait_app_stopped(pid);
+  end_app_handshake(&shm->ctxs[id]);
+  kill(pid, SIGCONT);
+}
+
+// Kills an app and collects it
+static void reap_app(pid_t pid) {
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+}
+
+// SIGUSR1 -> handle_kernel_stop -> SIGSTOP -> SIGCONT -> handle_kernel_cont
+static void bench_stop_cont(void) {
+  hist_t total, stop, cont;
+  hist_init(&total);
+  hist_init(&stop);
+  hist_init(&cont);
+
+  pid_t pid = spawn_app(0, -1);
+  uint32_t first_conts = atomic_load(&shared->conts);
+  continue_app(0, pid);
+  wait_counter(&shared->conts, first_conts);
+
+  for (long i = 0; i < iterations; i++) {
+    uint32_t conts = atomic_load(&shared->conts);
+
+    uint64_t begin_ns = get_time_ns();
+    try_begin_preempt(&shm->ctxs[0]);
+    kill(pid, SIGUSR1);
+    wait_app_stopped(pid);
+    uint64_t stopped_ns = get_time_ns();
+
+    end_app_handshake(&shm->ctxs[0]);
+    kill(pid, SIGCONT);
+    wait_counter(&shared->conts, conts);
+
+    hist_record(&stop, stopped_ns - begin_ns);
+    hist_record(&cont, shared->cont_ns - stopped_ns);
+    hist_record(&total, shared->cont_ns - begin_ns);
+  }
+
+  reap_app(pid);
+
+  hist_print(&stop, "stop (kill->stopped)");
+  hist_print(&cont, "cont (kill->handler)");
+  hist_print(&total, "stop-to-continue");
+}
+
+// Fast-switch mode: park request -> parked -> resumed -> context restored
+static void bench_park_resume(void) {
+  hist_t total, park, resume;
+  hist_init(&total);
+  hist_init(&park);
+  hist_init(&resume);
+
+  app_ctx_t *ctx = &shm->ctxs[0];
+  atomic_store(&ctx->run_word, RUN_WORD_BOOTING);
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Fork error\n");
+    exit(2);
+  }
+  if (pid == 0) {
+    // App side, parking at its only safe point
+    app.app_id = 0;
+    init_app_context(&app, shm);
+    park_app(ctx);
+    for (;;) {
+      if (wait_park_request(ctx, NULL)) {
+        park_app_at_safe_point(&app, shm);
+        acknowledge_cont();
+      }
+    }
+  }
+
+  wait_app_parked(ctx);
+  end_app_handshake(ctx);
+  resume_app(ctx);
+
+  for (long i = 0; i < iterations; i++) {
+    uint32_t conts = atomic_load(&shared->conts);
+
+    uint64_t begin_ns = get_time_ns();
+    try_begin_preempt(ctx);
+    request_app_park(ctx);
+    wait_app_parked(ctx);
+    uint64_t parked_ns = get_time_ns();
+
+    end_app_handshake(ctx);
+    resume_app(ctx);
+    wait_counter(&shared->conts, conts);
+
+    hist_record(&park, parked_ns - begin_ns);
+    hist_record(&resume, shared->cont_ns - parked_ns);
+    hist_record(&total, shared->cont_ns - begin_ns);
+  }
+
+  reap_app(pid);
+  atomic_store(&ctx->handshake, HANDSHAKE_IDLE);
+
+  hist_print(&park, "park (request->parked)");
+  hist_print(&resume, "resume (store->restored)");
+  hist_print(&total, "park-to-resume");
+}
+
+// IRQ_TIME written by an intersim stand-in, read by epoll and dispatched
+// between two apps the same way dispatch_next_app does
+static void bench_irq_dispatch(void) {
+  hist_t latency;
+  hist_init(&latency);
+
+  pid_t app_pids[BENCH_APP_AMOUNT];
+  for (int i = 0; i < BENCH_APP_AMOUNT; i++) {
+    app_pids[i] = spawn_app(i, -1);
+  }
+  int running = 0;
+  continue_app(running, app_pids[running]);
+
+  int interpipe_fd[2];
+  if (pipe(interpipe_fd) == -1) {
+    fprintf(stderr, "Pipe error\n");
+    exit(8);
+  }
+
+  pid_t intersim_pid = fork();
+  if (intersim_pid == -1) {
+    fprintf(stderr, "Fork error\n");
+    exit(2);
+  }
+  if (intersim_pid == 0) {
+    close(interpipe_fd[PIPE_READ]);
+
+    // Send one tick at a time, waiting until it's dispatched
+    for (long i = 0; i < iterations; i++) {
+      irq_msg_t irq_msg = {
+          .irq = IRQ_TIME, .cpu_id = 0, .timestamp_ns = get_time_ns()};
+      struct iovec iov = {&irq_msg, sizeof(irq_msg)};
+
+      writev(interpipe_fd[PIPE_WRITE], &iov, 1);
+      wait_counter(&shared->dispatches, (uint32_t)i);
+    }
+    _exit(0);
+  }
+  close(interpipe_fd[PIPE_WRITE]);
+
+  int epoll_fd = epoll_create1(0);
+  struct epoll_event ev = {.events = EPOLLIN,
+                           .data.fd = interpipe_fd[PIPE_READ]};
+  if (epoll_fd == -1 ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, interpipe_fd[PIPE_READ], &ev) == -1) {
+    fprintf(stderr, "Epoll error\n");
+    exit(14);
+  }
+
+  for (long i = 0; i < iterations;) {
+    if (epoll_wait(epoll_fd, &ev, 1, -1) <= 0)
+      continue;
+
+    irq_msg_t irq_msg;
+    if (read(interpipe_fd[PIPE_READ], &irq_msg, sizeof(irq_msg)) !=
+        sizeof(irq_msg))
+      continue;
+
+    // Pause the running app and continue the other one
+    int next = (running + 1) % BENCH_APP_AMOUNT;
+    if (try_begin_preempt(&shm->ctxs[running])) {
+      kill(app_pids[running], SIGUSR1);
+    }
+    continue_app(next, app_pids[next]);
+    running = next;
+
+    hist_record(&latency, get_time_ns() - irq_msg.timestamp_ns);
+
+    i++;
+    atomic_fetch_add(&shared->dispatches, 1);
+    futex_wake(&shared->dispatches);
+  }
+
+  waitpid(intersim_pid, NULL, 0);
+  for (int i = 0; i < BENCH_APP_AMOUNT; i++) {
+    reap_app(app_pids[i]);
+  }
+  close(interpipe_fd[PIPE_READ]);
+  close(epoll_fd);
+
+  hist_print(&latency, "IRQ_TIME->dispatch");
+}
+
+// Syscall submitted through the ring and doorbell, blocked by the kernel
+// with SIGUSR1 like handle_app_syscall, then continued right away
+static void bench_syscall_block(void) {
+  hist_init(&shared->syscall_block);
+
+  int doorbell_fd = eventfd(0, EFD_NONBLOCK);
+  if (doorbell_fd == -1) {
+    fprintf(stderr, "Eventfd error\n");
+    exit(15);
+  }
+
+  syscall_ring_t *syscall_ring = get_syscall_ring(shm);
+
+  pid_t pid = spawn_app(0, doorbell_fd);
+  continue_app(0, pid);
+
+  int epoll_fd = epoll_create1(0);
+  struct epoll_event ev = {.events = EPOLLIN, .data.fd = doorbell_fd};
+  if (epoll_fd == -1 ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, doorbell_fd, &ev) == -1) {
+    fprintf(stderr, "Epoll error\n");
+    exit(14);
+  }
+
+  for (long handled = 0; handled < iterations;) {
+    if (epoll_wait(epoll_fd, &ev, 1, -1) <= 0)
+      continue;
+
+    uint64_t rings;
+    syscall_request_t request;
+    read(doorbell_fd, &rings, sizeof(rings));
+
+    do {
+      while (pop_syscall_request(syscall_ring, &request)) {
+        // Block, then unblock as if the device answered immediately
+        kill(pid, SIGUSR1);
+        continue_app(request.app_id, pid);
+        handled++;
+      }
+    } while (!arm_syscall_doorbell(syscall_ring));
+  }
+
+  waitpid(pid, NULL, 0);
+  close(doorbell_fd);
+  close(epoll_fd);
+
+  hist_print(&shared->syscall_block, "syscall submit->block");
+}
+
+// Prints command line usage
+static void print_usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-i iterations]\n", prog);
+}
+
+int main(int argc, char **argv) {
+  // The app paths log, which would be measured too
+  log_set_level(LOG_LEVEL_ERROR);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:")) != -1) {
+    switch (opt) {
+    case 'i':
+      iterations = atol(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      exit(16);
+    }
+  }
+  if (iterations <= 0) {
+    print_usage(argv[0]);
+    exit(16);
+  }
+
+  shared = (bench_shared_t *)mmap(NULL, sizeof(bench_shared_t),
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    fprintf(stderr, "Shm alloc error\n");
+    exit(3);
+  }
+
+  char shm_name[32];
+  snprintf(shm_name, sizeof(shm_name), SHM_NAME_PREFIX "bench_%d", getpid());
+  shm = create_shm(shm_name, BENCH_APP_AMOUNT, SWITCH_SIGNAL, 0);
+
+  printf("%ld iterations per benchmark\n", iterations);
+  bench_stop_cont();
+  bench_park_resume();
+  bench_irq_dispatch();
+  bench_syscall_block();
+
+  destroy_shm(shm, shm_name);
+  munmap(shared, sizeof(bench_shared_t));
+
+  return 0;
+}
@@ -1,22 +1,143 @@
 #pragma once
 
-// Show debug logging on console
+// Show debug logging on console, can be changed at runtime with the
+// KERNELSIM_LOG_LEVEL environment variable (error, info or debug)
 #define DEBUG
+// Capacity of each process' log record ring, must be a power of two
+#define LOG_RING_SIZE 4096
+// Max log records per second in each category, 0 for unlimited
+#define LOG_RATE_LIMIT 1000
+
+// Defaults of the runtime configuration, which kernelsim -f and -o
+// override by the lowercase names, from APP_AMOUNT to VM_SWAP_DEVICE except
+// WORKLOAD_MIX, SCHED_MLFQ_LEVELS and the scheduler weights
 
 // How many application processes should be created
 #define APP_AMOUNT 3
+// How many simulated CPUs run apps at the same time
+#define CPU_AMOUNT 1
 // Program counter value at which the apps terminate
 #define APP_MAX_PC 5
 // How long should +1 counter increment take
 #define APP_SLEEP_TIME_MS 1000
 // Percentage chance of app sending a syscall during each iteration
 #define APP_SYSCALL_PROB 15
+// Working set of each app in KB, saved along with a register file whenever
+// the app is switched out. Only the chunks written since the last save are
+// copied
+#define APP_CONTEXT_KB 16
+// Words of its working set each app writes on every iteration
+#define APP_CONTEXT_TOUCHES 8
+// 1 to hand the working set over by swapping the app's pointer to its shm
+// area instead of copying it, 0 to copy its dirty chunks
+#define APP_CONTEXT_ZERO_COPY 0
+// Workload profiles assigned to apps by ratio, as profile:weight pairs
+// (kernelsim -w). Profiles are uniform, cpu, io, bursty and heavytail
+#define WORKLOAD_MIX "uniform:1"
+// Iterations of each CPU or I/O phase of bursty apps
+#define WORKLOAD_PHASE_STEPS 2
+// Pareto shape of heavy-tailed run lengths, lower is heavier. Runs are at
+// least APP_MAX_PC and at most WORKLOAD_TAIL_MAX_FACTOR times that long
+#define WORKLOAD_TAIL_ALPHA 1.5
+#define WORKLOAD_TAIL_MAX_FACTOR 50
+// Percentage chance of a syscall per iteration of each profile, uniform
+// apps use APP_SYSCALL_PROB. Bursty apps use WORKLOAD_BURSTY_BURST_PROB in
+// their I/O phases
+#define WORKLOAD_CPU_SYSCALL_PROB 3
+#define WORKLOAD_IO_SYSCALL_PROB 60
+#define WORKLOAD_BURSTY_SYSCALL_PROB 3
+#define WORKLOAD_BURSTY_BURST_PROB 60
+#define WORKLOAD_HEAVYTAIL_SYSCALL_PROB 15
+// Relative odds of the D1 R/W/X then D2 R/W/X syscalls of each profile.
+// Configured as six numbers separated by colons, like 4:3:0:2:1:0
+#define WORKLOAD_UNIFORM_WEIGHTS {1, 1, 1, 1, 1, 1}
+#define WORKLOAD_CPU_WEIGHTS {0, 0, 2, 0, 0, 1}
+#define WORKLOAD_IO_WEIGHTS {4, 3, 0, 2, 1, 0}
+#define WORKLOAD_BURSTY_WEIGHTS {2, 2, 1, 2, 2, 1}
+#define WORKLOAD_HEAVYTAIL_WEIGHTS {1, 1, 1, 1, 1, 1}
 
-// How often to generate a timeslice interrupt
-#define INTERSIM_SLEEP_TIME_MS 500
+// How often to generate a timeslice interrupt, in microseconds. Ticks follow
+// absolute deadlines, so sub-millisecond periods don't drift either
+#define INTERSIM_TICK_US 500000
 // Percentage chance of generating a D1/D2 interrupt with each timeslice change
 #define INTERSIM_D1_INT_PROB 10
 #define INTERSIM_D2_INT_PROB 5
 
-// Name of dispatch semaphore
-#define DISPATCH_SEM_NAME "/kernelsim_dispatch_sem"
+// Service time of device requests in the service model (kernelsim -d
+// service), per operation: DIST_FIXED, DIST_EXP or DIST_BIMODAL, and the
+// base time in microseconds. Configured as fixed, exp or bimodal
+#define DEVICE_READ_DIST DIST_EXP
+#define DEVICE_READ_US 300000
+#define DEVICE_WRITE_DIST DIST_BIMODAL
+#define DEVICE_WRITE_US 200000
+#define DEVICE_EXEC_DIST DIST_FIXED
+#define DEVICE_EXEC_US 500000
+// Percentage of bimodal requests that are slow, and how many times slower
+#define DEVICE_BIMODAL_SLOW_PROB 10
+#define DEVICE_BIMODAL_SLOW_FACTOR 8
+// Interrupt coalescing: a device interrupt completes every finished request
+// once this many are done, or this long after the oldest one finished.
+// A count of 1 raises an interrupt per request
+#define DEVICE_COALESCE_COUNT 4
+#define DEVICE_COALESCE_US 100000
+
+// Priority levels of the MLFQ policy, level i timeslices last 2^i ticks
+#define SCHED_MLFQ_LEVELS 3
+// How often every app is moved back to the top MLFQ level, in ticks
+#define SCHED_MLFQ_BOOST_TICKS 20
+// Share of every app: lottery tickets, stride and CFS weight
+#define SCHED_DEFAULT_WEIGHT 1024
+// Stride of an app with a single ticket
+#define SCHED_STRIDE1 (1 << 20)
+
+// Virtual pages of each app, 0 disables the memory subsystem
+#define VM_PAGES 0
+// Physical frames shared by every app
+#define VM_FRAMES 64
+// Entries of the TLB of each CPU, flushed when it switches apps
+#define VM_TLB_ENTRIES 16
+// Memory accesses of a running app in each tick
+#define VM_ACCESSES_PER_TICK 64
+// Percentage of accesses within the app's current hot pages, the rest are
+// uniform over its address space. The hot pages move every
+// VM_PHASE_ACCESSES accesses
+#define VM_LOCALITY 90
+#define VM_HOT_PAGES 8
+#define VM_PHASE_ACCESSES 1024
+// Page replacement: VM_REPLACEMENT_CLOCK, VM_REPLACEMENT_LRU or
+// VM_REPLACEMENT_WS. Configured as clock, lru or ws
+#define VM_REPLACEMENT VM_REPLACEMENT_CLOCK
+// Working set window of the ws policy, in accesses of the page's owner
+#define VM_WS_WINDOW 512
+// Device page faults block on and are served by, 1 or 2
+#define VM_SWAP_DEVICE 2
+
+// Max events in the binary trace file written with kernelsim -t
+#define TRACE_MAX_EVENTS (1 << 20)
+
+// How often kernelstat refreshes its view, in milliseconds
+#define KERNELSTAT_REFRESH_MS 100
+// Apps shown by kernelstat, busiest first
+#define KERNELSTAT_ROWS 20
+// Time kernelstat waits for a segment kernelsim is still setting up
+#define KERNELSTAT_ATTACH_WAIT_MS 1000
+
+// Iterations of each benchmark run by make bench
+#define BENCH_ITERATIONS 1000000
+
+// Prefix of the shm segment name, followed by the kernelsim pid
+#define SHM_NAME_PREFIX "/kernelsim_shm_"
+// Prefix of the live stats segment name, followed by the kernelsim pid
+#define STATS_NAME_PREFIX "/kernelsim_stats_"
+// Back the shm segment with huge pages, needs shmem transparent huge pages
+// #define SHM_HUGE_PAGES
+// Huge page size the shm segment is rounded up to
+#define SHM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Granularity of the dirty tracking of app working sets, in bytes
+#define CONTEXT_CHUNK_SIZE 4096
+
+// Stack size of each app coroutine, only touched pages get backed
+#define CORO_STACK_SIZE (32 * 1024)
+// Coroutine stacks mapped at once whenever the stack pool runs out
+#define CORO_POOL_CHUNK 64
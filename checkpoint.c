@@ -0,0 +1,161 @@
+#include "checkpoint.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Rounds up to the alignment of sections
+static uint64_t align_up(uint64_t offset) {
+  return (offset + CHECKPOINT_ALIGN - 1) & ~(uint64_t)(CHECKPOINT_ALIGN - 1);
+}
+
+static checkpoint_t *alloc_checkpoint(void) {
+  checkpoint_t *ckpt = (checkpoint_t *)calloc(1, sizeof(checkpoint_t));
+  if (ckpt == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  return ckpt;
+}
+
+// Writes bytes at the given offset of the image
+static void write_at(checkpoint_t *ckpt, uint64_t offset, const void *data,
+                     size_t size) {
+  if (fseek(ckpt->file, offset, SEEK_SET) == -1 ||
+      (size > 0 && fwrite(data, size, 1, ckpt->file) != 1)) {
+    fprintf(stderr, "Checkpoint file error\n");
+    exit(22);
+  }
+}
+
+checkpoint_t *checkpoint_create(const char *path,
+                                const checkpoint_header_t *header) {
+  checkpoint_t *ckpt = alloc_checkpoint();
+
+  ckpt->file = fopen(path, "wb");
+  if (ckpt->file == NULL) {
+    fprintf(stderr, "Checkpoint file error\n");
+    exit(22);
+  }
+
+  ckpt->header = *header;
+  ckpt->header.magic = CHECKPOINT_MAGIC;
+  ckpt->header.version = CHECKPOINT_VERSION;
+  ckpt->header.section_count = 0;
+  // The header is written last, once the table is complete
+  ckpt->size = align_up(sizeof(checkpoint_header_t));
+
+  return ckpt;
+}
+
+void checkpoint_write(checkpoint_t *ckpt, const char *name, const void *data,
+                      size_t size) {
+  checkpoint_header_t *header = &ckpt->header;
+
+  if (header->section_count == CHECKPOINT_MAX_SECTIONS ||
+      strlen(name) >= sizeof(header->sections[0].name)) {
+    fprintf(stderr, "Checkpoint file error\n");
+    exit(22);
+  }
+
+  checkpoint_section_t *section = &header->sections[header->section_count++];
+  strcpy(section->name, name);
+  section->offset = ckpt->size;
+  section->size = size;
+
+  write_at(ckpt, section->offset, data, size);
+  ckpt->size = align_up(section->offset + size);
+}
+
+void checkpoint_finish(checkpoint_t *ckpt) {
+  write_at(ckpt, 0, &ckpt->header, sizeof(checkpoint_header_t));
+
+  // Pad the last section, so the file is as long as the mapping reads
+  if (ftruncate(fileno(ckpt->file), ckpt->size) == -1 ||
+      fclose(ckpt->file) != 0) {
+    fprintf(stderr, "Checkpoint file error\n");
+    exit(22);
+  }
+  free(ckpt);
+}
+
+checkpoint_t *checkpoint_open(const char *path) {
+  checkpoint_t *ckpt = alloc_checkpoint();
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+
+  if (fd == -1 || fstat(fd, &st) == -1 ||
+      (size_t)st.st_size < sizeof(checkpoint_header_t)) {
+    fprintf(stderr, "Checkpoint file error\n");
+    exit(22);
+  }
+
+  ckpt->size = st.st_size;
+  ckpt->map = (uint8_t *)mmap(NULL, ckpt->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ckpt->map == MAP_FAILED) {
+    fprintf(stderr, "Checkpoint mmap error\n");
+    exit(22);
+  }
+
+  const checkpoint_header_t *header = (const checkpoint_header_t *)ckpt->map;
+  bool valid = header->magic == CHECKPOINT_MAGIC &&
+               header->version == CHECKPOINT_VERSION &&
+               header->section_count <= CHECKPOINT_MAX_SECTIONS &&
+               header->config.app_amount > 0 && header->config.cpu_amount > 0;
+  for (uint32_t i = 0; valid && i < header->section_count; i++) {
+    const checkpoint_section_t *section = &header->sections[i];
+
+    valid = section->offset <= ckpt->size &&
+            section->size <= ckpt->size - section->offset;
+  }
+  if (!valid) {
+    fprintf(stderr, "Checkpoint version mismatch\n");
+    exit(22);
+  }
+  ckpt->header = *header;
+
+  return ckpt;
+}
+
+const void *checkpoint_section(const checkpoint_t *ckpt, const char *name,
+                               size_t size) {
+  for (uint32_t i = 0; i < ckpt->header.section_count; i++) {
+    const checkpoint_section_t *section = &ckpt->header.sections[i];
+
+    if (strncmp(section->name, name, sizeof(section->name)) != 0)
+      continue;
+
+    if (section->size != size)
+      break;
+    return ckpt->map + section->offset;
+  }
+
+  fprintf(stderr, "Checkpoint section %s missing\n", name);
+  exit(22);
+}
+
+void checkpoint_read(const checkpoint_t *ckpt, const char *name, void *data,
+                     size_t size) {
+  memcpy(data, checkpoint_section(ckpt, name, size), size);
+}
+
+void checkpoint_close(checkpoint_t *ckpt) {
+  munmap(ckpt->map, ckpt->size);
+  free(ckpt);
+}
+
+bool checkpoint_config_compatible(const config_t *image,
+                                  const config_t *config) {
+  return image->app_amount == config->app_amount &&
+         image->cpu_amount == config->cpu_amount &&
+         image->app_context_kb == config->app_context_kb &&
+         image->app_context_zero_copy == config->app_context_zero_copy &&
+         image->vm_pages == config->vm_pages &&
+         image->vm_frames == config->vm_frames &&
+         image->vm_tlb_entries == config->vm_tlb_entries &&
+         image->vm_replacement == config->vm_replacement;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "config.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Checkpoint image of a virtual-time run. A header with the parameters of
+// the run and a table of named sections, each holding the raw state of a
+// module, aligned so the whole file can be mapped and every section read
+// in place. A run restored from it goes on exactly as the checkpointed one
+// would have, without replaying anything
+
+#define CHECKPOINT_MAGIC 0x54504b43 // "CKPT"
+#define CHECKPOINT_VERSION 2
+// Max sections in an image
+#define CHECKPOINT_MAX_SECTIONS 64
+// Alignment of every section in the file
+#define CHECKPOINT_ALIGN 64
+
+// Entry of the section table
+typedef struct {
+  char name[24];
+  uint64_t offset; // From the start of the file
+  uint64_t size;   // In bytes
+} checkpoint_section_t;
+
+// Header at the start of the image. The parameters the restored run
+// depends on are taken from here
+typedef struct {
+  uint32_t magic;        // CHECKPOINT_MAGIC
+  uint32_t version;      // CHECKPOINT_VERSION
+  config_t config;       // Configuration of the run
+  uint32_t seed;         // Base seed of the run
+  uint32_t sched_policy; // sched_policy_t
+  uint32_t device_model; // device_model_t
+  int32_t workload_weights[WORKLOAD_AMOUNT]; // Workload mix of the apps
+  uint64_t time_ns;      // Virtual time it was taken at
+  uint32_t section_count;
+  checkpoint_section_t sections[CHECKPOINT_MAX_SECTIONS];
+} checkpoint_header_t;
+
+// Image being written, or mapped for a restore
+typedef struct {
+  checkpoint_header_t header;
+  FILE *file;     // While writing
+  uint64_t size;  // Bytes written, or mapped
+  uint8_t *map;   // While restoring
+} checkpoint_t;
+
+// Creates an image with the given run parameters, filled in as sections
+// are written
+checkpoint_t *checkpoint_create(const char *path,
+                                const checkpoint_header_t *header);
+
+// Appends a section with a copy of the given bytes
+void checkpoint_write(checkpoint_t *ckpt, const char *name, const void *data,
+                      size_t size);
+
+// Writes the section table and closes the file
+void checkpoint_finish(checkpoint_t *ckpt);
+
+// Maps an image read-only and validates its header and section table
+checkpoint_t *checkpoint_open(const char *path);
+
+// Returns a section in the mapping, which must be exactly size bytes
+const void *checkpoint_section(const checkpoint_t *ckpt, const char *name,
+                               size_t size);
+
+// Copies a section of exactly size bytes
+void checkpoint_read(const checkpoint_t *ckpt, const char *name, void *data,
+                     size_t size);
+
+// Unmaps an image opened for a restore
+void checkpoint_close(checkpoint_t *ckpt);
+
+// Whether a restored run can use a configuration changed from the image's.
+// Keys that size the saved state can't change
+bool checkpoint_config_compatible(const config_t *image,
+                                  const config_t *config);
@@ -0,0 +1,321 @@
+#include "coapps.h"
+#include "appcore.h"
+#include "cfg.h"
+#include "coro.h"
+#include "util.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Wake time of an app waiting for the kernel to block it on a syscall
+#define WAKE_NEVER UINT64_MAX
+
+// App running as a coroutine inside kernelsim
+typedef struct {
+  app_t app;
+  coro_t *coro;          // NULL until first continued, and after finishing
+  uint64_t wake_ns;      // When its current sleep ends, while continued
+  uint64_t remaining_ns; // Sleep left when it was stopped
+  int running_index;     // Position in running_ids, or -1 while stopped
+} coapp_t;
+
+// Shared memory segment between apps and kernel
+static shm_t *shm;
+// Array of coroutine apps, indexed by app_id
+static coapp_t *coapps;
+static int coapp_amount;
+// Continued apps, one per CPU plus the ones waiting to be blocked
+static int *running_ids;
+static int running_amount = 0;
+// Told about every new wake time, used by the discrete-event mode
+static coapp_wake_fn_t wake_callback;
+
+static void add_running(coapp_t *co) {
+  co->running_index = running_amount;
+  running_ids[running_amount++] = co->app.app_id;
+}
+
+static void remove_running(coapp_t *co) {
+  int last_id = running_ids[--running_amount];
+
+  running_ids[co->running_index] = last_id;
+  coapps[last_id].running_index = co->running_index;
+  co->running_index = -1;
+}
+
+// Yields until the kernel has the app continued and the time has passed
+static void sleep_coapp(void *arg, uint64_t duration_ns) {
+  coapp_t *co = (coapp_t *)arg;
+
+  co->wake_ns = get_time_ns() + duration_ns;
+  if (wake_callback != NULL) {
+    wake_callback(co->wake_ns);
+  }
+  coro_yield();
+}
+
+// Publishes a syscall request, then yields until blocked and continued
+static void send_coapp_syscall(void *arg, syscall_t call) {
+  coapp_t *co = (coapp_t *)arg;
+  int app_id = co->app.app_id;
+
+  // Never waits, the kernel can't preempt a coroutine while it runs
+  begin_app_syscall(&shm->ctxs[app_id]);
+
+  // There should be no pending syscalls
+  assert(get_app_syscall(shm, app_id) == SYSCALL_NONE);
+
+  cdmsg(LOG_CAT_SYSCALL, "App %d started syscall: %s", app_id + 1,
+        SYSCALL_STR[call]);
+
+  // The kernel drains the ring right after running us, no doorbell needed
+  set_app_syscall(shm, app_id, call);
+  push_syscall_request(get_syscall_ring(shm), app_id, call);
+
+  co->wake_ns = WAKE_NEVER;
+  coro_yield();
+}
+
+// Publishes SYSCALL_APP_FINISHED, the coroutine returns right after
+static void finish_coapp(void *arg) {
+  coapp_t *co = (coapp_t *)arg;
+
+  submit_app_finished(&co->app, shm, false);
+}
+
+// Engine of coroutine apps, switched by kernelsim with stack swaps
+static const app_engine_t coroutine_engine = {
+    .sleep = sleep_coapp,
+    .send_syscall = send_coapp_syscall,
+    .finish = finish_coapp,
+};
+
+// Body of every app coroutine
+static void coapp_main(void *arg) {
+  coapp_t *co = (coapp_t *)arg;
+
+  run_app_loop(&co->app, &coroutine_engine, co);
+
+  cmsg(LOG_CAT_APP, "App %d finished", co->app.app_id + 1);
+}
+
+void coapps_init(shm_t *app_shm, int app_amount, unsigned int base_seed,
+                 coapp_wake_fn_t on_wake) {
+  shm = app_shm;
+  coapp_amount = app_amount;
+  wake_callback = on_wake;
+  coapps = (coapp_t *)calloc(app_amount, sizeof(coapp_t));
+  running_ids = (int *)malloc(app_amount * sizeof(int));
+  if (coapps == NULL || running_ids == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  for (int i = 0; i < app_amount; i++) {
+    coapps[i].app.app_id = i;
+    seed_app_prng(&coapps[i].app, base_seed);
+    load_app_workload(&coapps[i].app, shm);
+    init_app_context(&coapps[i].app, shm);
+    coapps[i].running_index = -1;
+  }
+}
+
+void coapps_free(void) {
+  for (int i = 0; i < coapp_amount; i++) {
+    if (coapps[i].coro != NULL) {
+      coro_destroy(coapps[i].coro);
+    }
+    context_free(&coapps[i].app.context);
+  }
+
+  coro_pool_free();
+  free(coapps);
+  free(running_ids);
+}
+
+void coapp_stop(int app_id) {
+  coapp_t *co = &coapps[app_id];
+
+  if (co->running_index != -1) {
+    uint64_t now = get_time_ns();
+
+    // Apps blocked on a syscall have no sleep left
+    co->remaining_ns = (co->wake_ns != WAKE_NEVER && co->wake_ns > now)
+                           ? co->wake_ns - now
+                           : 0;
+    remove_running(co);
+  }
+
+  save_app_context(&co->app, shm);
+}
+
+void coapp_continue(int app_id) {
+  coapp_t *co = &coapps[app_id];
+
+  assert(co->running_index == -1);
+
+  // Boot the app on its first timeslice
+  if (co->coro == NULL) {
+    cdmsg(LOG_CAT_APP, "App %d booting", app_id + 1);
+    co->coro = coro_create(coapp_main, co);
+  }
+
+  restore_app_context(&co->app, shm);
+
+  co->wake_ns = get_time_ns() + co->remaining_ns;
+  co->remaining_ns = 0;
+  add_running(co);
+  if (wake_callback != NULL) {
+    wake_callback(co->wake_ns);
+  }
+}
+
+int coapps_run_due(void) {
+  uint64_t now = get_time_ns();
+  int ran = 0;
+
+  // Backwards, so finished apps can be swapped out of the set
+  for (int i = running_amount - 1; i >= 0; i--) {
+    coapp_t *co = &coapps[running_ids[i]];
+
+    if (co->wake_ns > now)
+      continue;
+
+    coro_resume(co->coro);
+    ran++;
+
+    if (coro_finished(co->coro)) {
+      coro_destroy(co->coro);
+      co->coro = NULL;
+      remove_running(co);
+    }
+  }
+
+  return ran;
+}
+
+int coapps_next_wake_ms(void) {
+  uint64_t next_ns = WAKE_NEVER;
+
+  for (int i = 0; i < running_amount; i++) {
+    if (coapps[running_ids[i]].wake_ns < next_ns) {
+      next_ns = coapps[running_ids[i]].wake_ns;
+    }
+  }
+
+  if (next_ns == WAKE_NEVER)
+    return -1;
+
+  uint64_t now = get_time_ns();
+  return next_ns > now ? (int)((next_ns - now + 999999) / 1000000) : 0;
+}
+
+// State of a coroutine app in a checkpoint
+typedef struct {
+  int counter;
+  int run_steps;
+  prng_t prng;
+  reg_file_t regs;
+  bool in_syscall;
+  bool booted;             // Had a coroutine
+  bool working_set_dropped; // Zero-copy working set handed back to shm
+  int running_index;
+  uint64_t wake_ns;
+  uint64_t remaining_ns;
+} coapp_image_t;
+
+void coapps_checkpoint(checkpoint_t *ckpt) {
+  coapp_image_t *images =
+      (coapp_image_t *)calloc(coapp_amount, sizeof(coapp_image_t));
+  const app_context_t *first = &coapps[0].app.context;
+  bool copies = !first->zero_copy;
+  size_t size = first->size, chunks = first->chunks;
+  uint8_t *buf = (uint8_t *)malloc(copies ? coapp_amount * (size + 2 * chunks)
+                                          : 1);
+
+  if (images == NULL || buf == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  for (int i = 0; i < coapp_amount; i++) {
+    const coapp_t *co = &coapps[i];
+    const app_context_t *ctx = &co->app.context;
+
+    images[i] = (coapp_image_t){
+        .counter = co->app.counter,
+        .run_steps = co->app.run_steps,
+        .prng = co->app.prng,
+        .regs = ctx->regs,
+        .in_syscall = co->app.in_syscall,
+        .booted = co->coro != NULL,
+        .working_set_dropped = ctx->working_set == NULL,
+        .running_index = co->running_index,
+        .wake_ns = co->wake_ns,
+        .remaining_ns = co->remaining_ns,
+    };
+    // Private copies with their chunk flags, one app after another
+    if (copies) {
+      uint8_t *app_buf = buf + i * (size + 2 * chunks);
+
+      memcpy(app_buf, ctx->buffer, size);
+      memcpy(app_buf + size, ctx->dirty, chunks);
+      memcpy(app_buf + size + chunks, ctx->lost, chunks);
+    }
+  }
+
+  checkpoint_write(ckpt, "coapps", images,
+                   coapp_amount * sizeof(coapp_image_t));
+  checkpoint_write(ckpt, "coapps.contexts", buf,
+                   copies ? coapp_amount * (size + 2 * chunks) : 0);
+
+  free(images);
+  free(buf);
+}
+
+void coapps_restore(const checkpoint_t *ckpt) {
+  const coapp_image_t *images = (const coapp_image_t *)checkpoint_section(
+      ckpt, "coapps", coapp_amount * sizeof(coapp_image_t));
+  const app_context_t *first = &coapps[0].app.context;
+  bool copies = !first->zero_copy;
+  size_t size = first->size, chunks = first->chunks;
+  const uint8_t *buf = (const uint8_t *)checkpoint_section(
+      ckpt, "coapps.contexts",
+      copies ? coapp_amount * (size + 2 * chunks) : 0);
+
+  running_amount = 0;
+  for (int i = 0; i < coapp_amount; i++) {
+    coapp_t *co = &coapps[i];
+    app_context_t *ctx = &co->app.context;
+    const coapp_image_t *image = &images[i];
+
+    co->app.counter = image->counter;
+    co->app.run_steps = image->run_steps;
+    co->app.prng = image->prng;
+    co->app.in_syscall = image->in_syscall;
+    ctx->regs = image->regs;
+    if (copies) {
+      const uint8_t *app_buf = buf + i * (size + 2 * chunks);
+
+      memcpy(ctx->buffer, app_buf, size);
+      memcpy(ctx->dirty, app_buf + size, chunks);
+      memcpy(ctx->lost, app_buf + size + chunks, chunks);
+    } else if (image->working_set_dropped) {
+      ctx->working_set = NULL;
+    }
+
+    co->wake_ns = image->wake_ns;
+    co->remaining_ns = image->remaining_ns;
+    co->running_index = image->running_index;
+    if (co->running_index != -1) {
+      running_ids[co->running_index] = i;
+      running_amount++;
+    }
+
+    // Starts over in run_app_loop, right where the old one was suspended
+    if (image->booted) {
+      co->coro = coro_create(coapp_main, co);
+    }
+  }
+}
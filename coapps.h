@@ -0,0 +1,46 @@
+#pragma once
+
+#include "checkpoint.h"
+#include "types.h"
+
+// Coroutine engine, runs the app loop of every app as a coroutine inside
+// kernelsim instead of as a separate process. Apps still talk to the
+// kernel through their shm context slots and the syscall ring
+
+// Called whenever a continued app's sleep gets a new end time
+typedef void (*coapp_wake_fn_t)(uint64_t wake_ns);
+
+// Prepares app_amount coroutine apps using the given shm, seeding each one
+// from base_seed, with the workload profiles already assigned in shm. Each
+// coroutine and its stack are only created when its app is first
+// continued. on_wake may be NULL
+void coapps_init(shm_t *shm, int app_amount, unsigned int base_seed,
+                 coapp_wake_fn_t on_wake);
+
+// Destroys every coroutine and unmaps the stack pool
+void coapps_free(void);
+
+// Kernel side: stops an app, saving its context and the rest of its sleep
+void coapp_stop(int app_id);
+
+// Kernel side: continues an app, restoring its context. It runs again
+// once the rest of its sleep is over
+void coapp_continue(int app_id);
+
+// Runs every continued app whose sleep is over, until each one sleeps
+// again, submits a syscall or finishes.
+// Returns how many apps ran
+int coapps_run_due(void);
+
+// Milliseconds until the next continued app wakes up, rounded up,
+// or -1 if none will
+int coapps_next_wake_ms(void);
+
+// Writes the state of every app and of the running set to a checkpoint.
+// Apps are only ever suspended at a sleep or a syscall, and the app loop
+// picks up from their state, so no stack is saved
+void coapps_checkpoint(checkpoint_t *ckpt);
+
+// Restores the state written by coapps_checkpoint right after coapps_init,
+// with a fresh coroutine for every app that had booted and not finished
+void coapps_restore(const checkpoint_t *ckpt);
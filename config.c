@@ -0,0 +1,333 @@
+#include "config.h"
+#include "cfg.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+config_t config = {
+    .app_amount = APP_AMOUNT,
+    .cpu_amount = CPU_AMOUNT,
+    .app_max_pc = APP_MAX_PC,
+    .app_sleep_time_ms = APP_SLEEP_TIME_MS,
+    .app_syscall_prob = APP_SYSCALL_PROB,
+    .app_context_kb = APP_CONTEXT_KB,
+    .app_context_touches = APP_CONTEXT_TOUCHES,
+    .app_context_zero_copy = APP_CONTEXT_ZERO_COPY,
+    .workload_phase_steps = WORKLOAD_PHASE_STEPS,
+    .workload_tail_alpha = WORKLOAD_TAIL_ALPHA,
+    .workload_tail_max_factor = WORKLOAD_TAIL_MAX_FACTOR,
+    .workload_cpu_syscall_prob = WORKLOAD_CPU_SYSCALL_PROB,
+    .workload_io_syscall_prob = WORKLOAD_IO_SYSCALL_PROB,
+    .workload_bursty_syscall_prob = WORKLOAD_BURSTY_SYSCALL_PROB,
+    .workload_bursty_burst_prob = WORKLOAD_BURSTY_BURST_PROB,
+    .workload_heavytail_syscall_prob = WORKLOAD_HEAVYTAIL_SYSCALL_PROB,
+    .workload_weights = {WORKLOAD_UNIFORM_WEIGHTS, WORKLOAD_CPU_WEIGHTS,
+                         WORKLOAD_IO_WEIGHTS, WORKLOAD_BURSTY_WEIGHTS,
+                         WORKLOAD_HEAVYTAIL_WEIGHTS},
+    .intersim_tick_us = INTERSIM_TICK_US,
+    .intersim_d1_int_prob = INTERSIM_D1_INT_PROB,
+    .intersim_d2_int_prob = INTERSIM_D2_INT_PROB,
+    .device_dist = {DEVICE_READ_DIST, DEVICE_WRITE_DIST, DEVICE_EXEC_DIST},
+    .device_us = {DEVICE_READ_US, DEVICE_WRITE_US, DEVICE_EXEC_US},
+    .device_bimodal_slow_prob = DEVICE_BIMODAL_SLOW_PROB,
+    .device_bimodal_slow_factor = DEVICE_BIMODAL_SLOW_FACTOR,
+    .device_coalesce_count = DEVICE_COALESCE_COUNT,
+    .device_coalesce_us = DEVICE_COALESCE_US,
+    .sched_mlfq_boost_ticks = SCHED_MLFQ_BOOST_TICKS,
+    .vm_pages = VM_PAGES,
+    .vm_frames = VM_FRAMES,
+    .vm_tlb_entries = VM_TLB_ENTRIES,
+    .vm_accesses_per_tick = VM_ACCESSES_PER_TICK,
+    .vm_locality = VM_LOCALITY,
+    .vm_hot_pages = VM_HOT_PAGES,
+    .vm_phase_accesses = VM_PHASE_ACCESSES,
+    .vm_replacement = VM_REPLACEMENT,
+    .vm_ws_window = VM_WS_WINDOW,
+    .vm_swap_device = VM_SWAP_DEVICE,
+};
+
+// How a key's value is written
+typedef enum {
+  KEY_INT,    // Decimal integer
+  KEY_DOUBLE, // Decimal number
+  KEY_NAME,   // One of the key's names, stored as its index
+  KEY_WEIGHTS // WORKLOAD_SYSCALLS integers separated by colons, not all 0
+} key_type_t;
+
+// A configuration key and the range of its values
+typedef struct {
+  const char *name;
+  key_type_t type;
+  size_t offset; // Of its field in config_t
+  double min;
+  double max;         // Index of the last name of a KEY_NAME, or of each
+                      // integer of a KEY_WEIGHTS
+  const char **names; // Values of a KEY_NAME
+} config_key_t;
+
+#define INT_KEY(name, field, min, max)                                         \
+  {name, KEY_INT, offsetof(config_t, field), min, max, NULL}
+#define NAME_KEY(name, field, names, last)                                     \
+  {name, KEY_NAME, offsetof(config_t, field), 0, last, names}
+#define WEIGHTS_KEY(name, workload)                                            \
+  {name, KEY_WEIGHTS, offsetof(config_t, workload_weights[workload]), 0, 1000, \
+   NULL}
+
+// Every key, in the order config_format writes them
+static const config_key_t KEYS[] = {
+    INT_KEY("app_amount", app_amount, 1, APP_AMOUNT_MAX),
+    INT_KEY("cpu_amount", cpu_amount, 1, CPU_AMOUNT_MAX),
+    INT_KEY("app_max_pc", app_max_pc, 1, 1000000),
+    INT_KEY("app_sleep_time_ms", app_sleep_time_ms, 1, 3600000),
+    INT_KEY("app_syscall_prob", app_syscall_prob, 0, 100),
+    INT_KEY("app_context_kb", app_context_kb, 0, 65536),
+    INT_KEY("app_context_touches", app_context_touches, 0, 1000000),
+    INT_KEY("app_context_zero_copy", app_context_zero_copy, 0, 1),
+    INT_KEY("workload_phase_steps", workload_phase_steps, 1, 1000000),
+    {"workload_tail_alpha", KEY_DOUBLE, offsetof(config_t, workload_tail_alpha),
+     0.01, 100, NULL},
+    INT_KEY("workload_tail_max_factor", workload_tail_max_factor, 1, 10000),
+    INT_KEY("workload_cpu_syscall_prob", workload_cpu_syscall_prob, 0, 100),
+    INT_KEY("workload_io_syscall_prob", workload_io_syscall_prob, 0, 100),
+    INT_KEY("workload_bursty_syscall_prob", workload_bursty_syscall_prob, 0,
+            100),
+    INT_KEY("workload_bursty_burst_prob", workload_bursty_burst_prob, 0, 100),
+    INT_KEY("workload_heavytail_syscall_prob", workload_heavytail_syscall_prob,
+            0, 100),
+    WEIGHTS_KEY("workload_uniform_weights", WORKLOAD_UNIFORM),
+    WEIGHTS_KEY("workload_cpu_weights", WORKLOAD_CPU),
+    WEIGHTS_KEY("workload_io_weights", WORKLOAD_IO),
+    WEIGHTS_KEY("workload_bursty_weights", WORKLOAD_BURSTY),
+    WEIGHTS_KEY("workload_heavytail_weights", WORKLOAD_HEAVY_TAIL),
+    INT_KEY("intersim_tick_us", intersim_tick_us, 1, 60000000),
+    INT_KEY("intersim_d1_int_prob", intersim_d1_int_prob, 0, 100),
+    INT_KEY("intersim_d2_int_prob", intersim_d2_int_prob, 0, 100),
+    NAME_KEY("device_read_dist", device_dist[0], DIST_STR, DIST_BIMODAL),
+    INT_KEY("device_read_us", device_us[0], 1, 60000000),
+    NAME_KEY("device_write_dist", device_dist[1], DIST_STR, DIST_BIMODAL),
+    INT_KEY("device_write_us", device_us[1], 1, 60000000),
+    NAME_KEY("device_exec_dist", device_dist[2], DIST_STR, DIST_BIMODAL),
+    INT_KEY("device_exec_us", device_us[2], 1, 60000000),
+    INT_KEY("device_bimodal_slow_prob", device_bimodal_slow_prob, 0, 100),
+    INT_KEY("device_bimodal_slow_factor", device_bimodal_slow_factor, 1, 10000),
+    INT_KEY("device_coalesce_count", device_coalesce_count, 1, 65536),
+    INT_KEY("device_coalesce_us", device_coalesce_us, 0, 60000000),
+    INT_KEY("sched_mlfq_boost_ticks", sched_mlfq_boost_ticks, 1, 1000000),
+    INT_KEY("vm_pages", vm_pages, 0, 1048576),
+    INT_KEY("vm_frames", vm_frames, 1, 1048576),
+    INT_KEY("vm_tlb_entries", vm_tlb_entries, 1, 4096),
+    INT_KEY("vm_accesses_per_tick", vm_accesses_per_tick, 0, 1000000),
+    INT_KEY("vm_locality", vm_locality, 0, 100),
+    INT_KEY("vm_hot_pages", vm_hot_pages, 1, 1048576),
+    INT_KEY("vm_phase_accesses", vm_phase_accesses, 1, 100000000),
+    NAME_KEY("vm_replacement", vm_replacement, VM_REPLACEMENT_STR,
+             VM_REPLACEMENT_WS),
+    INT_KEY("vm_ws_window", vm_ws_window, 1, 100000000),
+    INT_KEY("vm_swap_device", vm_swap_device, 1, 2),
+};
+
+#define KEY_AMOUNT (int)(sizeof(KEYS) / sizeof(KEYS[0]))
+
+static const config_key_t *find_key(const char *name) {
+  for (int i = 0; i < KEY_AMOUNT; i++) {
+    if (strcmp(KEYS[i].name, name) == 0)
+      return &KEYS[i];
+  }
+
+  return NULL;
+}
+
+bool config_has_key(const char *key) { return find_key(key) != NULL; }
+
+bool config_set(const char *key, const char *value) {
+  const config_key_t *k = find_key(key);
+  char *field = (char *)&config;
+  char *end;
+
+  if (k == NULL || *value == '\0')
+    return false;
+
+  switch (k->type) {
+  case KEY_INT: {
+    long number = strtol(value, &end, 10);
+
+    if (*end != '\0' || number < k->min || number > k->max)
+      return false;
+    *(int *)(field + k->offset) = (int)number;
+    return true;
+  }
+  case KEY_DOUBLE: {
+    double number = strtod(value, &end);
+
+    if (*end != '\0' || !(number >= k->min && number <= k->max))
+      return false;
+    *(double *)(field + k->offset) = number;
+    return true;
+  }
+  case KEY_NAME:
+    for (int n = 0; n <= k->max; n++) {
+      if (strcmp(value, k->names[n]) == 0) {
+        *(int *)(field + k->offset) = n;
+        return true;
+      }
+    }
+    return false;
+  case KEY_WEIGHTS: {
+    int weights[WORKLOAD_SYSCALLS];
+    int total = 0;
+
+    for (int i = 0; i < WORKLOAD_SYSCALLS; i++) {
+      char sep = i < WORKLOAD_SYSCALLS - 1 ? ':' : '\0';
+      long number = strtol(value, &end, 10);
+
+      if (end == value || *end != sep || number < k->min || number > k->max)
+        return false;
+      weights[i] = (int)number;
+      total += weights[i];
+      value = end + 1;
+    }
+    if (total == 0)
+      return false;
+    memcpy(field + k->offset, weights, sizeof(weights));
+    return true;
+  }
+  }
+
+  return false;
+}
+
+// Trims leading and trailing whitespace in place
+static char *trim(char *text) {
+  char *end = text + strlen(text);
+
+  while (*text == ' ' || *text == '\t')
+    text++;
+  while (end > text && (end[-1] == ' ' || end[-1] == '\t' ||
+                        end[-1] == '\n' || end[-1] == '\r'))
+    end--;
+  *end = '\0';
+
+  return text;
+}
+
+// Sets a key from a "key=value" pair, modified in place
+static bool set_pair(char *pair) {
+  char *equals = strchr(pair, '=');
+
+  if (equals == NULL)
+    return false;
+  *equals = '\0';
+
+  return config_set(trim(pair), trim(equals + 1));
+}
+
+bool config_parse(const char *pairs) {
+  char buf[CONFIG_MAX_FORMAT];
+  char *save, *pair;
+
+  if (strlen(pairs) >= sizeof(buf)) {
+    fprintf(stderr, "Config too long\n");
+    return false;
+  }
+  strcpy(buf, pairs);
+
+  for (pair = strtok_r(buf, ",", &save); pair != NULL;
+       pair = strtok_r(NULL, ",", &save)) {
+    char text[CONFIG_MAX_FORMAT];
+
+    strcpy(text, pair);
+    if (!set_pair(pair)) {
+      fprintf(stderr, "Invalid config: %s\n", text);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool config_load(const char *path) {
+  FILE *file = fopen(path, "r");
+  char line[256];
+  int number = 0;
+
+  if (file == NULL) {
+    fprintf(stderr, "Config file error: %s\n", path);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *comment = strchr(line, '#');
+    char *pair;
+
+    number++;
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    pair = trim(line);
+    if (*pair == '\0')
+      continue;
+
+    if (!set_pair(pair)) {
+      fprintf(stderr, "Invalid config at %s:%d\n", path, number);
+      fclose(file);
+      return false;
+    }
+  }
+
+  fclose(file);
+  return true;
+}
+
+void config_format(char *buf, size_t size) {
+  const char *field = (const char *)&config;
+  size_t length = 0;
+
+  buf[0] = '\0';
+  for (int i = 0; i < KEY_AMOUNT && length < size; i++) {
+    const config_key_t *k = &KEYS[i];
+    const char *sep = i > 0 ? "," : "";
+
+    switch (k->type) {
+    case KEY_INT:
+      length += snprintf(buf + length, size - length, "%s%s=%d", sep, k->name,
+                         *(const int *)(field + k->offset));
+      break;
+    case KEY_DOUBLE:
+      length += snprintf(buf + length, size - length, "%s%s=%.17g", sep,
+                         k->name, *(const double *)(field + k->offset));
+      break;
+    case KEY_NAME:
+      length += snprintf(buf + length, size - length, "%s%s=%s", sep, k->name,
+                         k->names[*(const int *)(field + k->offset)]);
+      break;
+    case KEY_WEIGHTS: {
+      const int *weights = (const int *)(field + k->offset);
+
+      length += snprintf(buf + length, size - length, "%s%s=", sep, k->name);
+      for (int w = 0; w < WORKLOAD_SYSCALLS && length < size; w++) {
+        length += snprintf(buf + length, size - length, w > 0 ? ":%d" : "%d",
+                           weights[w]);
+      }
+      break;
+    }
+    }
+  }
+}
+
+bool config_parse_seed(const char *value, unsigned int *seed) {
+  char *end;
+
+  // strtoul would take leading spaces and a minus sign
+  if (!isdigit((unsigned char)value[0]))
+    return false;
+
+  errno = 0;
+  unsigned long number = strtoul(value, &end, 10);
+  if (*end != '\0' || errno == ERANGE || number > UINT_MAX)
+    return false;
+
+  *seed = (unsigned int)number;
+  return true;
+}
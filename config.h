@@ -0,0 +1,90 @@
+#pragma once
+
+#include "types.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Runtime configuration. Every knob starts at its cfg.h default, named in
+// lowercase, and kernelsim may override it from a config file (-f) or from
+// key=value pairs (-o). Children get the final configuration on their
+// command line, so every process of a run agrees on it
+
+// Max length of a configuration formatted by config_format
+#define CONFIG_MAX_FORMAT 2048
+// Max app_amount. App queues hold twice the apps, rounded up to a power
+// of two of unsigned positions, and app ids are 32-bit in the syscall
+// ring, the trace and recordings
+#define APP_AMOUNT_MAX (1 << 30)
+// Max cpu_amount. Intersim sends the IRQ_TIME of every CPU, plus one
+// interrupt per device, in a single write no larger than PIPE_BUF, so
+// kernelsim never reads a partial record
+#define CPU_AMOUNT_MAX ((int)(PIPE_BUF / sizeof(irq_msg_t)) - 2)
+
+typedef struct {
+  int app_amount;
+  int cpu_amount;
+  int app_max_pc;
+  int app_sleep_time_ms;
+  int app_syscall_prob;
+  int app_context_kb;
+  int app_context_touches;
+  int app_context_zero_copy;
+  int workload_phase_steps;
+  double workload_tail_alpha;
+  int workload_tail_max_factor;
+  int workload_cpu_syscall_prob;
+  int workload_io_syscall_prob;
+  int workload_bursty_syscall_prob;
+  int workload_bursty_burst_prob;
+  int workload_heavytail_syscall_prob;
+  // Indexed by workload_t
+  int workload_weights[WORKLOAD_AMOUNT][WORKLOAD_SYSCALLS];
+  int intersim_tick_us;
+  int intersim_d1_int_prob;
+  int intersim_d2_int_prob;
+  // Indexed by operation, R/W/X
+  int device_dist[3];
+  int device_us[3];
+  int device_bimodal_slow_prob;
+  int device_bimodal_slow_factor;
+  int device_coalesce_count;
+  int device_coalesce_us;
+  int sched_mlfq_boost_ticks;
+  int vm_pages;
+  int vm_frames;
+  int vm_tlb_entries;
+  int vm_accesses_per_tick;
+  int vm_locality;
+  int vm_hot_pages;
+  int vm_phase_accesses;
+  int vm_replacement;
+  int vm_ws_window;
+  int vm_swap_device;
+} config_t;
+
+// Configuration of this process
+extern config_t config;
+
+// Sets a key from its text value.
+// Returns false for an unknown key, or an invalid or out of range value
+bool config_set(const char *key, const char *value);
+
+// Sets every key of a list of comma separated key=value pairs.
+// Returns false at the first invalid pair, after printing it
+bool config_parse(const char *pairs);
+
+// Sets every key of a file of "key = value" lines, # starts a comment.
+// Returns false if the file can't be read or at the first invalid line,
+// after printing it
+bool config_load(const char *path);
+
+// Formats every key as a list config_parse reads back
+void config_format(char *buf, size_t size);
+
+// Whether a key is a configuration key
+bool config_has_key(const char *key);
+
+// Parses a PRNG seed given on a command line, a decimal unsigned int.
+// Returns false for anything else, leaving seed untouched
+bool config_parse_seed(const char *value, unsigned int *seed);
@@ -0,0 +1,125 @@
+#include "context.h"
+#include "cfg.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void context_init(app_context_t *ctx, shm_t *shm, int app_id, bool zero_copy) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->area = get_app_area(shm, app_id);
+  ctx->size = shm->working_set_size;
+  ctx->chunks = (ctx->size + CONTEXT_CHUNK_SIZE - 1) / CONTEXT_CHUNK_SIZE;
+  ctx->zero_copy = zero_copy;
+
+  if (zero_copy) {
+    ctx->working_set = ctx->area->working_set;
+    return;
+  }
+
+  ctx->buffer = (uint8_t *)calloc(ctx->size ? ctx->size : 1, 1);
+  ctx->dirty = (uint8_t *)calloc(ctx->chunks ? ctx->chunks : 1, 1);
+  ctx->lost = (uint8_t *)calloc(ctx->chunks ? ctx->chunks : 1, 1);
+  if (ctx->buffer == NULL || ctx->dirty == NULL || ctx->lost == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+  ctx->working_set = ctx->buffer;
+}
+
+void context_free(app_context_t *ctx) {
+  free(ctx->buffer);
+  free(ctx->dirty);
+  free(ctx->lost);
+}
+
+void context_step(app_context_t *ctx, int counter, int touches) {
+  reg_file_t *regs = &ctx->regs;
+  uint64_t words = ctx->size / sizeof(uint64_t);
+
+  // Every register steps its own LCG
+  regs->pc = counter;
+  for (int i = 0; i < 32; i++) {
+    regs->regs[i] = regs->regs[i] * 6364136223846793005ULL +
+                    1442695040888963407ULL + 2 * i;
+  }
+
+  for (int t = 0; t < touches && words > 0; t++) {
+    uint64_t value = regs->regs[t % 32];
+    uint64_t word = (value >> 17) % words;
+
+    ((uint64_t *)ctx->working_set)[word] += value;
+    regs->flags ^= word;
+    if (!ctx->zero_copy) {
+      ctx->dirty[word * sizeof(uint64_t) / CONTEXT_CHUNK_SIZE] = 1;
+    }
+  }
+}
+
+// Bytes of the given chunk, the last one may be partial
+static uint64_t chunk_length(const app_context_t *ctx, int chunk) {
+  uint64_t offset = (uint64_t)chunk * CONTEXT_CHUNK_SIZE;
+
+  return ctx->size - offset < CONTEXT_CHUNK_SIZE ? ctx->size - offset
+                                                 : CONTEXT_CHUNK_SIZE;
+}
+
+void context_save(app_context_t *ctx) {
+  app_area_t *area = ctx->area;
+  uint64_t begin_ns = get_real_time_ns();
+  uint64_t bytes = sizeof(reg_file_t);
+
+  // Simulate data loss, like the program counter
+  area->regs = ctx->regs;
+  memset(&ctx->regs, 0, sizeof(reg_file_t));
+
+  if (ctx->zero_copy) {
+    ctx->working_set = NULL;
+  } else {
+    for (int c = 0; c < ctx->chunks; c++) {
+      uint64_t offset = (uint64_t)c * CONTEXT_CHUNK_SIZE;
+      uint64_t length = chunk_length(ctx, c);
+
+      if (!ctx->dirty[c])
+        continue;
+
+      memcpy(area->working_set + offset, ctx->buffer + offset, length);
+      memset(ctx->buffer + offset, 0, length);
+      ctx->dirty[c] = 0;
+      ctx->lost[c] = 1;
+      bytes += length;
+    }
+  }
+
+  area->saves++;
+  area->bytes_saved += bytes;
+  area->save_ns += get_real_time_ns() - begin_ns;
+}
+
+void context_restore(app_context_t *ctx) {
+  app_area_t *area = ctx->area;
+  uint64_t begin_ns = get_real_time_ns();
+  uint64_t bytes = sizeof(reg_file_t);
+
+  ctx->regs = area->regs;
+
+  if (ctx->zero_copy) {
+    ctx->working_set = area->working_set;
+  } else {
+    for (int c = 0; c < ctx->chunks; c++) {
+      uint64_t offset = (uint64_t)c * CONTEXT_CHUNK_SIZE;
+      uint64_t length = chunk_length(ctx, c);
+
+      if (!ctx->lost[c])
+        continue;
+
+      memcpy(ctx->buffer + offset, area->working_set + offset, length);
+      ctx->lost[c] = 0;
+      bytes += length;
+    }
+  }
+
+  area->restores++;
+  area->bytes_restored += bytes;
+  area->restore_ns += get_real_time_ns() - begin_ns;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "types.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Large app context: a register file plus a working set the app writes as
+// it runs. Writes mark their CONTEXT_CHUNK_SIZE chunk dirty, so saving only
+// copies the chunks written since the last save into the app's shm area,
+// and restoring only copies back the chunks that were lost. In zero-copy
+// mode the working set lives in the shm area, and is handed over by
+// dropping and retaking the pointer to it
+
+typedef struct {
+  reg_file_t regs;      // Live register file
+  uint8_t *working_set; // Private copy, or the shm area in zero-copy mode
+  uint8_t *buffer;      // Private copy, NULL in zero-copy mode
+  uint8_t *dirty;       // Chunks written since the last save
+  uint8_t *lost;        // Chunks dropped at the last save
+  int chunks;
+  uint64_t size;        // Bytes of working set
+  bool zero_copy;
+  app_area_t *area;     // Where the context is saved, in shm
+} app_context_t;
+
+// Sets up the context of an app with the working set size of its shm area,
+// starting from the zeroed area
+void context_init(app_context_t *ctx, shm_t *shm, int app_id, bool zero_copy);
+
+void context_free(app_context_t *ctx);
+
+// Advances the register file by one iteration and writes touches words of
+// the working set, at positions drawn from the registers
+void context_step(app_context_t *ctx, int counter, int touches);
+
+// Saves the context in the shm area and loses the live copy, counting the
+// time and bytes it took
+void context_save(app_context_t *ctx);
+
+// Restores the context lost by the last save from the shm area
+void context_restore(app_context_t *ctx);
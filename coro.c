@@ -0,0 +1,185 @@
+#include "coro.h"
+#include "cfg.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+// Coroutine, placed at the top of its own stack
+struct coro {
+#if defined(__x86_64__)
+  void *sp; // Saved stack pointer while switched out
+#else
+  ucontext_t context; // Saved context while switched out
+#endif
+  coro_fn_t fn;
+  void *arg;
+  void *stack; // Lowest address of its stack, as taken from the pool
+  bool finished;
+};
+
+// Coroutine currently running, NULL while on the scheduler's stack
+static coro_t *current = NULL;
+
+// Free stacks, linked through their first word
+static void *free_stacks = NULL;
+// Chunks of stacks mapped so far
+static void **chunks = NULL;
+static int chunk_amount = 0;
+
+#if defined(__x86_64__)
+// Saved stack pointer of whoever resumed the running coroutine
+static void *scheduler_sp;
+
+// Pushes the callee-saved registers, stores the stack pointer in *from,
+// then loads the stack pointer to and pops its registers. The return
+// address on the new stack is where it last switched out
+void coro_switch_stack(void **from, void *to);
+__asm__(".text\n"
+        ".globl coro_switch_stack\n"
+        ".hidden coro_switch_stack\n"
+        ".type coro_switch_stack, @function\n"
+        "coro_switch_stack:\n"
+        "  pushq %rbp\n"
+        "  pushq %rbx\n"
+        "  pushq %r12\n"
+        "  pushq %r13\n"
+        "  pushq %r14\n"
+        "  pushq %r15\n"
+        "  movq %rsp, (%rdi)\n"
+        "  movq %rsi, %rsp\n"
+        "  popq %r15\n"
+        "  popq %r14\n"
+        "  popq %r13\n"
+        "  popq %r12\n"
+        "  popq %rbx\n"
+        "  popq %rbp\n"
+        "  ret\n"
+        ".size coro_switch_stack, .-coro_switch_stack\n");
+#else
+// Saved context of whoever resumed the running coroutine
+static ucontext_t scheduler_context;
+#endif
+
+// Maps another chunk of stacks and adds them to the free list
+static void grow_pool(void) {
+  size_t size = (size_t)CORO_STACK_SIZE * CORO_POOL_CHUNK;
+
+  // Pages are only backed once a coroutine touches them
+  char *chunk = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+                             0);
+  void **new_chunks =
+      (void **)realloc(chunks, (chunk_amount + 1) * sizeof(void *));
+  if (chunk == MAP_FAILED || new_chunks == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  chunks = new_chunks;
+  chunks[chunk_amount++] = chunk;
+
+  for (int i = CORO_POOL_CHUNK - 1; i >= 0; i--) {
+    void *stack = chunk + (size_t)i * CORO_STACK_SIZE;
+
+    *(void **)stack = free_stacks;
+    free_stacks = stack;
+  }
+}
+
+// First function run on a coroutine's stack
+static void coro_entry(void) {
+  coro_t *co = current;
+
+  co->fn(co->arg);
+  co->finished = true;
+
+  // Never resumed again
+  coro_yield();
+}
+
+coro_t *coro_create(coro_fn_t fn, void *arg) {
+  if (free_stacks == NULL) {
+    grow_pool();
+  }
+
+  void *stack = free_stacks;
+  free_stacks = *(void **)stack;
+
+  // The coroutine itself takes the top of the stack
+  uintptr_t top = (uintptr_t)stack + CORO_STACK_SIZE - sizeof(coro_t);
+  coro_t *co = (coro_t *)(top & ~(uintptr_t)63);
+
+  co->fn = fn;
+  co->arg = arg;
+  co->stack = stack;
+  co->finished = false;
+
+#if defined(__x86_64__)
+  // Build the frame coro_switch_stack pops on the first resume, so it
+  // returns into coro_entry with the stack aligned as after a call
+  void **sp = (void **)((uintptr_t)co & ~(uintptr_t)15);
+  *--sp = NULL;               // return address of coro_entry, never used
+  *--sp = (void *)coro_entry; // popped by ret
+  for (int i = 0; i < 6; i++) {
+    *--sp = NULL; // callee-saved registers
+  }
+  co->sp = sp;
+#else
+  getcontext(&co->context);
+  co->context.uc_stack.ss_sp = stack;
+  co->context.uc_stack.ss_size = (char *)co - (char *)stack;
+  co->context.uc_link = NULL;
+  makecontext(&co->context, coro_entry, 0);
+#endif
+
+  return co;
+}
+
+void coro_resume(coro_t *co) {
+  assert(current == NULL && !co->finished);
+
+  current = co;
+#if defined(__x86_64__)
+  coro_switch_stack(&scheduler_sp, co->sp);
+#else
+  swapcontext(&scheduler_context, &co->context);
+#endif
+  current = NULL;
+}
+
+void coro_yield(void) {
+  coro_t *co = current;
+
+  assert(co != NULL);
+#if defined(__x86_64__)
+  coro_switch_stack(&co->sp, scheduler_sp);
+#else
+  swapcontext(&co->context, &scheduler_context);
+#endif
+}
+
+bool coro_finished(const coro_t *co) { return co->finished; }
+
+void coro_destroy(coro_t *co) {
+  assert(co != current);
+
+  void *stack = co->stack;
+  *(void **)stack = free_stacks;
+  free_stacks = stack;
+}
+
+void coro_pool_free(void) {
+  for (int i = 0; i < chunk_amount; i++) {
+    munmap(chunks[i], (size_t)CORO_STACK_SIZE * CORO_POOL_CHUNK);
+  }
+
+  free(chunks);
+  chunks = NULL;
+  chunk_amount = 0;
+  free_stacks = NULL;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Stackful coroutine running a function on its own pooled stack.
+// Switching is a user-space stack swap, no syscalls involved
+typedef struct coro coro_t;
+
+// Function run by a coroutine
+typedef void (*coro_fn_t)(void *arg);
+
+// Creates a coroutine that runs fn(arg) on its first resume.
+// Its stack is taken from the pool, which grows in chunks as needed
+coro_t *coro_create(coro_fn_t fn, void *arg);
+
+// Runs the coroutine until it yields or its function returns
+void coro_resume(coro_t *co);
+
+// Called from inside a coroutine, switches back to whoever resumed it
+void coro_yield(void);
+
+// Whether the coroutine's function has returned
+bool coro_finished(const coro_t *co);
+
+// Gives the coroutine's stack back to the pool. Must not be running
+void coro_destroy(coro_t *co);
+
+// Unmaps every stack in the pool, all coroutines must be destroyed
+void coro_pool_free(void);
@@ -0,0 +1,130 @@
+#include "des.h"
+#include "util.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Initial calendar capacity, doubled whenever it fills up
+#define DES_INITIAL_CAPACITY 256
+
+// Binary min-heap ordered by (time_ns, seq)
+static des_event_t *heap = NULL;
+static size_t heap_size = 0;
+static size_t heap_capacity = 0;
+// Sequence number of the next scheduled event
+static uint64_t next_seq = 0;
+// Events popped so far
+static uint64_t popped = 0;
+
+static inline bool event_before(const des_event_t *a, const des_event_t *b) {
+  return a->time_ns < b->time_ns ||
+         (a->time_ns == b->time_ns && a->seq < b->seq);
+}
+
+void des_init(void) {
+  heap_capacity = DES_INITIAL_CAPACITY;
+  heap = (des_event_t *)malloc(heap_capacity * sizeof(des_event_t));
+  if (heap == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  set_virtual_time_ns(0);
+}
+
+void des_free(void) {
+  free(heap);
+  heap = NULL;
+  heap_size = heap_capacity = 0;
+}
+
+void des_schedule(uint64_t time_ns, des_type_t type, int arg) {
+  assert(time_ns >= get_time_ns());
+
+  if (heap_size == heap_capacity) {
+    heap_capacity *= 2;
+    heap = (des_event_t *)realloc(heap, heap_capacity * sizeof(des_event_t));
+    if (heap == NULL) {
+      fprintf(stderr, "Malloc error\n");
+      exit(6);
+    }
+  }
+
+  des_event_t event = {
+      .time_ns = time_ns, .seq = next_seq++, .type = type, .arg = arg};
+
+  // Sift up
+  size_t i = heap_size++;
+  while (i > 0 && event_before(&event, &heap[(i - 1) / 2])) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = event;
+}
+
+bool des_pop(des_event_t *event) {
+  if (heap_size == 0)
+    return false;
+
+  *event = heap[0];
+  des_event_t last = heap[--heap_size];
+
+  // Sift the last event down from the root
+  size_t i = 0;
+  while (2 * i + 1 < heap_size) {
+    size_t child = 2 * i + 1;
+
+    if (child + 1 < heap_size && event_before(&heap[child + 1], &heap[child]))
+      child++;
+    if (!event_before(&heap[child], &last))
+      break;
+
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+
+  popped++;
+  set_virtual_time_ns(event->time_ns);
+
+  return true;
+}
+
+uint64_t des_event_count(void) {
+  return popped;
+}
+
+// Calendar counters in a checkpoint
+typedef struct {
+  uint64_t size;
+  uint64_t next_seq;
+  uint64_t popped;
+} des_image_t;
+
+void des_checkpoint(checkpoint_t *ckpt) {
+  des_image_t image = {
+      .size = heap_size, .next_seq = next_seq, .popped = popped};
+
+  checkpoint_write(ckpt, "des", &image, sizeof(image));
+  // Already a heap, copied as is
+  checkpoint_write(ckpt, "des.events", heap, heap_size * sizeof(des_event_t));
+}
+
+void des_restore(const checkpoint_t *ckpt) {
+  des_image_t image;
+
+  checkpoint_read(ckpt, "des", &image, sizeof(image));
+  while (heap_capacity < image.size) {
+    heap_capacity *= 2;
+  }
+  heap = (des_event_t *)realloc(heap, heap_capacity * sizeof(des_event_t));
+  if (heap == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  checkpoint_read(ckpt, "des.events", heap, image.size * sizeof(des_event_t));
+  heap_size = image.size;
+  next_seq = image.next_seq;
+  popped = image.popped;
+}
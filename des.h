@@ -0,0 +1,48 @@
+#pragma once
+
+#include "checkpoint.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Discrete-event mode: instead of sleeping, kernelsim pops the earliest
+// event from a calendar and jumps the virtual clock straight to its time
+
+// Kinds of events in the calendar
+typedef enum {
+  DES_TICK,     // Intersim tick, sends IRQ_TIME to every CPU
+  DES_IRQ,      // Device interrupt, arg is the irq_t
+  DES_APP_WAKE, // A coroutine app's sleep ends, arg is the app_id
+  DES_DEVICE    // A device may raise an interrupt, arg is the irq_t
+} des_type_t;
+
+// Calendar entry. Events at the same time pop in the order they were
+// scheduled, so a run only depends on its seed
+typedef struct {
+  uint64_t time_ns; // Virtual time the event happens at
+  uint64_t seq;     // Scheduling order, breaks ties
+  des_type_t type;
+  int arg;
+} des_event_t;
+
+// Creates an empty calendar and starts the virtual clock at 0
+void des_init(void);
+
+// Frees the calendar
+void des_free(void);
+
+// Adds an event to the calendar, never before the current virtual time
+void des_schedule(uint64_t time_ns, des_type_t type, int arg);
+
+// Removes the earliest event and advances the virtual clock to it.
+// Returns false if the calendar is empty
+bool des_pop(des_event_t *event);
+
+// Amount of events popped so far
+uint64_t des_event_count(void);
+
+// Writes the calendar to a checkpoint
+void des_checkpoint(checkpoint_t *ckpt);
+
+// Replaces the calendar with the one written by des_checkpoint. The
+// virtual clock is left as is
+void des_restore(const checkpoint_t *ckpt);
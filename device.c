@@ -0,0 +1,148 @@
+#include "device.h"
+#include "config.h"
+#include "util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Draws the service time of a request for the given syscall
+static uint64_t draw_service_ns(device_t *dev, syscall_t call) {
+  int op = (call - SYSCALL_D1_R) % 3;
+  uint64_t base_ns = config.device_us[op] * 1000ULL;
+  // Uniform in [0, 1)
+  double u = prng_unit(&dev->prng);
+
+  switch ((dist_t)config.device_dist[op]) {
+  case DIST_FIXED:
+    return base_ns;
+  case DIST_EXP:
+    return (uint64_t)(-log(1.0 - u) * base_ns);
+  case DIST_BIMODAL:
+    return u * 100 < config.device_bimodal_slow_prob
+               ? base_ns * config.device_bimodal_slow_factor
+               : base_ns;
+  }
+
+  fprintf(stderr, "draw_service_ns error\n");
+  exit(23);
+}
+
+void device_init(device_t *dev, irq_t irq, int capacity, unsigned int seed) {
+  dev->irq = irq;
+  dev->reqs = (device_req_t *)malloc(capacity * sizeof(device_req_t));
+  if (dev->reqs == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+  dev->capacity = capacity;
+  dev->head = 0;
+  dev->length = 0;
+  dev->completed = 0;
+  dev->busy_ns = 0;
+  // Each device draws its own sequence
+  prng_seed(&dev->prng, seed, PRNG_STREAM_DEVICES + irq);
+  dev->requests = 0;
+  dev->interrupts = 0;
+  hist_init(&dev->latency);
+}
+
+void device_free(device_t *dev) { free(dev->reqs); }
+
+// The i-th oldest queued request
+static inline device_req_t *queued_req(const device_t *dev, int i) {
+  return &dev->reqs[(dev->head + i) % dev->capacity];
+}
+
+void device_submit(device_t *dev, syscall_t call, uint64_t submit_ns) {
+  if (dev->length == dev->capacity) {
+    fprintf(stderr, "device_submit error\n");
+    exit(23);
+  }
+
+  // Served once every request ahead of it is done
+  uint64_t start_ns = dev->busy_ns > submit_ns ? dev->busy_ns : submit_ns;
+  device_req_t *req = queued_req(dev, dev->length++);
+
+  req->submit_ns = submit_ns;
+  req->done_ns = start_ns + draw_service_ns(dev, call);
+  dev->busy_ns = req->done_ns;
+  dev->requests++;
+}
+
+int device_poll(device_t *dev, uint64_t now_ns) {
+  while (dev->completed < dev->length &&
+         queued_req(dev, dev->completed)->done_ns <= now_ns) {
+    dev->completed++;
+  }
+
+  if (dev->completed == 0 ||
+      (dev->completed < config.device_coalesce_count &&
+       now_ns < queued_req(dev, 0)->done_ns +
+                    config.device_coalesce_us * 1000ULL))
+    return 0;
+
+  // Notify every completed request with a single interrupt
+  int amount = dev->completed;
+  for (int i = 0; i < amount; i++) {
+    hist_record(&dev->latency, now_ns - queued_req(dev, i)->submit_ns);
+  }
+  dev->head = (dev->head + amount) % dev->capacity;
+  dev->length -= amount;
+  dev->completed = 0;
+  dev->interrupts++;
+
+  return amount;
+}
+
+uint64_t device_next_event_ns(const device_t *dev) {
+  if (dev->length == 0)
+    return UINT64_MAX;
+
+  // The oldest completion's coalescing timeout, unless enough requests
+  // finish before it to fill the batch
+  uint64_t next_ns =
+      queued_req(dev, 0)->done_ns + config.device_coalesce_us * 1000ULL;
+  int filled = config.device_coalesce_count - 1;
+
+  if (filled < dev->length && queued_req(dev, filled)->done_ns < next_ns) {
+    next_ns = queued_req(dev, filled)->done_ns;
+  }
+
+  return next_ns;
+}
+
+void device_print_stats(const device_t *dev) {
+  const hist_t *latency = &dev->latency;
+
+  msg("D%d device  | %lu requests / %lu interrupts | %.2f completions per "
+      "interrupt",
+      dev->irq, (unsigned long)dev->requests, (unsigned long)dev->interrupts,
+      dev->interrupts ? (double)latency->total / dev->interrupts : 0.0);
+  msg("D%d latency | %.1f ms avg / %.1f ms p50 / %.1f ms p99", dev->irq,
+      latency->total ? latency->sum / 1e6 / latency->total : 0.0,
+      hist_percentile(latency, 0.5) / 1e6,
+      hist_percentile(latency, 0.99) / 1e6);
+}
+
+void device_checkpoint(const device_t *dev, checkpoint_t *ckpt) {
+  char name[24];
+
+  sprintf(name, "device.d%d", dev->irq);
+  checkpoint_write(ckpt, name, dev, sizeof(device_t));
+  sprintf(name, "device.d%d.reqs", dev->irq);
+  checkpoint_write(ckpt, name, dev->reqs,
+                   dev->capacity * sizeof(device_req_t));
+}
+
+void device_restore(device_t *dev, const checkpoint_t *ckpt) {
+  device_req_t *reqs = dev->reqs;
+  char name[24];
+
+  // Everything but the queue's storage is copied as is
+  sprintf(name, "device.d%d", dev->irq);
+  checkpoint_read(ckpt, name, dev, sizeof(device_t));
+  dev->reqs = reqs;
+  sprintf(name, "device.d%d.reqs", dev->irq);
+  checkpoint_read(ckpt, name, dev->reqs,
+                  dev->capacity * sizeof(device_req_t));
+}
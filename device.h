@@ -0,0 +1,62 @@
+#pragma once
+
+#include "checkpoint.h"
+#include "hist.h"
+#include "prng.h"
+#include "types.h"
+#include <stdint.h>
+
+// Device service-time model: each request to a device is served in FIFO
+// order after a service time drawn from the distribution of its operation.
+// Completed requests are notified by an interrupt once enough of them
+// finished or the oldest one waited long enough, so one interrupt can
+// complete several requests
+
+// Request queued on a device
+typedef struct {
+  uint64_t submit_ns; // When the kernel blocked the app on it
+  uint64_t done_ns;   // When the device finishes serving it
+} device_req_t;
+
+// Single-server device with a FIFO of requests
+typedef struct {
+  irq_t irq;            // IRQ_D1 or IRQ_D2
+  device_req_t *reqs;   // Ring of queued requests, oldest first
+  int capacity;         // Max queued requests, one per app
+  int head;             // Position of the oldest request
+  int length;           // Queued requests, completed or not
+  int completed;        // Oldest requests done but not yet notified
+  uint64_t busy_ns;     // When the last queued request finishes
+  prng_t prng;          // Draws the service times
+  uint64_t requests;    // Requests submitted
+  uint64_t interrupts;  // Interrupts raised
+  hist_t latency;       // Submit to interrupt time of each request
+} device_t;
+
+// Prepares an idle device for up to capacity queued requests, drawing its
+// service times from its own stream of the given seed
+void device_init(device_t *dev, irq_t irq, int capacity, unsigned int seed);
+
+// Frees the request queue
+void device_free(device_t *dev);
+
+// Queues a request for the given syscall, submitted at submit_ns
+void device_submit(device_t *dev, syscall_t call, uint64_t submit_ns);
+
+// Accounts every request done by now_ns, then checks whether an interrupt
+// is due. Returns how many requests it completes, or 0 if none is due
+int device_poll(device_t *dev, uint64_t now_ns);
+
+// Earliest time device_poll may raise an interrupt, or UINT64_MAX if no
+// request is queued
+uint64_t device_next_event_ns(const device_t *dev);
+
+// Prints requests, interrupts, completions per interrupt and latencies
+void device_print_stats(const device_t *dev);
+
+// Writes the queue, counters and PRNG state of a device to a checkpoint
+void device_checkpoint(const device_t *dev, checkpoint_t *ckpt);
+
+// Restores the state written by device_checkpoint, into a device created
+// by device_init with the same irq and capacity
+void device_restore(device_t *dev, const checkpoint_t *ckpt);
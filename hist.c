@@ -0,0 +1,115 @@
+#include "hist.h"
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+
+// Bucket a value falls into
+static inline int bucket_index(uint64_t value) {
+  if (value < HIST_SUB_BUCKETS)
+    return (int)value;
+
+  // Power of two range, then linear position inside it
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - HIST_SUB_BITS;
+
+  return (shift + 1) * HIST_SUB_BUCKETS +
+         (int)((value >> shift) - HIST_SUB_BUCKETS);
+}
+
+// Highest value that falls into a bucket
+static inline uint64_t bucket_upper_value(int index) {
+  if (index < HIST_SUB_BUCKETS)
+    return index;
+
+  int shift = index / HIST_SUB_BUCKETS - 1;
+  uint64_t sub = index % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS;
+
+  return ((sub + 1) << shift) - 1;
+}
+
+void hist_init(hist_t *hist) {
+  memset(hist, 0, sizeof(hist_t));
+  hist->min = UINT64_MAX;
+}
+
+void hist_record(hist_t *hist, uint64_t value) {
+  hist->counts[bucket_index(value)]++;
+  hist->total++;
+  hist->sum += value;
+
+  if (value < hist->min) {
+    hist->min = value;
+  }
+  if (value > hist->max) {
+    hist->max = value;
+  }
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    dst->counts[i] += src->counts[i];
+  }
+
+  dst->total += src->total;
+  dst->sum += src->sum;
+  if (src->min < dst->min) {
+    dst->min = src->min;
+  }
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+}
+
+uint64_t hist_percentile(const hist_t *hist, double fraction) {
+  if (hist->total == 0)
+    return 0;
+
+  // Rank of the value we're looking for, at least the first one
+  uint64_t rank = (uint64_t)(fraction * hist->total + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += hist->counts[i];
+
+    if (seen >= rank) {
+      uint64_t value = bucket_upper_value(i);
+      return value < hist->max ? value : hist->max;
+    }
+  }
+
+  return hist->max;
+}
+
+void hist_print(const hist_t *hist, const char *name) {
+  if (hist->total == 0) {
+    printf("%-24s | no samples\n", name);
+    return;
+  }
+
+  printf("%-24s | n %9lu | min %9.2f | mean %9.2f | p50 %9.2f | p99 %9.2f "
+         "| p999 %9.2f | max %10.2f us\n",
+         name, (unsigned long)hist->total, hist->min / 1000.0,
+         (double)hist->sum / hist->total / 1000.0,
+         hist_percentile(hist, 0.50) / 1000.0,
+         hist_percentile(hist, 0.99) / 1000.0,
+         hist_percentile(hist, 0.999) / 1000.0, hist->max / 1000.0);
+}
+
+void hist_log(const hist_t *hist, const char *name) {
+  if (hist->total == 0) {
+    msg("%s | no samples", name);
+    return;
+  }
+
+  // Split in two records, as the logger stores at most LOG_MAX_ARGS
+  msg("%s | n %lu | min %.2f | mean %.2f | p50 %.2f us", name,
+      (unsigned long)hist->total, hist->min / 1000.0,
+      (double)hist->sum / hist->total / 1000.0,
+      hist_percentile(hist, 0.50) / 1000.0);
+  msg("%s | p99 %.2f | p999 %.2f | max %.2f us", name,
+      hist_percentile(hist, 0.99) / 1000.0,
+      hist_percentile(hist, 0.999) / 1000.0, hist->max / 1000.0);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+// Each power of two range is split into 2^HIST_SUB_BITS linear buckets,
+// so recorded values are off by at most 1/32 (about 3%)
+#define HIST_SUB_BITS 5
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+// Enough buckets for any uint64_t value
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+// Log-linear latency histogram with fixed size, so it can live in shm and
+// recording never allocates. Values are in nanoseconds
+typedef struct {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total; // Amount of recorded values
+  uint64_t min;
+  uint64_t max;
+  uint64_t sum;
+} hist_t;
+
+// Empties a histogram
+void hist_init(hist_t *hist);
+
+// Records a single value
+void hist_record(hist_t *hist, uint64_t value);
+
+// Adds every value recorded in src to dst
+void hist_merge(hist_t *dst, const hist_t *src);
+
+// Returns the value below which the given fraction of the recorded values
+// are, e.g. 0.99 for p99. Rounded up to the end of its bucket
+uint64_t hist_percentile(const hist_t *hist, double fraction);
+
+// Prints count, min, mean, p50, p99, p999 and max in microseconds
+void hist_print(const hist_t *hist, const char *name);
+
+// Same as hist_print, but through msg() so it stays in order with the other
+// log lines. The logger keeps %s pointers, so name must be static
+void hist_log(const hist_t *hist, const char *name);
@@ -1,17 +1,42 @@
 #include "cfg.h"
+#include "config.h"
+#include "device.h"
+#include "hist.h"
+#include "prng.h"
 #include "types.h"
 #include "util.h"
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
 // Controls whether the main loop continues
 static volatile sig_atomic_t intersim_running = false;
+// Times kernelsim continued us after a pause, so the ticks missed while
+// stopped aren't counted as overruns
+static volatile sig_atomic_t intersim_resumes = 0;
+// Set on SIGUSR1, the tick stats are dumped after the next tick
+static volatile sig_atomic_t intersim_dump_requested = false;
+
+// How late each tick was woken up after its deadline
+static hist_t tick_lateness;
+// Ticks missed because we woke up after the following deadline had passed
+static uint64_t tick_overruns = 0;
+// Ticks missed while paused by kernelsim
+static uint64_t paused_ticks = 0;
+
+// How device interrupts are generated, chosen by kernelsim
+static device_model_t device_model;
+// Devices D1 and D2 of the service model, indexed by irq_t - IRQ_D1
+static device_t devices[2];
 
 // Called by parent on Ctrl+C or all apps finished.
 // Cleanup and exit
@@ -21,11 +46,184 @@ static void handle_sigterm(int signum) {
   intersim_running = false;
 }
 
+// Called when kernelsim unpauses us
+static void handle_sigcont(int signum) {
+  intersim_resumes++;
+}
+
+// Called on SIGUSR1, asks for a dump of the tick stats
+static void handle_dump(int signum) {
+  intersim_dump_requested = true;
+}
+
+// Prints the missed ticks and the tick lateness histogram
+static void dump_tick_stats(void) {
+  msg("Intersim tick stats: %d us period, %lu overruns, %lu ticks skipped "
+      "while paused",
+      config.intersim_tick_us, (unsigned long)tick_overruns,
+      (unsigned long)paused_ticks);
+  hist_log(&tick_lateness, "Intersim tick lateness");
+  if (device_model == DEVICE_MODEL_SERVICE) {
+    device_print_stats(&devices[0]);
+    device_print_stats(&devices[1]);
+  }
+}
+
+// Arms the timerfd to expire every configured tick on absolute
+// CLOCK_MONOTONIC deadlines, the first one a period after start_ns.
+// Expirations still pending from the previous schedule are discarded
+static void arm_tick_timer(int timer_fd, uint64_t start_ns) {
+  uint64_t period_ns = config.intersim_tick_us * 1000ULL;
+  uint64_t first_ns = start_ns + period_ns;
+  struct itimerspec spec = {
+      .it_interval = {.tv_sec = period_ns / 1000000000ULL,
+                      .tv_nsec = period_ns % 1000000000ULL},
+      .it_value = {.tv_sec = first_ns / 1000000000ULL,
+                   .tv_nsec = first_ns % 1000000000ULL}};
+
+  if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+    fprintf(stderr, "Timerfd error\n");
+    exit(18);
+  }
+}
+
+// Reads how many tick deadlines passed since the last call, once the
+// timerfd is readable
+static uint64_t read_tick_expirations(int timer_fd) {
+  uint64_t expirations;
+
+  while (read(timer_fd, &expirations, sizeof(expirations)) == -1) {
+    if (errno != EINTR) {
+      fprintf(stderr, "Timerfd error\n");
+      exit(18);
+    }
+  }
+
+  return expirations;
+}
+
+// Arms the device timerfd for the earliest device event, or disarms it
+static void arm_device_timer(int timer_fd) {
+  uint64_t next_ns = device_next_event_ns(&devices[0]);
+  struct itimerspec spec = {0};
+
+  if (device_next_event_ns(&devices[1]) < next_ns) {
+    next_ns = device_next_event_ns(&devices[1]);
+  }
+  // A zero it_value disarms the timer, so events due now fire 1 ns later
+  if (next_ns != UINT64_MAX) {
+    next_ns = next_ns ? next_ns : 1;
+    spec.it_value.tv_sec = next_ns / 1000000000ULL;
+    spec.it_value.tv_nsec = next_ns % 1000000000ULL;
+  }
+
+  if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+    fprintf(stderr, "Timerfd error\n");
+    exit(18);
+  }
+}
+
+// Writes interrupt records to kernelsim at once. The batch fits in
+// PIPE_BUF, so the write is atomic and never short on a blocking pipe
+static void write_irqs(int pipe_fd, const irq_msg_t *batch, int amount) {
+  size_t size = amount * sizeof(irq_msg_t);
+  ssize_t bytes;
+
+  assert(size <= PIPE_BUF);
+  do {
+    bytes = write(pipe_fd, batch, size);
+  } while (bytes == -1 && errno == EINTR);
+
+  if (bytes != (ssize_t)size) {
+    fprintf(stderr, "Pipe error\n");
+    exit(8);
+  }
+}
+
+// Sends an IRQ_TIME for each CPU, plus the random device interrupts of the
+// random model, in a single write
+static void send_tick(int pipe_fd, int cpu_amount, prng_t *prng) {
+  irq_msg_t batch[CPU_AMOUNT_MAX + 2];
+  int amount = 0;
+  uint64_t now = get_time_ns();
+
+  // Timeslice interrupt for each CPU
+  for (int i = 0; i < cpu_amount; i++) {
+    batch[amount++] =
+        (irq_msg_t){.irq = IRQ_TIME, .cpu_id = i, .timestamp_ns = now};
+  }
+
+  // Randomly add D1 and D2 interrupts
+  if (device_model == DEVICE_MODEL_RANDOM) {
+    if (prng_below(prng, 100) < (uint64_t)config.intersim_d1_int_prob) {
+      batch[amount++] =
+          (irq_msg_t){.irq = IRQ_D1, .count = 1, .timestamp_ns = now};
+    }
+    if (prng_below(prng, 100) < (uint64_t)config.intersim_d2_int_prob) {
+      batch[amount++] =
+          (irq_msg_t){.irq = IRQ_D2, .count = 1, .timestamp_ns = now};
+    }
+  }
+
+  write_irqs(pipe_fd, batch, amount);
+
+  cdmsg(LOG_CAT_IRQ, "Intersim sent time interrupt");
+  for (int i = cpu_amount; i < amount; i++) {
+    cdmsg(LOG_CAT_IRQ, "Intersim sent device interrupt D%d", batch[i].irq);
+  }
+}
+
+// Queues every device request kernelsim sent on its device.
+// Returns whether the device pipe is still open
+static bool read_device_requests(int devpipe_fd) {
+  device_request_t batch[64];
+  ssize_t bytes;
+
+  while ((bytes = read(devpipe_fd, batch, sizeof(batch))) > 0) {
+    // Writes up to PIPE_BUF are atomic, so we never see partial records
+    assert(bytes % sizeof(device_request_t) == 0);
+
+    for (int i = 0; i < bytes / sizeof(device_request_t); i++) {
+      int device = batch[i].call <= SYSCALL_D1_X ? 0 : 1;
+
+      device_submit(&devices[device], batch[i].call, batch[i].submit_ns);
+    }
+  }
+
+  if (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+      errno != EINTR) {
+    fprintf(stderr, "Pipe error\n");
+    exit(8);
+  }
+
+  return bytes != 0;
+}
+
+// Sends an interrupt for each device with completed requests due
+static void send_device_interrupts(int pipe_fd) {
+  uint64_t now = get_time_ns();
+
+  for (int i = 0; i < 2; i++) {
+    int completed = device_poll(&devices[i], now);
+
+    if (completed > 0) {
+      irq_msg_t irq_msg = {
+          .irq = devices[i].irq, .count = completed, .timestamp_ns = now};
+
+      write_irqs(pipe_fd, &irq_msg, 1);
+      cdmsg(LOG_CAT_IRQ, "Intersim sent device interrupt D%d for %d requests",
+            irq_msg.irq, completed);
+    }
+  }
+}
+
 int main(int argc, char **argv) {
+  log_init();
   dmsg("Intersim booting");
-  assert(argc == 4);
-  srand(time(NULL) ^ (getpid() << 16)); // reset seed
-  if (signal(SIGTERM, handle_sigterm) == SIG_ERR) {
+  assert(argc == 11);
+  if (signal(SIGTERM, handle_sigterm) == SIG_ERR ||
+      signal(SIGCONT, handle_sigcont) == SIG_ERR ||
+      signal(SIGUSR1, handle_dump) == SIG_ERR) {
     fprintf(stderr, "Signal error\n");
     exit(4);
   }
@@ -33,55 +231,124 @@ int main(int argc, char **argv) {
   // Get pipe fds from parent
   int interpipe_fd[] = {atoi(argv[1]), atoi(argv[2])};
   close(interpipe_fd[PIPE_READ]); // close read
-  close(atoi(argv[3]));           // close app read inherited from parent
+  close(atoi(argv[3]));           // close doorbell inherited from parent
+  int cpu_amount = atoi(argv[4]);
+  // Seed chosen by kernelsim, so device interrupts are reproducible
+  unsigned int seed = strtoul(argv[5], NULL, 10);
+  prng_t irq_prng;
+  prng_seed(&irq_prng, seed, PRNG_STREAM_IRQ);
+  // Device requests from kernelsim, at most one queued per app
+  int devpipe_fd = atoi(argv[6]);
+  int app_amount = atoi(argv[7]);
+  device_model = atoi(argv[8]);
+  // Same configuration as kernelsim
+  if (!config_parse(argv[10])) {
+    exit(16);
+  }
+
+  if (fcntl(devpipe_fd, F_SETFL, O_NONBLOCK) == -1) {
+    fprintf(stderr, "Pipe error\n");
+    exit(8);
+  }
+  device_init(&devices[0], IRQ_D1, app_amount, seed);
+  device_init(&devices[1], IRQ_D2, app_amount, seed);
 
-  // Start paused
+  // Start paused, the kernel waits for us to be stopped before continuing us
+  signal_child_ready(atoi(argv[9]));
   raise(SIGSTOP);
 
   intersim_running = true;
-  msg("Intersim running");
+  msg("Intersim running, %s device model", DEVICE_MODEL_STR[device_model]);
 
-  // Main loop
-  while (intersim_running) {
-    // Send timeslice interrupt
-    irq_t irq = IRQ_TIME;
-    write(interpipe_fd[PIPE_WRITE], &irq, sizeof(irq_t));
-
-    dmsg("Intersim sent time interrupt");
+  // The first tick is sent right away, the following ones on deadlines
+  // a period apart from it, regardless of how long each tick takes
+  hist_init(&tick_lateness);
+  uint64_t deadline_ns = get_time_ns();
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  int device_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timer_fd == -1 || device_timer_fd == -1) {
+    fprintf(stderr, "Timerfd error\n");
+    exit(18);
+  }
+  arm_tick_timer(timer_fd, deadline_ns);
+  sig_atomic_t resumes_seen = intersim_resumes;
+  send_tick(interpipe_fd[PIPE_WRITE], cpu_amount, &irq_prng);
 
-    // Randomly send D1 and D2 interrupts
-    if (rand() % 100 < INTERSIM_D1_INT_PROB) {
-      irq = IRQ_D1;
+  // Wait on the tick deadlines, device requests and device deadlines
+  struct pollfd fds[] = {{.fd = timer_fd, .events = POLLIN},
+                         {.fd = devpipe_fd, .events = POLLIN},
+                         {.fd = device_timer_fd, .events = POLLIN}};
 
-      write(interpipe_fd[PIPE_WRITE], &irq, sizeof(irq_t));
-      dmsg("Intersim sent device interrupt D%d", irq);
+  // Main loop
+  while (intersim_running) {
+    if (intersim_dump_requested) {
+      intersim_dump_requested = false;
+      dump_tick_stats();
     }
-    if (rand() % 100 < INTERSIM_D2_INT_PROB) {
-      irq = IRQ_D2;
 
-      write(interpipe_fd[PIPE_WRITE], &irq, sizeof(irq_t));
-      dmsg("Intersim sent device interrupt D%d", irq);
+    if (poll(fds, 3, -1) == -1) {
+      // Interrupted by SIGCONT, SIGUSR1 or SIGTERM
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "Poll error\n");
+      exit(8);
     }
 
-    // Sleep according to time set at cfg.h,
-    // Remaining time is restored after a signal is handled
-    struct timespec time_total, time_remaining;
-    time_total.tv_sec = INTERSIM_SLEEP_TIME_MS / 1000;
-    time_total.tv_nsec = (INTERSIM_SLEEP_TIME_MS % 1000) * 1000000L;
+    if (fds[0].revents & POLLIN) {
+      // Deadlines that passed in the meantime are skipped instead of sent
+      // late, so the period never drifts
+      uint64_t expirations = read_tick_expirations(timer_fd);
+      uint64_t woke_ns = get_time_ns();
+      bool resumed = intersim_resumes != resumes_seen;
+      resumes_seen = intersim_resumes;
 
-    while (nanosleep(&time_total, &time_remaining) == -1) {
-      if (errno == EINTR) {
-        // Restore remaining sleep time after a signal
-        time_total = time_remaining;
+      if (resumed) {
+        // Stopped by kernelsim at some point since the last tick, which
+        // may have been right after it, so the pause can't be told apart
+        // from the expirations. Restart the schedule from now instead
+        paused_ticks += (woke_ns - deadline_ns) /
+                        (config.intersim_tick_us * 1000ULL);
+        deadline_ns = woke_ns;
+        arm_tick_timer(timer_fd, deadline_ns);
       } else {
-        fprintf(stderr, "Nanosleep error\n");
-        exit(13);
+        deadline_ns += expirations * config.intersim_tick_us * 1000ULL;
+
+        if (expirations > 1) {
+          cdmsg(LOG_CAT_IRQ, "Intersim missed %lu ticks",
+                (unsigned long)(expirations - 1));
+        }
+        tick_overruns += expirations - 1;
+        hist_record(&tick_lateness,
+                    woke_ns > deadline_ns ? woke_ns - deadline_ns : 0);
       }
+
+      send_tick(interpipe_fd[PIPE_WRITE], cpu_amount, &irq_prng);
+    }
+
+    if (fds[1].revents & (POLLIN | POLLHUP) &&
+        !read_device_requests(devpipe_fd)) {
+      // Kernelsim closed the device pipe
+      fds[1].fd = -1;
+    }
+
+    // Devices keep serving requests while kernelsim is paused, so their
+    // interrupts are raised as soon as we're continued
+    if (fds[2].revents & POLLIN) {
+      read_tick_expirations(device_timer_fd);
     }
+    send_device_interrupts(interpipe_fd[PIPE_WRITE]);
+    arm_device_timer(device_timer_fd);
   }
 
   dmsg("Intersim left main loop");
+  dump_tick_stats();
 
+  device_free(&devices[0]);
+  device_free(&devices[1]);
+  close(timer_fd);
+  close(device_timer_fd);
+  close(devpipe_fd);
   close(interpipe_fd[PIPE_WRITE]);
   msg("Intersim finished");
 
@@ -1,38 +1,120 @@
+#include "appcore.h"
 #include "cfg.h"
+#include "checkpoint.h"
+#include "coapps.h"
+#include "config.h"
+#include "des.h"
+#include "device.h"
+#include "prng.h"
+#include "replay.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "trace.h"
 #include "types.h"
 #include "util.h"
+#include "vm.h"
+#include "workload.h"
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <semaphore.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/shm.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+// Max amount of ready fds handled per epoll wakeup
+#define KERNEL_MAX_EVENTS 8
+// Max amount of records read from a pipe per read() while draining it
+#define KERNEL_DRAIN_BATCH 64
+
 // Whether the kernel is running and reading the interrupt controller pipe
-static volatile sig_atomic_t kernel_running = false;
+static bool kernel_running = false;
 // Whether the kernel has been paused by a SIGUSR1
-static volatile sig_atomic_t kernel_paused = false;
+static bool kernel_paused = false;
 // Queue of apps waiting on device D1
 static queue_t *D1_app_queue;
 // Queue of apps waiting on device D2
 static queue_t *D2_app_queue;
-// Round-robin queue of apps waiting to run
-static queue_t *dispatch_queue;
+// Amount of simulated CPUs, set at startup
+static int cpu_amount;
+// Simulated CPUs, each with its own run queue inside the scheduler
+static cpu_t *cpus;
 // PID of the intersim process
 static pid_t intersim_pid;
-// Array of app info structs
-static proc_info_t apps[APP_AMOUNT];
+// Passed to children, which inherit our environment
+extern char **environ;
+// Amount of apps, set at startup
+static int app_amount;
+// Array of app info structs, indexed by app_id
+static proc_info_t *apps;
+// How many apps are in each proc_state_t, kept on every state change
+static int state_counts[FINISHED + 1];
 // Shared memory segment between apps and kernel
-static int *shm;
-// Semaphore to avoid a syscall while the dispatcher is making a decision
-static sem_t *dispatch_sem;
+static shm_t *shm;
+// Ring of syscall requests from apps, inside shm
+static syscall_ring_t *syscall_ring;
+// How apps are stopped and continued, set at startup
+static switch_mode_t switch_mode = SWITCH_SIGNAL;
+// Whether apps run as processes or as coroutines inside kernelsim
+static engine_t engine = ENGINE_PROCESS;
+// How the run queues pick the next app, set at startup
+static sched_policy_t sched_policy = SCHED_POLICY_RR;
+// Whether the discrete-event mode drives a virtual clock, in place of
+// intersim and real sleeps
+static bool virtual_time = false;
+// Device interrupt draws of the discrete-event mode, seeded like intersim's
+// so both draw the same interrupts
+static prng_t irq_prng;
+// How device interrupts are generated, set at startup
+static device_model_t device_model = DEVICE_MODEL_RANDOM;
+// Ratio of the workload profiles assigned to apps, set at startup
+static workload_mix_t workload_mix;
+// Write end of the pipe carrying device requests to intersim, in the
+// service model
+static int devpipe_write_fd = -1;
+// Devices D1 and D2 of the service model in virtual time, indexed by
+// irq_t - IRQ_D1. In real time, intersim runs them
+static device_t devices[2];
+// Time of the DES_DEVICE event scheduled for each device, to not schedule
+// the same one twice
+static uint64_t device_event_ns[2] = {UINT64_MAX, UINT64_MAX};
+// Live stats segment read by kernelstat
+static stats_shm_t *live_stats;
+// Simulation time the kernel started running at
+static uint64_t kernel_start_ns = 0;
+// Recording of this run's inputs (-r), or the recording being replayed (-R)
+static replay_t *recording = NULL;
+static replay_t *replaying = NULL;
+// Metrics of the run are written here at the end, with -m
+static FILE *metrics_file = NULL;
+// Whether a replay found an input the kernel couldn't have handled
+static bool replay_diverged = false;
+// Folded from every app state change, equal in a run and in its replay
+static uint64_t schedule_checksum = REPLAY_CHECKSUM_INIT;
+// Interrupts and syscall requests handled, published in the stats segment
+static uint64_t time_irq_count = 0;
+static uint64_t device_irq_count = 0;
+static uint64_t syscall_count = 0;
+// Binary trace of state changes and interrupts, or NULL if not tracing
+static trace_t *trace = NULL;
+// Whether running apps issue memory accesses through the vm model
+static bool vm_enabled = false;
+// Image the run was restored from (-K), or NULL
+static checkpoint_t *restoring = NULL;
+
+// Returns the device a syscall waits on, 1 or 2
+static inline int syscall_device(syscall_t call) {
+  return (call >= SYSCALL_D1_R && call <= SYSCALL_D1_X) ? 1 : 2;
+}
 
 // Updates the stats of an app according to the syscall type
 static inline void update_app_stats(syscall_t call, int app_id) {
@@ -67,281 +149,1673 @@ static inline void update_app_stats(syscall_t call, int app_id) {
   }
 }
 
+// Publishes an app's counters in the stats segment. Called after every
+// change, and at every tick of a running app so its run time can be
+// extrapolated from updated_ns
+static void publish_app_stats(int app_id) {
+  stats_app_t *entry = &stats_apps(live_stats)[app_id];
+  const sched_stats_t *sched = sched_get_stats(app_id);
+  uint64_t now = get_time_ns();
+
+  stats_write_begin(&entry->seq);
+  if (entry->state != apps[app_id].state) {
+    entry->state_since_ns = now;
+  }
+  entry->state = apps[app_id].state;
+  entry->cpu_id = apps[app_id].cpu_id;
+  entry->D1_access_count = apps[app_id].D1_access_count;
+  entry->D2_access_count = apps[app_id].D2_access_count;
+  entry->read_count = apps[app_id].read_count;
+  entry->write_count = apps[app_id].write_count;
+  entry->exec_count = apps[app_id].exec_count;
+  entry->switches = sched->dispatches;
+  entry->preemptions = sched->preemptions;
+  entry->blocks = sched->blocks;
+  entry->run_ns = sched->run_ns;
+  entry->wait_ns = sched->wait_ns;
+  entry->blocked_ns = sched->blocked_ns;
+  if (vm_enabled) {
+    const vm_stats_t *vm = vm_get_stats(app_id);
+
+    entry->mem_accesses = vm->accesses;
+    entry->tlb_hits = vm->tlb_hits;
+    entry->page_faults = vm->faults;
+  }
+  entry->updated_ns = now;
+  stats_write_end(&entry->seq);
+}
+
+// Publishes the kernel and CPU counters in the stats segment, once per
+// main loop wakeup
+static void publish_kernel_stats(void) {
+  stats_kernel_t *kernel = &live_stats->kernel;
+  stats_cpu_t *entries = stats_cpus(live_stats);
+
+  stats_write_begin(&live_stats->seq);
+  kernel->start_ns = kernel_start_ns;
+  kernel->now_ns = get_time_ns();
+  for (int i = 0; i <= FINISHED; i++) {
+    kernel->state_counts[i] = state_counts[i];
+  }
+  kernel->paused = kernel_paused;
+  kernel->finished = !kernel_running;
+  kernel->time_irqs = time_irq_count;
+  kernel->device_irqs = device_irq_count;
+  kernel->syscalls = syscall_count;
+  for (int i = 0; i < cpu_amount; i++) {
+    entries[i].running_app_id = cpus[i].running_app_id;
+    entries[i].busy_ticks = cpus[i].busy_ticks;
+    entries[i].idle_ticks = cpus[i].idle_ticks;
+    entries[i].steals = cpus[i].steals;
+    entries[i].migrations = cpus[i].migrations;
+  }
+  stats_write_end(&live_stats->seq);
+}
+
+// Moves an app to a new state, keeping the state counters and the running
+// app of its CPU up to date
+static inline void set_app_state(int app_id, proc_state_t state) {
+  cpu_t *cpu = &cpus[apps[app_id].cpu_id];
+
+  state_counts[apps[app_id].state]--;
+  state_counts[state]++;
+
+  if (state == RUNNING) {
+    cpu->running_app_id = app_id;
+  } else if (cpu->running_app_id == app_id) {
+    cpu->running_app_id = -1;
+  }
+
+  apps[app_id].state = state;
+  schedule_checksum =
+      replay_checksum(schedule_checksum, get_time_ns() - kernel_start_ns,
+                      app_id, state, apps[app_id].cpu_id);
+
+  if (trace != NULL) {
+    syscall_t call = get_app_syscall(shm, app_id);
+    // Apps blocked without a pending syscall faulted on a page
+    int device = (state != BLOCKED)       ? 0
+                 : (call != SYSCALL_NONE) ? syscall_device(call)
+                                          : config.vm_swap_device;
+    trace_record(trace, get_time_ns(), TRACE_APP_STATE, state,
+                 apps[app_id].cpu_id, app_id, device);
+  }
+
+  publish_app_stats(app_id);
+}
+
 // Returns whether all apps have finished executing
-static bool all_apps_finished(void) {
-  for (int i = 0; i < APP_AMOUNT; i++) {
-    if (apps[i].state != FINISHED) {
-      return false;
-    }
+static inline bool all_apps_finished(void) {
+  return state_counts[FINISHED] == app_amount;
+}
+
+// Sends a signal to intersim, which isn't spawned in virtual time
+static void signal_intersim(int signum) {
+  if (intersim_pid > 0) {
+    kill(intersim_pid, signum);
   }
+}
 
-  return true;
+// Waits until a child has stopped itself, after a SIGUSR1 or while
+// booting, so our SIGCONT can't arrive before its SIGSTOP. Returns right
+// away in the usual case, where it stopped long ago. WNOWAIT leaves the
+// stop unreported, so this only tells whether the child is currently stopped
+static void wait_child_stopped(pid_t pid) {
+  siginfo_t info;
+
+  while (waitid(P_PID, pid, &info, WSTOPPED | WNOWAIT) == -1 &&
+         errno == EINTR)
+    ;
 }
 
-// Returns the appid of the current running app
-static int get_running_appid(void) {
-  for (int i = 0; i < APP_AMOUNT; i++) {
-    if (apps[i].state == RUNNING) {
-      return apps[i].app_id;
-    }
+// Record mode: appends an input the kernel is about to handle. Interrupts
+// and syscall requests freeze the clock in real time, so everything done
+// for them sees the recorded time, as it will in the replay
+static void record_input(replay_type_t type, int value, int arg) {
+  if (recording == NULL)
+    return;
+
+  if (type != REPLAY_PREEMPT_SKIP && !virtual_time) {
+    set_virtual_time_ns(get_real_time_ns());
   }
+  replay_append(recording, get_time_ns() - kernel_start_ns, type, value, arg);
+}
 
-  return -1;
+// Asks an app to save its context and stop, with SIGUSR1 or by flipping
+// its park request in fast-switch mode. Coroutine apps stop right away
+static void stop_app(int app_id) {
+  if (engine == ENGINE_REPLAY) {
+    return;
+  } else if (engine == ENGINE_COROUTINE) {
+    coapp_stop(app_id);
+  } else if (switch_mode == SWITCH_FUTEX) {
+    request_app_park(&shm->ctxs[app_id]);
+  } else {
+    kill(apps[app_id].app_pid, SIGUSR1);
+  }
 }
 
-// Returns how many apps are either blocked or have finished
-static int amount_apps_not_ready(void) {
-  int count = 0;
+// Continues a stopped app and releases its handshake, once it has
+// actually stopped
+static void continue_app(int app_id) {
+  app_ctx_t *ctx = &shm->ctxs[app_id];
 
-  for (int i = 0; i < APP_AMOUNT; i++) {
-    if (apps[i].state == FINISHED || apps[i].state == BLOCKED) {
-      count++;
-    }
+  if (engine == ENGINE_REPLAY) {
+    return;
+  } else if (engine == ENGINE_COROUTINE) {
+    end_app_handshake(ctx);
+    coapp_continue(app_id);
+  } else if (switch_mode == SWITCH_FUTEX) {
+    wait_app_parked(ctx);
+    end_app_handshake(ctx);
+    resume_app(ctx);
+  } else {
+    end_app_handshake(ctx);
+    wait_child_stopped(apps[app_id].app_pid);
+    kill(apps[app_id].app_pid, SIGCONT);
   }
+}
+
+// Discrete-event mode: schedules a check of the device at its next event,
+// unless one is already scheduled then
+static void schedule_device_event(device_t *dev) {
+  int i = dev->irq - IRQ_D1;
+  uint64_t next_ns = device_next_event_ns(dev);
 
-  return count;
+  if (next_ns != UINT64_MAX && next_ns != device_event_ns[i]) {
+    des_schedule(next_ns, DES_DEVICE, dev->irq);
+    device_event_ns[i] = next_ns;
+  }
 }
 
-// Whether an app has a pending syscall request in shm
-static inline bool has_pending_syscall(int app_id) {
-  return get_app_syscall(shm, app_id) != SYSCALL_NONE;
+// Service model: queues the request of an app that just blocked on its
+// device, run by intersim or by ourselves in virtual time
+static void submit_device_request(syscall_t call) {
+  // Replayed device interrupts were recorded along with the requests
+  if (device_model != DEVICE_MODEL_SERVICE || engine == ENGINE_REPLAY)
+    return;
+
+  if (virtual_time) {
+    device_t *dev = &devices[syscall_device(call) - 1];
+
+    device_submit(dev, call, get_time_ns());
+    schedule_device_event(dev);
+  } else {
+    device_request_t request = {.call = call, .submit_ns = get_time_ns()};
+
+    if (write(devpipe_write_fd, &request, sizeof(request)) == -1) {
+      fprintf(stderr, "Pipe error\n");
+      exit(8);
+    }
+  }
 }
 
-// Handles an incoming syscall from the apps syscall pipe
-static void handle_app_syscall(int app_id) {
-  assert(apps[app_id].state == RUNNING);
+// Handles an incoming syscall request from the syscall ring
+static void handle_app_syscall(const syscall_request_t *request) {
+  int app_id = request->app_id;
+  syscall_t call = request->call;
 
-  syscall_t call = get_app_syscall(shm, app_id);
+  record_input(REPLAY_SYSCALL, call, app_id);
 
+  assert(apps[app_id].state == RUNNING);
   assert(call != SYSCALL_NONE);
+  assert(call == get_app_syscall(shm, app_id));
+  syscall_count++;
 
   if (call == SYSCALL_APP_FINISHED) {
-    dmsg("Kernel got finished app %d", app_id + 1);
+    cdmsg(LOG_CAT_SYSCALL, "Kernel got finished app %d", app_id + 1);
 
-    apps[app_id].state = FINISHED;
+    sched_finish(app_id);
+    if (vm_enabled) {
+      vm_release(app_id);
+    }
+    set_app_state(app_id, FINISHED);
 
     if (all_apps_finished()) {
       dmsg("Syscall handler: All apps finished");
       kernel_running = false;
-      kill(intersim_pid, SIGTERM);
+      signal_intersim(SIGTERM);
     }
 
     return;
   }
 
-  // Device syscall. Save, block, update stats, enqueue.
-  apps[app_id].state = BLOCKED;
-  kill(apps[app_id].app_pid, SIGUSR1); // save state
+  // Device syscall. Update stats, block, save, enqueue.
   update_app_stats(call, app_id);
+  sched_block(app_id);
+  set_app_state(app_id, BLOCKED);
+  stop_app(app_id); // save state
 
-  if (call >= SYSCALL_D1_R && call <= SYSCALL_D1_X) {
+  if (syscall_device(call) == 1) {
     enqueue(D1_app_queue, app_id);
   } else {
     enqueue(D2_app_queue, app_id);
   }
+  submit_device_request(call);
+
+  cdmsg(LOG_CAT_SYSCALL, "App %d blocked for syscall: %s, %lu us after submit",
+        app_id + 1, SYSCALL_STR[call],
+        (unsigned long)((get_time_ns() - request->submit_ns) / 1000));
+}
+
+// Asks every app process that hasn't finished and intersim to exit.
+// Stopped children only handle the SIGTERM once continued
+static void terminate_children(void) {
+  for (int i = 0; i < app_amount && engine == ENGINE_PROCESS; i++) {
+    if (apps[i].app_pid > 0 && apps[i].state != FINISHED) {
+      kill(apps[i].app_pid, SIGTERM);
+      kill(apps[i].app_pid, SIGCONT);
+    }
+  }
 
-  dmsg("App %d blocked for syscall: %s", app_id + 1, SYSCALL_STR[call]);
+  signal_intersim(SIGTERM);
+  signal_intersim(SIGCONT);
 }
 
-// Called on Ctrl+C.
+// Called on Ctrl+C, read from the signalfd.
 // Terminate children, cleanup and exit
-static void handle_sigint(int signum) {
+static void handle_sigint(void) {
   printf("\n");
   fflush(stdout);
   msg("Kernel stopping from SIGINT");
 
-  // kill all apps
-  for (int i = 0; i < APP_AMOUNT; i++) {
-    if (apps[i].state != FINISHED) {
-      kill(apps[i].app_pid, SIGTERM);
-    }
-  }
-
-  // kill intersim
-  kill(intersim_pid, SIGTERM);
+  terminate_children();
 
   // and exit from main
   kernel_paused = false;
   kernel_running = false;
 }
 
-// Stops current running app and dispatch the next app in queue
-static void dispatch_next_app(void) {
+// Returns the CPU with the longest run queue other than the given one,
+// or NULL if all of them are empty
+static cpu_t *find_steal_victim(const cpu_t *thief) {
+  cpu_t *victim = NULL;
+
+  for (int i = 0; i < cpu_amount; i++) {
+    if (i != thief->cpu_id && sched_queue_length(i) > 0 &&
+        (victim == NULL ||
+         sched_queue_length(i) > sched_queue_length(victim->cpu_id))) {
+      victim = &cpus[i];
+    }
+  }
+
+  return victim;
+}
+
+// Takes the next app from the CPU's run queue. If it's empty the CPU is
+// idle, so it steals one from the busiest CPU instead.
+// Returns -1 if no app is waiting anywhere
+static int take_next_app(cpu_t *cpu) {
+  int app_id = sched_pick_next(cpu->cpu_id);
+
+  if (app_id == -1) {
+    cpu_t *victim = find_steal_victim(cpu);
+
+    if (victim != NULL) {
+      app_id = sched_pick_next(victim->cpu_id);
+      cpu->steals++;
+      cdmsg(LOG_CAT_DISPATCH, "CPU %d stole app %d from CPU %d", cpu->cpu_id,
+            app_id + 1, victim->cpu_id);
+    }
+  }
+
+  return app_id;
+}
+
+// Claims the handshake of a running app before preempting it. Fails while
+// the app claims it for a syscall, which is recorded, or read back from
+// the recording in a replay
+static bool try_preempt_app(int app_id) {
+  if (engine == ENGINE_REPLAY) {
+    replay_record_t record;
+
+    if (replay_peek(replaying, &record) &&
+        record.type == REPLAY_PREEMPT_SKIP && record.arg == app_id) {
+      replay_skip(replaying);
+      return false;
+    }
+    return true;
+  }
+
+  if (try_begin_preempt(&shm->ctxs[app_id]))
+    return true;
+
+  record_input(REPLAY_PREEMPT_SKIP, 0, app_id);
+  return false;
+}
+
+// Blocks a running app that faulted on a page, once its handshake is
+// claimed, until the swap device reads the page in
+static void block_faulted_app(int app_id) {
+  syscall_t call = config.vm_swap_device == 1 ? SYSCALL_D1_R : SYSCALL_D2_R;
+
+  cdmsg(LOG_CAT_DISPATCH, "App %d blocked for page fault", app_id + 1);
+
+  vm_handle_fault(app_id);
+  sched_block(app_id);
+  set_app_state(app_id, BLOCKED);
+  stop_app(app_id);
+
+  enqueue(config.vm_swap_device == 1 ? D1_app_queue : D2_app_queue, app_id);
+  submit_device_request(call);
+}
+
+// Stops the app running on a CPU and dispatches the next app in its queue
+static void dispatch_next_app(cpu_t *cpu) {
   // Check if we're done
   if (all_apps_finished()) {
-    dmsg("Dispatcher: All apps finished");
+    cdmsg(LOG_CAT_DISPATCH, "Dispatcher: All apps finished");
     kernel_running = false;
-    kill(intersim_pid, SIGTERM);
+    signal_intersim(SIGTERM);
 
     return;
   }
 
-  int cur_app_id = get_running_appid();
+  int cur_app_id = cpu->running_app_id;
+  bool has_waiting_app = sched_queue_length(cpu->cpu_id) > 0;
+  // Whether the policy wants the running app off the CPU
+  bool slice_over =
+      cur_app_id != -1 && sched_tick(cpu->cpu_id, cur_app_id);
+
+  if (cur_app_id != -1) {
+    cpu->busy_ticks++;
+  } else {
+    cpu->idle_ticks++;
+  }
 
-  // Pause app unless it's the only ready one, or has a pending syscall
-  if (cur_app_id != -1 && amount_apps_not_ready() < (APP_AMOUNT - 1) &&
-      !has_pending_syscall(cur_app_id)) {
-    // Pause and insert into dispatch queue
+  // The running app's accesses of this tick. A fault blocks it unless it's
+  // starting a syscall, then the access is retried at its next tick
+  bool faulted = vm_enabled && cur_app_id != -1 &&
+                 vm_run_app(cpu->cpu_id, cur_app_id,
+                            config.vm_accesses_per_tick);
+
+  // Pause app unless its timeslice goes on, no other app is waiting for
+  // this CPU, or it has a pending syscall.
+  // Claiming the handshake keeps the app from starting a syscall meanwhile
+  int paused_app_id = -1;
+  if (faulted) {
+    if (try_preempt_app(cur_app_id)) {
+      block_faulted_app(cur_app_id);
+    }
+  } else if (slice_over && has_waiting_app && try_preempt_app(cur_app_id)) {
+    // Pause, it goes back into the run queue after picking the next one
     assert(apps[cur_app_id].state == RUNNING);
-    dmsg("Dispatcher pausing app %d", cur_app_id + 1);
+    cdmsg(LOG_CAT_DISPATCH, "Dispatcher pausing app %d on CPU %d",
+          cur_app_id + 1, cpu->cpu_id);
 
-    apps[cur_app_id].state = PAUSED;
-    kill(apps[cur_app_id].app_pid, SIGUSR1);
-    enqueue(dispatch_queue, cur_app_id);
+    set_app_state(cur_app_id, PAUSED);
+    stop_app(cur_app_id);
+    paused_app_id = cur_app_id;
   } else {
     // No apps to pause
-    dmsg("Dispatcher found no apps to pause");
+    cdmsg(LOG_CAT_DISPATCH, "Dispatcher found no apps to pause on CPU %d",
+          cpu->cpu_id);
   }
 
-  // Dispatch next app
-  int next_app_id = dequeue(dispatch_queue);
+  // Dispatch next app if the CPU is free
+  int next_app_id = cpu->running_app_id == -1 ? take_next_app(cpu) : -1;
   if (next_app_id != -1) {
     assert(apps[next_app_id].state == PAUSED);
-    dmsg("Dispatcher continued app %d", next_app_id + 1);
-    apps[next_app_id].state = RUNNING;
-    kill(apps[next_app_id].app_pid, SIGCONT);
-  } else {
-    dmsg("Dispatcher found no apps to continue");
+    cdmsg(LOG_CAT_DISPATCH, "Dispatcher continued app %d on CPU %d",
+          next_app_id + 1, cpu->cpu_id);
+
+    if (apps[next_app_id].cpu_id != cpu->cpu_id) {
+      cpu->migrations++;
+      apps[next_app_id].cpu_id = cpu->cpu_id;
+    }
+
+    set_app_state(next_app_id, RUNNING);
+    if (vm_enabled) {
+      vm_switch(cpu->cpu_id, next_app_id);
+    }
+    continue_app(next_app_id);
+  } else if (cpu->running_app_id == -1) {
+    cdmsg(LOG_CAT_DISPATCH, "Dispatcher found no apps to continue on CPU %d",
+          cpu->cpu_id);
+  }
+
+  if (paused_app_id != -1) {
+    sched_preempt(cpu->cpu_id, paused_app_id);
+    publish_app_stats(paused_app_id);
+  } else if (cur_app_id != -1 && cpu->running_app_id == cur_app_id) {
+    // Still running, charged up to now by the tick
+    publish_app_stats(cur_app_id);
   }
 }
 
+// Prints utilization, steals and migrations of each CPU
+static void dump_cpus_info(void) {
+  for (int i = 0; i < cpu_amount; i++) {
+    uint64_t ticks = cpus[i].busy_ticks + cpus[i].idle_ticks;
+
+    msg("CPU %d | %5.1f%% busy | %lu steals | %lu migrations", i,
+        ticks ? 100.0 * cpus[i].busy_ticks / ticks : 0.0,
+        (unsigned long)cpus[i].steals, (unsigned long)cpus[i].migrations);
+  }
+}
+
+// Prints how long apps took to honor park requests in fast-switch mode,
+// which is the cooperative preemption latency
+static void dump_switch_info(void) {
+  uint64_t sum_ns = 0, max_ns = 0, parks = 0;
+
+  if (switch_mode != SWITCH_FUTEX)
+    return;
+
+  for (int i = 0; i < app_amount; i++) {
+    sum_ns += shm->ctxs[i].park_latency_sum_ns;
+    parks += shm->ctxs[i].parks;
+    if (shm->ctxs[i].park_latency_max_ns > max_ns) {
+      max_ns = shm->ctxs[i].park_latency_max_ns;
+    }
+  }
+
+  msg("Preemption latency | %.1f us avg / %.1f us max over %lu parks",
+      parks ? sum_ns / 1000.0 / parks : 0.0, max_ns / 1000.0,
+      (unsigned long)parks);
+}
+
+// Prints the syscall stats summed over every app, which only depend on the
+// seed and not on timing
+static void dump_totals_info(void) {
+  int d1 = 0, d2 = 0, reads = 0, writes = 0, execs = 0;
+
+  for (int i = 0; i < app_amount; i++) {
+    d1 += apps[i].D1_access_count;
+    d2 += apps[i].D2_access_count;
+    reads += apps[i].read_count;
+    writes += apps[i].write_count;
+    execs += apps[i].exec_count;
+  }
+
+  msg("Totals | %d / %d D1/D2 access | %d / %d / %d R/W/X requests", d1, d2,
+      reads, writes, execs);
+}
+
+// Large context switch costs summed over every app, as measured by them
+typedef struct {
+  uint64_t saves;
+  uint64_t restores;
+  uint64_t save_ns;
+  uint64_t restore_ns;
+  uint64_t bytes_saved;
+  uint64_t bytes_restored;
+} context_costs_t;
+
+static context_costs_t sum_context_costs(void) {
+  context_costs_t costs = {0};
+
+  for (int i = 0; i < app_amount; i++) {
+    const app_area_t *area = get_app_area(shm, i);
+
+    costs.saves += area->saves;
+    costs.restores += area->restores;
+    costs.save_ns += area->save_ns;
+    costs.restore_ns += area->restore_ns;
+    costs.bytes_saved += area->bytes_saved;
+    costs.bytes_restored += area->bytes_restored;
+  }
+
+  return costs;
+}
+
+// Prints the bytes copied and time taken by saving and restoring the large
+// app contexts, a switch being a save and the following restore
+static void dump_context_info(void) {
+  context_costs_t costs = sum_context_costs();
+  uint64_t saves = costs.saves ? costs.saves : 1;
+  uint64_t restores = costs.restores ? costs.restores : 1;
+
+  if (engine == ENGINE_REPLAY)
+    return;
+
+  msg("Context | %d KB working set, %s | %lu saves / %lu restores",
+      config.app_context_kb,
+      config.app_context_zero_copy ? "zero-copy" : "dirty chunks copied",
+      (unsigned long)costs.saves, (unsigned long)costs.restores);
+  msg("Context | %.1f / %.1f KB copied and %.2f / %.2f us per save/restore",
+      costs.bytes_saved / 1024.0 / saves,
+      costs.bytes_restored / 1024.0 / restores, costs.save_ns / 1000.0 / saves,
+      costs.restore_ns / 1000.0 / restores);
+}
+
+// Memory counters summed over every app
+static vm_stats_t sum_vm_stats(void) {
+  vm_stats_t sum = {0};
+
+  for (int i = 0; i < app_amount && vm_enabled; i++) {
+    const vm_stats_t *stats = vm_get_stats(i);
+
+    sum.accesses += stats->accesses;
+    sum.tlb_hits += stats->tlb_hits;
+    sum.faults += stats->faults;
+    sum.evictions += stats->evictions;
+    sum.resident += stats->resident;
+  }
+
+  return sum;
+}
+
+// Prints the page faults and TLB hits of the memory accesses, which only
+// depend on the seed and the schedule
+static void dump_vm_info(void) {
+  vm_stats_t sum = sum_vm_stats();
+  uint64_t accesses = sum.accesses ? sum.accesses : 1;
+
+  if (!vm_enabled)
+    return;
+
+  msg("Memory | %s replacement | %d pages per app / %d frames / %d TLB "
+      "entries",
+      VM_REPLACEMENT_STR[config.vm_replacement], config.vm_pages,
+      config.vm_frames, config.vm_tlb_entries);
+  msg("Memory | %lu accesses | %lu faults / %lu evictions | %.3f%% faults / "
+      "%.1f%% TLB hits",
+      (unsigned long)sum.accesses, (unsigned long)sum.faults,
+      (unsigned long)sum.evictions, 100.0 * sum.faults / accesses,
+      100.0 * sum.tlb_hits / accesses);
+}
+
+// Sums of the scheduling metrics over a class of finished apps
+typedef struct {
+  int apps;
+  uint64_t turnaround_ns;
+  uint64_t response_ns; // Sum of each app's average response time
+  uint64_t wait_ns;
+} sched_class_t;
+
+static void dump_sched_class(const char *name, const sched_class_t *class) {
+  if (class->apps == 0)
+    return;
+
+  msg("%s | %d apps | %.1f ms turnaround / %.1f ms response / "
+      "%.1f ms wait avg",
+      name, class->apps, class->turnaround_ns / 1e6 / class->apps,
+      class->response_ns / 1e6 / class->apps,
+      class->wait_ns / 1e6 / class->apps);
+}
+
+// Adds a finished app's times to a class
+static void add_sched_class(sched_class_t *class, const sched_stats_t *stats) {
+  class->apps++;
+  class->turnaround_ns += stats->finish_ns - stats->arrival_ns;
+  class->response_ns +=
+      stats->responses ? stats->response_sum_ns / stats->responses : 0;
+  class->wait_ns += stats->wait_ns;
+}
+
+// Prints the throughput of the run and the average turnaround, response
+// and wait times of finished apps. Apps that blocked more often than they
+// were preempted count as I/O-bound, the rest as CPU-bound. With more than
+// one workload profile, apps are also grouped by profile
+static void dump_sched_info(uint64_t start_ns) {
+  sched_class_t io_bound = {0}, cpu_bound = {0};
+  sched_class_t workloads[WORKLOAD_AMOUNT] = {0};
+  int workload_amount = 0;
+  uint64_t elapsed_ns = get_time_ns() - start_ns;
+
+  for (int i = 0; i < app_amount; i++) {
+    const sched_stats_t *stats = sched_get_stats(i);
+
+    if (apps[i].state != FINISHED)
+      continue;
+
+    add_sched_class(stats->blocks > stats->preemptions ? &io_bound
+                                                       : &cpu_bound,
+                    stats);
+    add_sched_class(&workloads[shm->ctxs[i].workload], stats);
+  }
+  for (int w = 0; w < WORKLOAD_AMOUNT; w++) {
+    workload_amount += workload_mix.weights[w] > 0;
+  }
+
+  msg("Sched %s | %d finished apps, %.2f apps/s",
+      SCHED_POLICY_STR[sched_policy], state_counts[FINISHED],
+      elapsed_ns ? state_counts[FINISHED] * 1e9 / elapsed_ns : 0.0);
+  dump_sched_class("I/O-bound", &io_bound);
+  dump_sched_class("CPU-bound", &cpu_bound);
+  for (int w = 0; w < WORKLOAD_AMOUNT && workload_amount > 1; w++) {
+    dump_sched_class(WORKLOAD_STR[w], &workloads[w]);
+  }
+}
+
+// Writes the metrics of the run as key=value lines, read by sweepsim. Times
+// are averaged over finished apps, and dispatches count context switches
+static void write_metrics(FILE *file, uint64_t start_ns) {
+  sched_class_t finished = {0};
+  context_costs_t costs = sum_context_costs();
+  uint64_t switches = costs.saves ? costs.saves : 1;
+  vm_stats_t vm = sum_vm_stats();
+  uint64_t accesses = vm.accesses ? vm.accesses : 1;
+  uint64_t dispatches = 0, preemptions = 0, blocks = 0;
+  uint64_t busy_ticks = 0, ticks = 0;
+  uint64_t elapsed_ns = get_time_ns() - start_ns;
+  int apps_amount;
+
+  for (int i = 0; i < app_amount; i++) {
+    const sched_stats_t *stats = sched_get_stats(i);
+
+    dispatches += stats->dispatches;
+    preemptions += stats->preemptions;
+    blocks += stats->blocks;
+    if (apps[i].state == FINISHED) {
+      add_sched_class(&finished, stats);
+    }
+  }
+  for (int i = 0; i < cpu_amount; i++) {
+    busy_ticks += cpus[i].busy_ticks;
+    ticks += cpus[i].busy_ticks + cpus[i].idle_ticks;
+  }
+  apps_amount = finished.apps ? finished.apps : 1;
+
+  fprintf(file, "finished_apps=%d\n", finished.apps);
+  fprintf(file, "elapsed_s=%.6f\n", elapsed_ns / 1e9);
+  fprintf(file, "throughput=%.4f\n",
+          elapsed_ns ? finished.apps * 1e9 / elapsed_ns : 0.0);
+  fprintf(file, "turnaround_ms=%.3f\n",
+          finished.turnaround_ns / 1e6 / apps_amount);
+  fprintf(file, "response_ms=%.3f\n", finished.response_ns / 1e6 / apps_amount);
+  fprintf(file, "wait_ms=%.3f\n", finished.wait_ns / 1e6 / apps_amount);
+  fprintf(file, "dispatches=%lu\n", (unsigned long)dispatches);
+  fprintf(file, "preemptions=%lu\n", (unsigned long)preemptions);
+  fprintf(file, "blocks=%lu\n", (unsigned long)blocks);
+  fprintf(file, "time_irqs=%lu\n", (unsigned long)time_irq_count);
+  fprintf(file, "device_irqs=%lu\n", (unsigned long)device_irq_count);
+  fprintf(file, "syscalls=%lu\n", (unsigned long)syscall_count);
+  fprintf(file, "cpu_busy_pct=%.1f\n",
+          ticks ? 100.0 * busy_ticks / ticks : 0.0);
+  fprintf(file, "context_kb_per_switch=%.3f\n",
+          (costs.bytes_saved + costs.bytes_restored) / 1024.0 / switches);
+  fprintf(file, "context_us_per_switch=%.3f\n",
+          (costs.save_ns + costs.restore_ns) / 1000.0 / switches);
+  fprintf(file, "page_faults=%lu\n", (unsigned long)vm.faults);
+  fprintf(file, "fault_rate_pct=%.3f\n", 100.0 * vm.faults / accesses);
+  fprintf(file, "tlb_hit_pct=%.1f\n", 100.0 * vm.tlb_hits / accesses);
+  fprintf(file, "checksum=%016lx\n", (unsigned long)schedule_checksum);
+}
+
 // Prints proc_info_t and shm state for each app
 static void dump_apps_info(void) {
-  for (int i = 0; i < APP_AMOUNT; i++) {
+  for (int i = 0; i < app_amount; i++) {
     msg("----------- App %d -----------", i + 1);
     msg("Counter        | %d", get_app_counter(shm, i));
     msg("State          | %s", PROC_STATE_STR[apps[i].state]);
+    msg("Workload       | %s", WORKLOAD_STR[shm->ctxs[i].workload]);
+    msg("CPU            | %d", apps[i].cpu_id);
     msg("Pending call   | %s", SYSCALL_STR[get_app_syscall(shm, i)]);
     msg("D1/D2 access   | %d / %d", apps[i].D1_access_count,
         apps[i].D2_access_count);
     msg("R/W/X requests | %d / %d / %d", apps[i].read_count,
         apps[i].write_count, apps[i].exec_count);
+    const app_area_t *area = get_app_area(shm, i);
+    msg("Context        | %lu saves | %.1f KB / %.2f us per save",
+        (unsigned long)area->saves,
+        area->saves ? area->bytes_saved / 1024.0 / area->saves : 0.0,
+        area->saves ? area->save_ns / 1000.0 / area->saves : 0.0);
+    if (vm_enabled) {
+      const vm_stats_t *vm = vm_get_stats(i);
+      msg("Memory         | %d pages resident | %lu faults / %lu evictions "
+          "| %.1f%% TLB hits",
+          vm->resident, (unsigned long)vm->faults,
+          (unsigned long)vm->evictions,
+          vm->accesses ? 100.0 * vm->tlb_hits / vm->accesses : 0.0);
+    }
+    msg("Contention     | %u app waits / %u preempt skips",
+        atomic_load(&shm->ctxs[i].app_waits),
+        atomic_load(&shm->ctxs[i].preempt_skips));
+    const sched_stats_t *stats = sched_get_stats(i);
+    msg("Sched          | %.1f ms run / %.1f ms wait | %u dispatches / "
+        "%u preempts / %u blocks",
+        stats->run_ns / 1e6, stats->wait_ns / 1e6, stats->dispatches,
+        stats->preemptions, stats->blocks);
+    if (switch_mode == SWITCH_FUTEX) {
+      app_ctx_t *ctx = &shm->ctxs[i];
+      msg("Park latency   | %.1f us avg / %.1f us max over %u parks",
+          ctx->parks ? ctx->park_latency_sum_ns / 1000.0 / ctx->parks : 0.0,
+          ctx->park_latency_max_ns / 1000.0, ctx->parks);
+    }
   }
 
   msg("-----------------------------");
+  dump_cpus_info();
 }
 
-// Called on SIGUSR1.
-// Pauses or unpauses intersim, the current running app, and the kernelsim.
-// Dumps apps info after pausing
-static void handle_pause(int signum) {
-  int running_app = get_running_appid();
-
+// Called on SIGUSR1, read from the signalfd.
+// Pauses or unpauses intersim, the running apps, and the kernelsim.
+// Dumps apps info after pausing. While paused, the main loop only listens to
+// the signalfd
+static void handle_pause(void) {
   if (kernel_paused) {
-    // unpause
-    if (running_app != -1) {
-      kill(apps[running_app].app_pid, SIGCONT);
+    // unpause, coroutine apps only run from the main loop
+    for (int i = 0; i < cpu_amount && engine == ENGINE_PROCESS; i++) {
+      if (cpus[i].running_app_id != -1) {
+        kill(apps[cpus[i].running_app_id].app_pid, SIGCONT);
+      }
     }
-    kill(intersim_pid, SIGCONT);
+    signal_intersim(SIGCONT);
 
     kernel_paused = false;
     msg("Kernel resumed");
   } else {
     // pause and dump apps info
-    if (running_app != -1) {
-      kill(apps[running_app].app_pid, SIGSTOP);
+    for (int i = 0; i < cpu_amount && engine == ENGINE_PROCESS; i++) {
+      if (cpus[i].running_app_id != -1) {
+        kill(apps[cpus[i].running_app_id].app_pid, SIGSTOP);
+      }
     }
-    kill(intersim_pid, SIGSTOP);
+    signal_intersim(SIGSTOP);
 
     dump_apps_info();
 
     kernel_paused = true;
     msg("Kernel paused");
+  }
+}
 
-    // pause kernelsim and don't block SIGUSR1
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigsuspend(&mask);
+// Called on SIGCHLD, read from the signalfd.
+// Reaps every child that has terminated since the last wakeup
+static void handle_sigchld(void) {
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    if (WIFEXITED(status)) {
+      dmsg("Kernel reaped child %d with exit code %d", pid,
+           WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+      dmsg("Kernel reaped child %d killed by signal %d", pid,
+           WTERMSIG(status));
+    }
   }
 }
 
-// Dequeue app from device queue and change its blocked state,
-// then add it to the dispatch queue
-static void unblock_next_app(irq_t irq) {
-  int app_id = (irq == IRQ_D1) ? dequeue(D1_app_queue) : dequeue(D2_app_queue);
+// Blocks until every child has exited and reaps it, so none outlives us
+static void reap_children(void) {
+  pid_t pid;
+  int status;
 
-  if (app_id == -1) {
-    dmsg("No apps waiting on D%d", irq);
+  while ((pid = waitpid(-1, &status, 0)) > 0 || errno == EINTR) {
+    if (pid > 0 && WIFSIGNALED(status)) {
+      dmsg("Kernel reaped child %d killed by signal %d", pid,
+           WTERMSIG(status));
+    }
+  }
+}
+
+// Spawns a child running argv[0] with the given signal mask. close_fd, if
+// not -1, is only closed in the child. posix_spawn doesn't copy our page
+// tables, so spawning thousands of apps stays cheap.
+// Returns the child's pid, or -1 on error
+static pid_t spawn_child(char *const argv[], const sigset_t *mask,
+                         int close_fd) {
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t actions;
+  pid_t pid;
+
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setsigmask(&attr, mask);
+  posix_spawn_file_actions_init(&actions);
+  if (close_fd != -1) {
+    posix_spawn_file_actions_addclose(&actions, close_fd);
+  }
+
+  int error = posix_spawn(&pid, argv[0], &actions, &attr, argv, environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+  return error == 0 ? pid : -1;
+}
+
+// Waits for the given amount of children to write to the readiness
+// eventfd, right before each one stops itself.
+// Returns false if a child exited or SIGINT arrived first
+static bool wait_children_ready(int ready_fd, int signal_fd, int amount) {
+  struct pollfd fds[] = {{.fd = ready_fd, .events = POLLIN},
+                         {.fd = signal_fd, .events = POLLIN}};
+  uint64_t ready = 0;
+
+  while (ready < (uint64_t)amount) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "Poll error\n");
+      exit(14);
+    }
+
+    if (fds[1].revents & POLLIN) {
+      struct signalfd_siginfo info;
+
+      // A pause request before we start running is dropped
+      while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGINT || info.ssi_signo == SIGCHLD)
+          return false;
+      }
+    }
+
+    uint64_t count;
+    if ((fds[0].revents & POLLIN) &&
+        read(ready_fd, &count, sizeof(count)) == sizeof(count)) {
+      ready += count;
+    }
+  }
+
+  return true;
+}
+
+// Reads every pending signal from the signalfd and dispatches it
+static void handle_signalfd(int signal_fd) {
+  struct signalfd_siginfo info;
+
+  while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+    switch (info.ssi_signo) {
+    case SIGINT:
+      handle_sigint();
+      break;
+    case SIGUSR1:
+      handle_pause();
+      break;
+    case SIGCHLD:
+      handle_sigchld();
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// Enables or disables the event sources in the epoll set, used while paused
+static void set_sources_enabled(int epoll_fd, int *fds, int amount,
+                              bool enabled) {
+  for (int i = 0; i < amount; i++) {
+    struct epoll_event ev = {.events = enabled ? EPOLLIN : 0,
+                             .data.fd = fds[i]};
+
+    // A pipe that reached EOF has already been removed from the set
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fds[i], &ev) == -1 &&
+        errno != ENOENT) {
+      fprintf(stderr, "Epoll error\n");
+      exit(14);
+    }
+  }
+}
+
+// Dequeue the given amount of apps from a device queue and change their
+// blocked state, then add each to the run queue of the CPU it last ran on.
+// Devices serve requests in order, so these are the completed ones
+static void unblock_apps(irq_t irq, int amount) {
+  for (int i = 0; i < amount; i++) {
+    int app_id =
+        (irq == IRQ_D1) ? dequeue(D1_app_queue) : dequeue(D2_app_queue);
+
+    if (app_id == -1) {
+      cdmsg(LOG_CAT_IRQ, "No apps waiting on D%d", irq);
+      return;
+    }
+
+    assert(apps[app_id].state == BLOCKED);
+    sched_wakeup(apps[app_id].cpu_id, app_id);
+    set_app_state(app_id, PAUSED);
+
+    cdmsg(LOG_CAT_IRQ, "Kernel unblocked app %d", app_id + 1);
+  }
+}
+
+// Handles a single interrupt record from intersim
+static void handle_interrupt(const irq_msg_t *irq_msg) {
+  record_input(REPLAY_IRQ, irq_msg->irq,
+               irq_msg->irq == IRQ_TIME ? irq_msg->cpu_id : irq_msg->count);
+
+  if (trace != NULL) {
+    trace_record(trace, get_time_ns(), TRACE_IRQ, irq_msg->irq,
+                 irq_msg->cpu_id, -1, 0);
+  }
+
+  if (irq_msg->irq == IRQ_TIME) {
+    // Time interrupt
+    time_irq_count++;
+    assert(irq_msg->cpu_id >= 0 && irq_msg->cpu_id < cpu_amount);
+    cdmsg(LOG_CAT_IRQ, "Kernel got time interrupt for CPU %d after %lu us",
+          irq_msg->cpu_id,
+          (unsigned long)((get_time_ns() - irq_msg->timestamp_ns) / 1000));
+
+    dispatch_next_app(&cpus[irq_msg->cpu_id]);
+  } else {
+    // Device interrupt
+    assert(irq_msg->irq == IRQ_D1 || irq_msg->irq == IRQ_D2);
+    device_irq_count++;
+    cdmsg(LOG_CAT_IRQ, "Kernel got device interrupt D%d for %d requests",
+          irq_msg->irq, irq_msg->count);
+
+    unblock_apps(irq_msg->irq, irq_msg->count);
+  }
+}
+
+// Reads fixed-size records from a non-blocking pipe until it's empty.
+// Returns the amount of records read, or -1 when the write end was closed
+static int read_records(int fd, void *buf, size_t record_size) {
+  ssize_t bytes;
+
+  do {
+    bytes = read(fd, buf, record_size * KERNEL_DRAIN_BATCH);
+  } while (bytes == -1 && errno == EINTR);
+
+  if (bytes == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return 0;
+
+    fprintf(stderr, "Pipe error\n");
+    exit(8);
+  }
+  if (bytes == 0)
+    return -1;
+
+  // Writes up to PIPE_BUF are atomic, so we never see partial records
+  assert(bytes % record_size == 0);
+
+  return bytes / record_size;
+}
+
+// Drains every buffered interrupt record and handles them in order.
+// Returns whether the pipe is still open
+static bool drain_interrupts(int fd) {
+  irq_msg_t batch[KERNEL_DRAIN_BATCH];
+  int amount;
+
+  while (kernel_running &&
+         (amount = read_records(fd, batch, sizeof(irq_msg_t))) > 0) {
+    for (int i = 0; i < amount && kernel_running; i++) {
+      handle_interrupt(&batch[i]);
+    }
+  }
+
+  return amount != -1;
+}
+
+// Drains every published syscall request and handles them in order,
+// then arms the doorbell again before going back to sleep
+static void drain_app_syscalls(int doorbell_fd) {
+  uint64_t rings;
+  syscall_request_t request;
+
+  // Clear the doorbell, it may have been rung more than once
+  read(doorbell_fd, &rings, sizeof(rings));
+
+  do {
+    while (kernel_running && pop_syscall_request(syscall_ring, &request)) {
+      handle_app_syscall(&request);
+    }
+  } while (kernel_running && !arm_syscall_doorbell(syscall_ring));
+}
+
+// Discrete-event mode: schedules a coroutine app's wakeup in the calendar.
+// Wakeups left behind by a stop just find no app due
+static void schedule_app_wake(uint64_t wake_ns) {
+  des_schedule(wake_ns, DES_APP_WAKE, 0);
+}
+
+// Discrete-event mode: sends IRQ_TIME to every CPU and draws the random
+// device interrupts the way intersim does, then schedules the next tick
+static void handle_des_tick(void) {
+  uint64_t now = get_time_ns();
+
+  cdmsg(LOG_CAT_IRQ, "Virtual tick at %lu ms", (unsigned long)(now / 1000000));
+
+  for (int i = 0; i < cpu_amount && kernel_running; i++) {
+    irq_msg_t irq_msg = {.irq = IRQ_TIME, .cpu_id = i, .timestamp_ns = now};
+    handle_interrupt(&irq_msg);
+  }
+
+  if (device_model == DEVICE_MODEL_RANDOM) {
+    if (prng_below(&irq_prng, 100) < (uint64_t)config.intersim_d1_int_prob) {
+      des_schedule(now, DES_IRQ, IRQ_D1);
+    }
+    if (prng_below(&irq_prng, 100) < (uint64_t)config.intersim_d2_int_prob) {
+      des_schedule(now, DES_IRQ, IRQ_D2);
+    }
+  }
+
+  des_schedule(now + config.intersim_tick_us * 1000ULL, DES_TICK, 0);
+}
+
+// Discrete-event mode: pops the next event, jumping the virtual clock to
+// it, and handles it along with the syscalls apps submitted meanwhile
+static void handle_next_des_event(int doorbell_fd) {
+  des_event_t event;
+
+  // The tick is always scheduled, so the calendar never runs dry
+  bool popped = des_pop(&event);
+  assert(popped);
+
+  switch (event.type) {
+  case DES_TICK:
+    handle_des_tick();
+    break;
+  case DES_IRQ: {
+    irq_msg_t irq_msg = {
+        .irq = event.arg, .count = 1, .timestamp_ns = event.time_ns};
+    handle_interrupt(&irq_msg);
+    break;
+  }
+  case DES_DEVICE: {
+    device_t *dev = &devices[event.arg - IRQ_D1];
+    irq_msg_t irq_msg = {.irq = event.arg,
+                         .count = device_poll(dev, event.time_ns),
+                         .timestamp_ns = event.time_ns};
+
+    if (device_event_ns[event.arg - IRQ_D1] == event.time_ns) {
+      device_event_ns[event.arg - IRQ_D1] = UINT64_MAX;
+    }
+    if (irq_msg.count > 0) {
+      handle_interrupt(&irq_msg);
+    }
+    schedule_device_event(dev);
+    break;
+  }
+  case DES_APP_WAKE:
+    coapps_run_due();
+    break;
+  }
+
+  drain_app_syscalls(doorbell_fd);
+}
+
+// Kernel state in a checkpoint that isn't in an array
+typedef struct {
+  uint64_t start_ns;
+  uint64_t time_irqs;
+  uint64_t device_irqs;
+  uint64_t syscalls;
+  uint64_t schedule_checksum;
+  uint64_t device_event_ns[2];
+  int32_t state_counts[FINISHED + 1];
+  int32_t device_queue_lengths[2];
+  prng_t irq_prng;
+} kernel_image_t;
+
+// Checkpoint mode: writes the whole state of the run to an image, in
+// between two calendar events. In virtual time, the calendar and the
+// interrupt draws are intersim's schedule position
+static void write_checkpoint(const char *path, unsigned int seed) {
+  checkpoint_header_t header = {.config = config,
+                                .seed = seed,
+                                .sched_policy = sched_policy,
+                                .device_model = device_model,
+                                .time_ns = get_time_ns()};
+  kernel_image_t image = {.start_ns = kernel_start_ns,
+                          .time_irqs = time_irq_count,
+                          .device_irqs = device_irq_count,
+                          .syscalls = syscall_count,
+                          .schedule_checksum = schedule_checksum,
+                          .device_event_ns = {device_event_ns[0],
+                                              device_event_ns[1]},
+                          .irq_prng = irq_prng};
+  int *d1_queued = (int *)calloc(app_amount, sizeof(int));
+  int *d2_queued = (int *)calloc(app_amount, sizeof(int));
+
+  if (d1_queued == NULL || d2_queued == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+  for (int w = 0; w < WORKLOAD_AMOUNT; w++) {
+    header.workload_weights[w] = workload_mix.weights[w];
+  }
+  for (int i = 0; i <= FINISHED; i++) {
+    image.state_counts[i] = state_counts[i];
+  }
+  image.device_queue_lengths[0] = queue_items(D1_app_queue, d1_queued);
+  image.device_queue_lengths[1] = queue_items(D2_app_queue, d2_queued);
+
+  checkpoint_t *ckpt = checkpoint_create(path, &header);
+  checkpoint_write(ckpt, "kernel", &image, sizeof(image));
+  checkpoint_write(ckpt, "kernel.apps", apps, app_amount * sizeof(proc_info_t));
+  checkpoint_write(ckpt, "kernel.cpus", cpus, cpu_amount * sizeof(cpu_t));
+  checkpoint_write(ckpt, "kernel.d1_queue", d1_queued,
+                   image.device_queue_lengths[0] * sizeof(int));
+  checkpoint_write(ckpt, "kernel.d2_queue", d2_queued,
+                   image.device_queue_lengths[1] * sizeof(int));
+  // The syscall ring is always empty in between events
+  checkpoint_write(ckpt, "shm.ctxs", shm->ctxs, app_amount * sizeof(app_ctx_t));
+  checkpoint_write(ckpt, "shm.areas", get_app_area(shm, 0),
+                   app_amount * shm->area_stride);
+  sched_checkpoint(ckpt);
+  des_checkpoint(ckpt);
+  coapps_checkpoint(ckpt);
+  if (device_model == DEVICE_MODEL_SERVICE) {
+    device_checkpoint(&devices[0], ckpt);
+    device_checkpoint(&devices[1], ckpt);
+  }
+  if (vm_enabled) {
+    vm_checkpoint(ckpt);
+  }
+  checkpoint_finish(ckpt);
+
+  free(d1_queued);
+  free(d2_queued);
+}
+
+// Restore mode: replaces the state of the freshly booted run, whose apps
+// weren't added to the run queues, with the state in the image
+static void restore_checkpoint(void) {
+  kernel_image_t image;
+
+  checkpoint_read(restoring, "kernel", &image, sizeof(image));
+  kernel_start_ns = image.start_ns;
+  time_irq_count = image.time_irqs;
+  device_irq_count = image.device_irqs;
+  syscall_count = image.syscalls;
+  schedule_checksum = image.schedule_checksum;
+  device_event_ns[0] = image.device_event_ns[0];
+  device_event_ns[1] = image.device_event_ns[1];
+  irq_prng = image.irq_prng;
+  for (int i = 0; i <= FINISHED; i++) {
+    state_counts[i] = image.state_counts[i];
+  }
+
+  checkpoint_read(restoring, "kernel.apps", apps,
+                  app_amount * sizeof(proc_info_t));
+  checkpoint_read(restoring, "kernel.cpus", cpus, cpu_amount * sizeof(cpu_t));
+  for (int d = 0; d < 2; d++) {
+    int length = image.device_queue_lengths[d];
+    const int *queued = (const int *)checkpoint_section(
+        restoring, d == 0 ? "kernel.d1_queue" : "kernel.d2_queue",
+        length * sizeof(int));
+
+    for (int i = 0; i < length; i++) {
+      enqueue(d == 0 ? D1_app_queue : D2_app_queue, queued[i]);
+    }
+  }
+  checkpoint_read(restoring, "shm.ctxs", shm->ctxs,
+                  app_amount * sizeof(app_ctx_t));
+  checkpoint_read(restoring, "shm.areas", get_app_area(shm, 0),
+                  app_amount * shm->area_stride);
+  sched_restore(restoring);
+  des_restore(restoring);
+  coapps_restore(restoring);
+  if (device_model == DEVICE_MODEL_SERVICE) {
+    device_restore(&devices[0], restoring);
+    device_restore(&devices[1], restoring);
+  }
+  if (vm_enabled) {
+    vm_restore(restoring);
+  }
+
+  for (int i = 0; i < app_amount; i++) {
+    publish_app_stats(i);
+  }
+}
+
+// Replay mode: stops the kernel on an input it couldn't have handled in
+// the recorded run
+static void diverge_replay(const char *reason) {
+  msg("Replay diverged at input %lu: %s",
+      (unsigned long)replaying->position, reason);
+  replay_diverged = true;
+  kernel_running = false;
+}
+
+// Replay mode: moves the virtual clock to the next recorded input and
+// handles it as if intersim or an app had sent it. Stops the kernel after
+// the last one
+static void handle_next_replay_input(void) {
+  replay_record_t record;
+
+  if (!replay_peek(replaying, &record)) {
+    dmsg("Kernel replayed every input");
+    kernel_running = false;
+    return;
+  }
+  if (record.time_ns < get_time_ns()) {
+    diverge_replay("input out of order");
     return;
   }
+  replay_skip(replaying);
+  set_virtual_time_ns(record.time_ns);
+
+  if (record.type == REPLAY_IRQ && record.value == IRQ_TIME) {
+    irq_msg_t irq_msg = {.irq = IRQ_TIME,
+                         .cpu_id = record.arg,
+                         .timestamp_ns = record.time_ns};
+
+    if (record.arg < 0 || record.arg >= cpu_amount) {
+      diverge_replay("time interrupt for an unknown CPU");
+      return;
+    }
+    handle_interrupt(&irq_msg);
+  } else if (record.type == REPLAY_IRQ &&
+             (record.value == IRQ_D1 || record.value == IRQ_D2)) {
+    irq_msg_t irq_msg = {.irq = record.value,
+                         .count = record.arg,
+                         .timestamp_ns = record.time_ns};
+
+    handle_interrupt(&irq_msg);
+  } else if (record.type == REPLAY_SYSCALL) {
+    syscall_request_t request = {.app_id = record.arg,
+                                 .call = record.value,
+                                 .submit_ns = record.time_ns};
+
+    if (request.app_id < 0 || request.app_id >= app_amount ||
+        apps[request.app_id].state != RUNNING ||
+        request.call <= SYSCALL_NONE || request.call > SYSCALL_APP_FINISHED) {
+      diverge_replay("syscall from an app that isn't running");
+      return;
+    }
+    // The app would have published it in its context slot
+    set_app_syscall(shm, request.app_id, request.call);
+    handle_app_syscall(&request);
+  } else {
+    diverge_replay("preemption skipped outside of a dispatch");
+  }
+}
 
-  assert(apps[app_id].state == BLOCKED);
-  apps[app_id].state = PAUSED;
-  enqueue(dispatch_queue, app_id);
+// Called when startup can't finish. Terminates and reaps the children
+// spawned so far, removes our shared segments and exits with the given code
+static void abort_startup(int code, const char *shm_name,
+                          const char *stats_name) {
+  terminate_children();
+  reap_children();
+  destroy_shm(shm, shm_name);
+  stats_destroy(live_stats, stats_name);
+  if (trace != NULL) {
+    trace_close(trace);
+  }
+  exit(code);
+}
 
-  dmsg("Kernel unblocked app %d", app_id + 1);
+// Prints command line usage
+static void print_usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-n app_amount] [-c cpu_amount] [-t trace_file] "
+          "[-s signal|futex] [-e process|coroutine] [-v] [-S seed] "
+          "[-p rr|mlfq|lottery|stride|cfs] [-d random|service] "
+          "[-w profile:weight,...] [-r record_file | -R replay_file] "
+          "[-f config_file] [-o key=value,...] [-m metrics_file] "
+          "[-k seconds:checkpoint_file | -K checkpoint_file]\n"
+          "app_amount is 1 to %d, memory permitting, and cpu_amount 1 to %d\n",
+          prog, APP_AMOUNT_MAX, CPU_AMOUNT_MAX);
 }
 
-int main(void) {
-  srand(time(NULL) ^ (getpid() << 16)); // reset seed
+int main(int argc, char **argv) {
+  log_init();
+
+  // Read options from command line, defaults are set at cfg.h. Config
+  // files and pairs are applied in order, so later ones win
+  const char *trace_path = NULL;
+  const char *mix_spec = WORKLOAD_MIX;
+  const char *record_path = NULL;
+  const char *replay_path = NULL;
+  const char *metrics_path = NULL;
+  const char *checkpoint_path = NULL;
+  const char *restore_path = NULL;
+  // Simulated time since the start to checkpoint at
+  uint64_t checkpoint_ns = 0;
+  bool checkpointed = false;
+  // Whether -e process was asked for, which restores can't run
+  bool process_engine = false;
+  // Configuration options in order, applied again over a restored image's
+  // configuration
+  int config_opts[argc];
+  const char *config_args[argc];
+  int config_opt_amount = 0;
+  // Apps and intersim are seeded from this, so a run can be repeated
+  unsigned int base_seed = time(NULL) ^ (getpid() << 16);
+  int opt;
+  while ((opt = getopt(argc, argv, "n:c:t:s:e:vS:p:d:w:r:R:f:o:m:k:K:")) !=
+         -1) {
+    if (strchr("ncfo", opt) != NULL) {
+      config_opts[config_opt_amount] = opt;
+      config_args[config_opt_amount++] = optarg;
+    }
+
+    switch (opt) {
+    case 'n':
+      if (!config_set("app_amount", optarg)) {
+        print_usage(argv[0]);
+        exit(16);
+      }
+      break;
+    case 'c':
+      if (!config_set("cpu_amount", optarg)) {
+        print_usage(argv[0]);
+        exit(16);
+      }
+      break;
+    case 't':
+      trace_path = optarg;
+      break;
+    case 's':
+      if (strcmp(optarg, SWITCH_MODE_STR[SWITCH_FUTEX]) == 0) {
+        switch_mode = SWITCH_FUTEX;
+      } else if (strcmp(optarg, SWITCH_MODE_STR[SWITCH_SIGNAL]) != 0) {
+        print_usage(argv[0]);
+        exit(16);
+      }
+      break;
+    case 'e':
+      process_engine = strcmp(optarg, ENGINE_STR[ENGINE_PROCESS]) == 0;
+      if (strcmp(optarg, ENGINE_STR[ENGINE_COROUTINE]) == 0) {
+        engine = ENGINE_COROUTINE;
+      } else if (!process_engine) {
+        print_usage(argv[0]);
+        exit(16);
+      }
+      break;
+    case 'v':
+      virtual_time = true;
+      break;
+    case 'S':
+      if (!config_parse_seed(optarg, &base_seed)) {
+        print_usage(argv[0]);
+        exit(16);
+      }
+      break;
+    case 'p': {
+      bool found = false;
+
+      for (sched_policy_t p = SCHED_POLICY_RR; p <= SCHED_POLICY_CFS; p++) {
+        if (strcmp(optarg, SCHED_POLICY_STR[p]) == 0) {
+          sched_policy = p;
+          found = true;
+          break;
+        }
+      }
+      if (!found) {
+        print_usage(argv[0]);
+        exit(16);
+      }
+      break;
+    }
+    case 'd':
+      if (strcmp(optarg, DEVICE_MODEL_STR[DEVICE_MODEL_SERVICE]) == 0) {
+        device_model = DEVICE_MODEL_SERVICE;
+      } else if (strcmp(optarg, DEVICE_MODEL_STR[DEVICE_MODEL_RANDOM]) != 0) {
+        print_usage(argv[0]);
+        exit(16);
+      }
+      break;
+    case 'w':
+      mix_spec = optarg;
+      break;
+    case 'r':
+      record_path = optarg;
+      break;
+    case 'R':
+      replay_path = optarg;
+      break;
+    case 'f':
+      if (!config_load(optarg)) {
+        exit(16);
+      }
+      break;
+    case 'o':
+      if (!config_parse(optarg)) {
+        exit(16);
+      }
+      break;
+    case 'm':
+      metrics_path = optarg;
+      break;
+    case 'k': {
+      char *end;
+      double seconds = strtod(optarg, &end);
+
+      if (*end != ':' || end[1] == '\0' || !(seconds >= 0)) {
+        print_usage(argv[0]);
+        exit(16);
+      }
+      checkpoint_ns = (uint64_t)(seconds * 1e9);
+      checkpoint_path = end + 1;
+      break;
+    }
+    case 'K':
+      restore_path = optarg;
+      break;
+    default:
+      print_usage(argv[0]);
+      exit(16);
+    }
+  }
+  // Checkpoints are taken in virtual time, which restores run in too, with
+  // coroutine apps
+  if (!workload_parse_mix(mix_spec, &workload_mix) ||
+      (record_path != NULL && replay_path != NULL) ||
+      (restore_path != NULL &&
+       (record_path != NULL || replay_path != NULL || process_engine)) ||
+      (checkpoint_path != NULL &&
+       (replay_path != NULL || (!virtual_time && restore_path == NULL)))) {
+    print_usage(argv[0]);
+    exit(16);
+  }
+
+  // Restores take the parameters of the checkpointed run. Configuration
+  // options still apply over its configuration, unless they change the
+  // size of the saved state
+  if (restore_path != NULL) {
+    restoring = checkpoint_open(restore_path);
+    config = restoring->header.config;
+    for (int i = 0; i < config_opt_amount; i++) {
+      bool valid = config_opts[i] == 'f' ? config_load(config_args[i])
+                   : config_opts[i] == 'o'
+                       ? config_parse(config_args[i])
+                       : config_set(config_opts[i] == 'n' ? "app_amount"
+                                                          : "cpu_amount",
+                                    config_args[i]);
+
+      if (!valid) {
+        exit(16);
+      }
+    }
+    if (!checkpoint_config_compatible(&restoring->header.config, &config)) {
+      fprintf(stderr, "Checkpoint config mismatch\n");
+      exit(22);
+    }
+    base_seed = restoring->header.seed;
+    sched_policy = restoring->header.sched_policy;
+    device_model = restoring->header.device_model;
+    for (int w = 0; w < WORKLOAD_AMOUNT; w++) {
+      workload_mix.weights[w] = restoring->header.workload_weights[w];
+    }
+    if (sched_policy > SCHED_POLICY_CFS ||
+        device_model > DEVICE_MODEL_SERVICE) {
+      fprintf(stderr, "Checkpoint version mismatch\n");
+      exit(22);
+    }
+
+    virtual_time = true;
+  }
+
+  // Replays take the parameters of the recorded run, and run in virtual
+  // time without apps or intersim
+  if (replay_path != NULL) {
+    replaying = replay_open(replay_path);
+    config = replaying->header.config;
+    base_seed = replaying->header.seed;
+    sched_policy = replaying->header.sched_policy;
+    for (int w = 0; w < WORKLOAD_AMOUNT; w++) {
+      workload_mix.weights[w] = replaying->header.workload_weights[w];
+    }
+    if (sched_policy > SCHED_POLICY_CFS) {
+      fprintf(stderr, "Replay version mismatch\n");
+      exit(20);
+    }
+
+    virtual_time = true;
+    engine = ENGINE_REPLAY;
+    device_model = DEVICE_MODEL_RANDOM;
+    set_virtual_time_ns(0);
+  }
+
+  app_amount = config.app_amount;
+  cpu_amount = config.cpu_amount;
+  prng_seed(&irq_prng, base_seed, PRNG_STREAM_IRQ);
+
+  // Opened up front, so a bad path doesn't waste a whole run
+  if (metrics_path != NULL) {
+    metrics_file = fopen(metrics_path, "w");
+    if (metrics_file == NULL) {
+      fprintf(stderr, "Metrics file error\n");
+      exit(21);
+    }
+  }
+
+  // Virtual time needs apps that only run when the kernel lets them
+  if (virtual_time && engine != ENGINE_REPLAY) {
+    engine = ENGINE_COROUTINE;
+    des_init();
+  }
+  if (restoring != NULL) {
+    set_virtual_time_ns(restoring->header.time_ns);
+  }
+
+  // Record the run's inputs. In real time, the clock stays frozen until the
+  // first one, so startup takes no time in the recording either
+  if (record_path != NULL) {
+    replay_header_t header = {.config = config,
+                              .seed = base_seed,
+                              .sched_policy = sched_policy};
+
+    for (int w = 0; w < WORKLOAD_AMOUNT; w++) {
+      header.workload_weights[w] = workload_mix.weights[w];
+    }
+    recording = replay_create(record_path, &header);
+    if (!virtual_time) {
+      set_virtual_time_ns(get_real_time_ns());
+    }
+  }
+
+  // Children get the same configuration, already validated by config_set
+  char config_str[CONFIG_MAX_FORMAT];
+  config_format(config_str, sizeof(config_str));
+
   dmsg("Kernel booting");
-  // Validate some configs
-  assert(APP_MAX_PC > 0);
-  assert(APP_SLEEP_TIME_MS > 0);
-  assert(INTERSIM_SLEEP_TIME_MS > 0);
-  assert(APP_SYSCALL_PROB >= 0 && APP_SYSCALL_PROB <= 100);
-
-  // Register signal handlers
-  if (signal(SIGINT, handle_sigint) == SIG_ERR) {
+
+  // Allocate app table, all apps start paused
+  apps = (proc_info_t *)calloc(app_amount, sizeof(proc_info_t));
+  if (apps == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+  state_counts[PAUSED] = app_amount;
+
+  // Allocate CPUs, all start idle
+  cpus = (cpu_t *)calloc(cpu_amount, sizeof(cpu_t));
+  if (cpus == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  // Don't get SIGCHLD when children stop, only when they terminate
+  struct sigaction chld_action = {.sa_handler = SIG_DFL,
+                                  .sa_flags = SA_NOCLDSTOP};
+  sigemptyset(&chld_action.sa_mask);
+  if (sigaction(SIGCHLD, &chld_action, NULL) == -1) {
     fprintf(stderr, "Signal error\n");
     exit(4);
   }
-  if (signal(SIGUSR1, handle_pause) == SIG_ERR) {
+
+  // Block the signals we handle, they are read from a signalfd instead.
+  // Children restore the original mask before exec
+  sigset_t handled_mask, orig_mask;
+  sigemptyset(&handled_mask);
+  sigaddset(&handled_mask, SIGINT);
+  sigaddset(&handled_mask, SIGUSR1);
+  sigaddset(&handled_mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &handled_mask, &orig_mask) == -1) {
+    fprintf(stderr, "Signal blocking error\n");
+    exit(9);
+  }
+
+  int signal_fd = signalfd(-1, &handled_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signal_fd == -1) {
     fprintf(stderr, "Signal error\n");
     exit(4);
   }
 
-  // Allocate shared memory to store app states (simulating a snapshot)
-  int shm_id =
-      shmget(IPC_PRIVATE, sizeof(int) * 2 * APP_AMOUNT, IPC_CREAT | S_IRWXU);
-  if (shm_id < 0) {
-    fprintf(stderr, "Shm alloc error\n");
-    exit(3);
+  // Allocate shared memory to store app contexts (simulating a snapshot),
+  // followed by the syscall ring
+  char shm_name[32];
+  sprintf(shm_name, SHM_NAME_PREFIX "%d", getpid());
+  shm = create_shm(shm_name, app_amount, switch_mode,
+                   config.app_context_kb * 1024ULL);
+  syscall_ring = get_syscall_ring(shm);
+  workload_assign(&workload_mix, shm);
+
+  // Map the trace file before apps start changing states
+  if (trace_path != NULL) {
+    trace = trace_open(trace_path, TRACE_MAX_EVENTS, app_amount, cpu_amount,
+                       get_time_ns());
   }
 
-  shm = (int *)shmat(shm_id, NULL, 0);
-  memset(shm, 0, sizeof(int) * 2 * APP_AMOUNT);
+  // Create the doorbell apps ring when the syscall ring becomes non-empty
+  int doorbell_fd = eventfd(0, EFD_NONBLOCK);
+  if (doorbell_fd == -1) {
+    fprintf(stderr, "Eventfd error\n");
+    exit(15);
+  }
 
-  // Create semaphore for avoiding race conditions
-  sem_unlink(DISPATCH_SEM_NAME); // remove any existing semaphore
-  dispatch_sem = sem_open(DISPATCH_SEM_NAME, O_CREAT, 0666, 1);
-  if (dispatch_sem == SEM_FAILED) {
-    fprintf(stderr, "Semaphore error\n");
-    exit(11);
+  // Allocate device waiting and CPU run queues
+  D1_app_queue = create_queue(app_amount);
+  D2_app_queue = create_queue(app_amount);
+  for (int i = 0; i < cpu_amount; i++) {
+    cpus[i].cpu_id = i;
+    cpus[i].running_app_id = -1;
+  }
+  sched_init(sched_policy, app_amount, cpu_amount, base_seed);
+  vm_enabled = config.vm_pages > 0;
+  if (vm_enabled) {
+    vm_init(app_amount, cpu_amount, base_seed);
   }
 
-  // Create apps pipe
-  int apps_pipe_fd[2];
-  if (pipe(apps_pipe_fd) == -1) {
-    fprintf(stderr, "Pipe error\n");
-    exit(8);
+  // Published for kernelstat from here on
+  char stats_name[32];
+  sprintf(stats_name, STATS_NAME_PREFIX "%d", getpid());
+  live_stats = stats_create(stats_name, app_amount, cpu_amount,
+                            SCHED_POLICY_STR[sched_policy], virtual_time);
+
+  // Devices are seeded like intersim's, so both serve requests the same
+  if (virtual_time && device_model == DEVICE_MODEL_SERVICE) {
+    device_init(&devices[0], IRQ_D1, app_amount, base_seed);
+    device_init(&devices[1], IRQ_D2, app_amount, base_seed);
   }
 
-  // Allocate device waiting and dispatch queues
-  D1_app_queue = create_queue();
-  D2_app_queue = create_queue();
-  dispatch_queue = create_queue();
+  // Coroutine apps share our shm directly, and boot on their first timeslice
+  if (engine == ENGINE_COROUTINE) {
+    coapps_init(shm, app_amount, base_seed,
+                virtual_time ? schedule_app_wake : NULL);
+  }
 
-  // Spawn apps
-  for (int i = 0; i < APP_AMOUNT; i++) {
-    pid_t pid = fork();
-    if (pid < 0) {
-      fprintf(stderr, "Fork error\n");
-      exit(2);
-    } else if (pid == 0) {
-      // child
-      // passing shm_id and app_id as args, and pipe fds
-      char shm_id_str[10];
-      char app_id_str[10];
-      char pipe_read_str[10];
-      char pipe_write_str[10];
-      sprintf(shm_id_str, "%d", shm_id);
+  // Children write to this eventfd once booted, right before stopping
+  int ready_fd = eventfd(0, EFD_NONBLOCK);
+  if (ready_fd == -1) {
+    fprintf(stderr, "Eventfd error\n");
+    exit(15);
+  }
+  char ready_str[12];
+  sprintf(ready_str, "%d", ready_fd);
+
+  // Spawn apps, passing shm name and app_id as args, the doorbell fd, the
+  // base seed their PRNG streams come from, the readiness fd and the
+  // configuration
+  char doorbell_str[12];
+  sprintf(doorbell_str, "%d", doorbell_fd);
+  for (int i = 0; i < app_amount; i++) {
+    pid_t pid = 0;
+    if (engine == ENGINE_PROCESS) {
+      char app_id_str[12];
+      char seed_str[12];
       sprintf(app_id_str, "%d", i);
-      sprintf(pipe_read_str, "%d", apps_pipe_fd[PIPE_READ]);
-      sprintf(pipe_write_str, "%d", apps_pipe_fd[PIPE_WRITE]);
+      sprintf(seed_str, "%u", base_seed);
 
-      execlp("./app", "app", shm_id_str, app_id_str, pipe_read_str,
-             pipe_write_str, NULL);
+      char *const app_argv[] = {"./app",   shm_name,  app_id_str,
+                                doorbell_str, seed_str, ready_str,
+                                config_str,   NULL};
+      pid = spawn_child(app_argv, &orig_mask, -1);
+    }
+    if (pid < 0) {
+      fprintf(stderr, "Fork error\n");
+      abort_startup(2, shm_name, stats_name);
     }
 
     apps[i].app_id = i;
@@ -352,117 +1826,279 @@ int main(void) {
     apps[i].write_count = 0;
     apps[i].exec_count = 0;
     apps[i].state = PAUSED;
+    apps[i].cpu_id = i % cpu_amount;
 
-    enqueue(dispatch_queue, i); // add app to dispatch queue
+    // Restored apps are queued where the image says
+    if (restoring == NULL) {
+      sched_add(apps[i].cpu_id, i); // add app to its CPU queue
+    }
+    publish_app_stats(i);
   }
 
-  close(apps_pipe_fd[PIPE_WRITE]); // close write
-
-  // Create interrupts pipe
+  // Create interrupts pipe, and the device requests pipe the other way
   int interpipe_fd[2];
-  if (pipe(interpipe_fd) == -1) {
+  int devpipe_fd[2];
+  if (pipe(interpipe_fd) == -1 || pipe(devpipe_fd) == -1) {
     fprintf(stderr, "Pipe error\n");
-    exit(8);
+    abort_startup(8, shm_name, stats_name);
   }
-
-  // Spawn intersim
-  intersim_pid = fork();
-  if (intersim_pid < 0) {
-    fprintf(stderr, "Fork error\n");
-    exit(2);
-  } else if (intersim_pid == 0) {
-    // child
-    // passing pipe fds as args, as well as the apps read pipe that needs to be
-    // closed, as it's being inherited
-    char pipe_read_str[10];
-    char pipe_write_str[10];
-    char app_pipe_read_str[10];
+  devpipe_write_fd = devpipe_fd[PIPE_WRITE];
+
+  // Spawn intersim, its ticks are calendar events in virtual time.
+  // Passing pipe fds as args, as well as the doorbell fd that needs to be
+  // closed, as it's being inherited, the amount of CPUs, the seed, the
+  // device requests pipe, the amount of apps, the device model, the
+  // readiness fd and the configuration. Our end of the device requests pipe
+  // is closed in it
+  if (!virtual_time) {
+    char pipe_read_str[12];
+    char pipe_write_str[12];
+    char cpu_amount_str[12];
+    char seed_str[12];
+    char devpipe_str[12];
+    char app_amount_str[12];
+    char device_model_str[12];
     sprintf(pipe_read_str, "%d", interpipe_fd[PIPE_READ]);
     sprintf(pipe_write_str, "%d", interpipe_fd[PIPE_WRITE]);
-    sprintf(app_pipe_read_str, "%d", apps_pipe_fd[PIPE_READ]);
-
-    execlp("./intersim", "intersim", pipe_read_str, pipe_write_str,
-           app_pipe_read_str, NULL);
+    sprintf(cpu_amount_str, "%d", cpu_amount);
+    sprintf(seed_str, "%u", base_seed);
+    sprintf(devpipe_str, "%d", devpipe_fd[PIPE_READ]);
+    sprintf(app_amount_str, "%d", app_amount);
+    sprintf(device_model_str, "%d", device_model);
+
+    char *const intersim_argv[] = {
+        "./intersim",     pipe_read_str, pipe_write_str, doorbell_str,
+        cpu_amount_str,   seed_str,      devpipe_str,    app_amount_str,
+        device_model_str, ready_str,     config_str,     NULL};
+    intersim_pid = spawn_child(intersim_argv, &orig_mask,
+                               devpipe_fd[PIPE_WRITE]);
+    if (intersim_pid < 0) {
+      fprintf(stderr, "Fork error\n");
+      abort_startup(2, shm_name, stats_name);
+    }
   }
 
   close(interpipe_fd[PIPE_WRITE]); // close write
-
-  // Wait for all processes to boot, start kernel and intersim
-  sleep(1);
+  close(devpipe_fd[PIPE_READ]);    // close read
+
+  // Wait for all processes to boot, then start kernel and intersim once
+  // it's actually stopped
+  int child_amount =
+      (engine == ENGINE_PROCESS ? app_amount : 0) + (virtual_time ? 0 : 1);
+  if (!wait_children_ready(ready_fd, signal_fd, child_amount)) {
+    fprintf(stderr, "Startup error\n");
+    abort_startup(19, shm_name, stats_name);
+  }
+  close(ready_fd);
+  if (!virtual_time) {
+    wait_child_stopped(intersim_pid);
+  }
   kernel_running = true;
-  msg("Kernel running");
-  kill(intersim_pid, SIGCONT);
+  uint64_t real_start_ns = get_real_time_ns();
+  kernel_start_ns = get_time_ns();
+  if (engine == ENGINE_REPLAY) {
+    msg("Kernel replaying %lu inputs, %d apps on %d CPUs, %s policy, seed %u",
+        (unsigned long)replaying->header.count, app_amount, cpu_amount,
+        SCHED_POLICY_STR[sched_policy], base_seed);
+  } else if (restoring != NULL) {
+    restore_checkpoint();
+    msg("Kernel restored at %.3f s from %s, %s policy, %s devices, seed %u",
+        (get_time_ns() - kernel_start_ns) / 1e9, restore_path,
+        SCHED_POLICY_STR[sched_policy], DEVICE_MODEL_STR[device_model],
+        base_seed);
+  } else if (virtual_time) {
+    msg("Kernel running, %s engine in virtual time, %s policy, %s devices, "
+        "seed %u",
+        ENGINE_STR[engine], SCHED_POLICY_STR[sched_policy],
+        DEVICE_MODEL_STR[device_model], base_seed);
+    des_schedule(0, DES_TICK, 0);
+  } else if (engine == ENGINE_COROUTINE) {
+    msg("Kernel running, %s engine, %s policy, seed %u", ENGINE_STR[engine],
+        SCHED_POLICY_STR[sched_policy], base_seed);
+  } else {
+    msg("Kernel running, %s switch mode, %s policy, seed %u",
+        SWITCH_MODE_STR[switch_mode], SCHED_POLICY_STR[sched_policy],
+        base_seed);
+  }
+  signal_intersim(SIGCONT);
 
-  // Setup for reading both pipes without blocking
-  fd_set fdset;
-  int max_fd = interpipe_fd[PIPE_READ] > apps_pipe_fd[PIPE_READ]
-                   ? interpipe_fd[PIPE_READ]
-                   : apps_pipe_fd[PIPE_READ];
+  // Setup a single epoll set for the signalfd, the doorbell and the pipe
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    fprintf(stderr, "Epoll error\n");
+    exit(14);
+  }
 
-  // Main loop for reading pipes
-  while (kernel_running) {
-    irq_t irq;
-    int syscall_app_id;
+  // The interrupts pipe is drained until EAGAIN on each wakeup
+  if (fcntl(interpipe_fd[PIPE_READ], F_SETFL, O_NONBLOCK) == -1) {
+    fprintf(stderr, "Pipe error\n");
+    exit(8);
+  }
 
-    // Read both pipes
-    FD_ZERO(&fdset);
-    FD_SET(apps_pipe_fd[PIPE_READ], &fdset);
-    FD_SET(interpipe_fd[PIPE_READ], &fdset);
+  // Nobody writes to the pipe in virtual time, so it isn't watched
+  int source_fds[] = {doorbell_fd, interpipe_fd[PIPE_READ]};
+  int watched_fds[] = {signal_fd, source_fds[0], source_fds[1]};
+  for (int i = 0; i < (virtual_time ? 2 : 3); i++) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = watched_fds[i]};
 
-    // This handling is necessary in case select gets interrupted by a signal
-    int select_result;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watched_fds[i], &ev) == -1) {
+      fprintf(stderr, "Epoll error\n");
+      exit(14);
+    }
+  }
 
-    do {
-      select_result = select(max_fd + 1, &fdset, NULL, NULL, NULL);
-    } while (select_result == -1 && errno == EINTR);
+  // Main loop, handles every ready source on each wakeup
+  while (kernel_running) {
+    struct epoll_event events[KERNEL_MAX_EVENTS];
+    // Coroutine apps are run from here, so wake up for their next sleep end
+    // In virtual time, only poll for signals between events
+    int timeout_ms = -1;
+    if (virtual_time && !kernel_paused) {
+      timeout_ms = 0;
+    } else if (engine == ENGINE_COROUTINE && !kernel_paused) {
+      timeout_ms = coapps_next_wake_ms();
+    }
+    int ready = epoll_wait(epoll_fd, events, KERNEL_MAX_EVENTS, timeout_ms);
 
-    if (select_result == -1) {
-      fprintf(stderr, "Select error\n");
-      exit(10);
+    // While recording in real time the clock is frozen by the last input,
+    // coroutine apps are due by the current time
+    if (recording != NULL && !virtual_time) {
+      set_virtual_time_ns(get_real_time_ns());
     }
 
-    if (FD_ISSET(apps_pipe_fd[PIPE_READ], &fdset)) {
-      // Got syscall from app
-      read(apps_pipe_fd[PIPE_READ], &syscall_app_id, sizeof(int));
+    if (ready == -1) {
+      // Only happens if kernelsim itself is stopped and continued
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "Epoll error\n");
+      exit(14);
+    }
 
-      handle_app_syscall(syscall_app_id);
+    for (int i = 0; i < ready && kernel_running; i++) {
+      int fd = events[i].data.fd;
+
+      if (fd == signal_fd) {
+        bool was_paused = kernel_paused;
+
+        handle_signalfd(signal_fd);
+
+        if (kernel_paused != was_paused) {
+          set_sources_enabled(epoll_fd, source_fds, 2, !kernel_paused);
+        }
+      } else if (kernel_paused) {
+        // Leave the requests and interrupts buffered until we resume
+        continue;
+      } else if (fd == doorbell_fd) {
+        // Got syscalls from apps
+        drain_app_syscalls(doorbell_fd);
+      } else if (!drain_interrupts(fd)) {
+        // Intersim closed the interrupts pipe
+        dmsg("Kernel interrupts pipe closed");
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+      }
     }
-    if (FD_ISSET(interpipe_fd[PIPE_READ], &fdset)) {
-      // Got interrupt from intersim
-      read(interpipe_fd[PIPE_READ], &irq, sizeof(irq_t));
 
-      if (irq == IRQ_TIME) {
-        // Time interrupt
-        sem_wait(dispatch_sem);
-        dmsg("Kernel got time interrupt");
+    publish_kernel_stats();
 
-        dispatch_next_app();
-        sem_post(dispatch_sem);
-      } else {
-        // Device interrupt
-        assert(irq == IRQ_D1 || irq == IRQ_D2);
-        dmsg("Kernel got device interrupt D%d", irq);
+    if (!kernel_running || kernel_paused)
+      continue;
 
-        unblock_next_app(irq);
-      }
+    if (engine == ENGINE_REPLAY) {
+      handle_next_replay_input();
+    } else if (checkpoint_path != NULL &&
+               get_time_ns() - kernel_start_ns >= checkpoint_ns) {
+      // Stop at the first event boundary past the checkpoint time
+      write_checkpoint(checkpoint_path, base_seed);
+      checkpointed = true;
+      msg("Kernel checkpointed at %.3f s to %s",
+          (get_time_ns() - kernel_start_ns) / 1e9, checkpoint_path);
+      kernel_running = false;
+    } else if (virtual_time) {
+      handle_next_des_event(doorbell_fd);
+    } else if (engine == ENGINE_COROUTINE && coapps_run_due() > 0) {
+      // Run the coroutine apps that are due, then handle what they submitted
+      drain_app_syscalls(doorbell_fd);
     }
   }
 
   msg("Kernel left main loop");
+  publish_kernel_stats();
+  dump_totals_info();
+  dump_sched_info(kernel_start_ns);
+  dump_cpus_info();
+  dump_switch_info();
+  dump_context_info();
+  dump_vm_info();
+  if (virtual_time && engine != ENGINE_REPLAY) {
+    msg("Simulated %.3f s in %.3f s, %lu events",
+        get_time_ns() / 1e9, (get_real_time_ns() - real_start_ns) / 1e9,
+        (unsigned long)des_event_count());
+  }
+  if (virtual_time && device_model == DEVICE_MODEL_SERVICE) {
+    device_print_stats(&devices[0]);
+    device_print_stats(&devices[1]);
+  }
+  msg("Schedule checksum %016lx", (unsigned long)schedule_checksum);
+  if (metrics_file != NULL) {
+    write_metrics(metrics_file, kernel_start_ns);
+    fclose(metrics_file);
+  }
+  if (engine == ENGINE_REPLAY && !replay_diverged) {
+    if (schedule_checksum == replaying->header.checksum) {
+      msg("Replay matched the recorded schedule");
+    } else {
+      msg("Replay diverged, the recorded schedule checksum is %016lx",
+          (unsigned long)replaying->header.checksum);
+      replay_diverged = true;
+    }
+  }
 
   // Cleanup
   free_queue(D1_app_queue);
   free_queue(D2_app_queue);
-  free_queue(dispatch_queue);
-  shmdt(shm);
-  shmctl(shm_id, IPC_RMID, NULL);
+  sched_free();
+  if (vm_enabled) {
+    vm_free();
+  }
+  if (restoring != NULL) {
+    checkpoint_close(restoring);
+  }
+  if (engine == ENGINE_COROUTINE) {
+    coapps_free();
+  }
+  if (virtual_time && engine != ENGINE_REPLAY) {
+    des_free();
+  }
+  if (virtual_time && device_model == DEVICE_MODEL_SERVICE) {
+    device_free(&devices[0]);
+    device_free(&devices[1]);
+  }
+  reap_children();
+  destroy_shm(shm, shm_name);
+  stats_destroy(live_stats, stats_name);
+  free(apps);
+  free(cpus);
+  if (trace != NULL) {
+    trace_close(trace);
+  }
+  if (recording != NULL) {
+    replay_finish(recording, schedule_checksum);
+  }
+  if (replaying != NULL) {
+    replay_close(replaying);
+  }
   close(interpipe_fd[PIPE_READ]);
-  close(apps_pipe_fd[PIPE_READ]);
-  sem_close(dispatch_sem);
-  sem_unlink(DISPATCH_SEM_NAME);
+  close(devpipe_write_fd);
+  close(doorbell_fd);
+  close(epoll_fd);
+  close(signal_fd);
 
   msg("Kernel finished");
-  sleep(1); // wait for children cleanup
 
-  return 0;
+  if (checkpoint_path != NULL && !checkpointed) {
+    fprintf(stderr, "Checkpoint time not reached, no image written\n");
+    return 22;
+  }
+  return replay_diverged ? 20 : 0;
 }
@@ -0,0 +1,270 @@
+#include "cfg.h"
+#include "stats.h"
+#include "types.h"
+#include "util.h"
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Where shm segments show up as files
+#define SHM_DIR "/dev/shm/"
+
+// An app's counters at a refresh, with the times of its current state
+// extrapolated up to the snapshot
+typedef struct {
+  stats_app_t stats;
+  uint64_t run_ns;
+  uint64_t wait_ns;
+  uint64_t blocked_ns;
+  double cpu_percent; // Share of a CPU since the previous refresh
+} app_view_t;
+
+// Segment being watched
+static stats_shm_t *stats;
+// Snapshots of this and the previous refresh
+static app_view_t *views;
+static uint64_t *prev_run_ns;
+// Views ordered for printing, busiest first
+static app_view_t **sorted;
+static uint64_t prev_now_ns = 0;
+
+// Finds the newest stats segment in SHM_DIR, writing its name to name.
+// Returns whether one was found
+static bool find_newest_segment(char *name, size_t size) {
+  const char *prefix = STATS_NAME_PREFIX + 1; // Without the leading slash
+  DIR *dir = opendir(SHM_DIR);
+  struct dirent *entry;
+  time_t newest = 0;
+  bool found = false;
+
+  if (dir == NULL)
+    return false;
+
+  while ((entry = readdir(dir)) != NULL) {
+    char path[512];
+    struct stat st;
+
+    if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0)
+      continue;
+
+    snprintf(path, sizeof(path), SHM_DIR "%s", entry->d_name);
+    if (stat(path, &st) == 0 && (!found || st.st_mtime >= newest)) {
+      snprintf(name, size, "/%s", entry->d_name);
+      newest = st.st_mtime;
+      found = true;
+    }
+  }
+
+  closedir(dir);
+  return found;
+}
+
+// Copies every app and extrapolates the time spent in its current state
+static void snapshot_apps(uint64_t now_ns) {
+  for (int i = 0; i < stats->app_amount; i++) {
+    app_view_t *view = &views[i];
+    stats_app_t *app = &view->stats;
+
+    stats_read_app(stats, i, app);
+    view->run_ns = app->run_ns;
+    view->wait_ns = app->wait_ns;
+    view->blocked_ns = app->blocked_ns;
+
+    if (now_ns > app->updated_ns) {
+      switch (app->state) {
+      case RUNNING:
+        view->run_ns += now_ns - app->updated_ns;
+        break;
+      case PAUSED:
+        view->wait_ns += now_ns - app->state_since_ns;
+        break;
+      case BLOCKED:
+        view->blocked_ns += now_ns - app->state_since_ns;
+        break;
+      default:
+        break;
+      }
+    }
+
+    uint64_t elapsed_ns = now_ns - prev_now_ns;
+    uint64_t ran_ns =
+        view->run_ns > prev_run_ns[i] ? view->run_ns - prev_run_ns[i] : 0;
+    view->cpu_percent = elapsed_ns ? 100.0 * ran_ns / elapsed_ns : 0.0;
+    prev_run_ns[i] = view->run_ns;
+  }
+}
+
+// Busiest first, then the ones that ran the most
+static int compare_views(const void *a, const void *b) {
+  const app_view_t *x = *(const app_view_t *const *)a;
+  const app_view_t *y = *(const app_view_t *const *)b;
+
+  if (x->cpu_percent != y->cpu_percent)
+    return x->cpu_percent < y->cpu_percent ? 1 : -1;
+  if (x->run_ns != y->run_ns)
+    return x->run_ns < y->run_ns ? 1 : -1;
+  return 0;
+}
+
+// Prints the kernel and CPU counters, then the busiest apps
+static void print_view(const stats_kernel_t *kernel, const stats_cpu_t *cpus,
+                       uint64_t now_ns, int rows, bool clear) {
+  // A real time run attached to while booting hasn't set its start yet
+  bool started = stats->virtual_time || kernel->start_ns != 0;
+
+  if (clear) {
+    printf("\033[H\033[2J");
+  }
+
+  printf("kernelsim %d | %s policy | %s time %.1f s | %s\n",
+         stats->kernel_pid, stats->policy,
+         stats->virtual_time ? "virtual" : "real",
+         started ? (now_ns - kernel->start_ns) / 1e9 : 0.0,
+         kernel->finished ? "finished"
+                          : (kernel->paused ? "paused" : "running"));
+  printf("Apps: %d running / %d blocked / %d paused / %d finished | "
+         "IRQs: %lu time / %lu device | %lu syscalls\n",
+         kernel->state_counts[RUNNING], kernel->state_counts[BLOCKED],
+         kernel->state_counts[PAUSED], kernel->state_counts[FINISHED],
+         (unsigned long)kernel->time_irqs, (unsigned long)kernel->device_irqs,
+         (unsigned long)kernel->syscalls);
+
+  for (int i = 0; i < stats->cpu_amount; i++) {
+    uint64_t ticks = cpus[i].busy_ticks + cpus[i].idle_ticks;
+    char running[16] = "idle";
+
+    if (cpus[i].running_app_id != -1) {
+      snprintf(running, sizeof(running), "app %d",
+               cpus[i].running_app_id + 1);
+    }
+    printf("CPU %-3d | %-9s | %5.1f%% busy | %lu steals | %lu migrations\n",
+           i, running, ticks ? 100.0 * cpus[i].busy_ticks / ticks : 0.0,
+           (unsigned long)cpus[i].steals, (unsigned long)cpus[i].migrations);
+  }
+
+  for (int i = 0; i < stats->app_amount; i++) {
+    sorted[i] = &views[i];
+  }
+  qsort(sorted, stats->app_amount, sizeof(app_view_t *), compare_views);
+
+  printf("\n%7s %-8s %4s %6s %10s %10s %10s %7s %7s %5s %5s %4s %4s %4s %7s "
+         "%5s\n",
+         "APP", "STATE", "CPU", "%CPU", "RUN ms", "WAIT ms", "BLOCK ms",
+         "SWITCH", "PREEMPT", "D1", "D2", "R", "W", "X", "FAULT", "%TLB");
+  for (int i = 0; i < rows && i < stats->app_amount; i++) {
+    const app_view_t *view = sorted[i];
+    const stats_app_t *app = &view->stats;
+
+    printf("%7ld %-8s %4d %6.1f %10.1f %10.1f %10.1f %7u %7u %5d %5d %4d "
+           "%4d %4d %7lu %5.1f\n",
+           (long)(view - views) + 1, PROC_STATE_STR[app->state], app->cpu_id,
+           view->cpu_percent, view->run_ns / 1e6, view->wait_ns / 1e6,
+           view->blocked_ns / 1e6, app->switches, app->preemptions,
+           app->D1_access_count, app->D2_access_count, app->read_count,
+           app->write_count, app->exec_count, (unsigned long)app->page_faults,
+           app->mem_accesses ? 100.0 * app->tlb_hits / app->mem_accesses
+                             : 0.0);
+  }
+
+  fflush(stdout);
+}
+
+// Prints command line usage
+static void print_usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-p kernelsim_pid] [-i interval_ms] [-n rows] [-o]\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  char name[300] = "";
+  int interval_ms = KERNELSTAT_REFRESH_MS;
+  int rows = KERNELSTAT_ROWS;
+  bool once = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:i:n:o")) != -1) {
+    switch (opt) {
+    case 'p':
+      snprintf(name, sizeof(name), STATS_NAME_PREFIX "%s", optarg);
+      break;
+    case 'i':
+      interval_ms = atoi(optarg);
+      break;
+    case 'n':
+      rows = atoi(optarg);
+      break;
+    case 'o':
+      once = true;
+      break;
+    default:
+      print_usage(argv[0]);
+      exit(16);
+    }
+  }
+  if (interval_ms <= 0 || rows < 0) {
+    print_usage(argv[0]);
+    exit(16);
+  }
+
+  // Watch the newest kernelsim unless told which one
+  if (name[0] == '\0' && !find_newest_segment(name, sizeof(name))) {
+    fprintf(stderr, "No kernelsim stats segment found\n");
+    exit(3);
+  }
+  stats = stats_attach(name);
+  if (stats == NULL) {
+    fprintf(stderr, "Shm attach error\n");
+    exit(3);
+  }
+
+  views = (app_view_t *)malloc(stats->app_amount * sizeof(app_view_t));
+  prev_run_ns = (uint64_t *)calloc(stats->app_amount, sizeof(uint64_t));
+  sorted = (app_view_t **)malloc(stats->app_amount * sizeof(app_view_t *));
+  stats_cpu_t *cpus = (stats_cpu_t *)malloc(stats->cpu_amount *
+                                            sizeof(stats_cpu_t));
+  if (views == NULL || prev_run_ns == NULL || sorted == NULL ||
+      cpus == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  while (true) {
+    stats_kernel_t kernel;
+
+    stats_read_kernel(stats, &kernel, cpus);
+
+    // Virtual time only moves when the kernel publishes it
+    uint64_t now_ns = stats->virtual_time ? kernel.now_ns : get_time_ns();
+    if (prev_now_ns == 0 || prev_now_ns < kernel.start_ns) {
+      prev_now_ns = kernel.start_ns;
+    }
+    snapshot_apps(now_ns);
+    prev_now_ns = now_ns;
+
+    print_view(&kernel, cpus, now_ns, rows, !once);
+
+    // Stop once the kernel is done, or gone without saying so
+    if (once || kernel.finished ||
+        (kill(stats->kernel_pid, 0) == -1 && errno == ESRCH))
+      break;
+
+    struct timespec interval = {.tv_sec = interval_ms / 1000,
+                                .tv_nsec = (interval_ms % 1000) * 1000000L};
+    nanosleep(&interval, NULL);
+  }
+
+  free(views);
+  free(prev_run_ns);
+  free(sorted);
+  free(cpus);
+  stats_detach(stats);
+
+  return 0;
+}
@@ -0,0 +1,476 @@
+#include "logger.h"
+#include "cfg.h"
+#include "util.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// How long the background thread sleeps when there's nothing to print
+#define LOG_IDLE_WAIT_MS 100
+
+// Kind of argument a printf conversion takes, as stored in a record
+typedef enum {
+  ARG_NONE,   // %%
+  ARG_INT,    // int or unsigned int, including char and short
+  ARG_LONG,   // long or unsigned long
+  ARG_LLONG,  // long long or unsigned long long, intmax_t
+  ARG_SIZE,   // size_t or ptrdiff_t
+  ARG_DOUBLE, // double
+  ARG_PTR     // string or pointer
+} arg_kind_t;
+
+// Compact binary log record, formatted later by the background thread
+typedef struct {
+  _Atomic uint32_t sequence; // Whose turn it is to use the slot
+  uint8_t level;             // log_level_t
+  uint8_t category;          // log_cat_t
+  uint8_t argc;              // Amount of stored arguments
+  uint64_t timestamp_ns;     // CLOCK_REALTIME time of the call
+  const char *format;        // Static format string, works as a format id
+  uint64_t args[LOG_MAX_ARGS];
+} log_record_t;
+
+// Per-category rate limiting, counts records in the current second
+typedef struct {
+  _Atomic uint64_t window;     // Second the count refers to
+  _Atomic uint32_t count;      // Records accepted in that second
+  _Atomic uint32_t suppressed; // Records dropped since last reported
+} log_rate_t;
+
+static const char *LOG_CAT_STR[] = {"general", "dispatch", "irq", "syscall",
+                                    "app"};
+
+// Multi-producer single-consumer ring of records, producers are any thread
+// or signal handler of this process, consumer is the background thread
+static log_record_t ring[LOG_RING_SIZE];
+static _Atomic uint32_t ring_tail;
+static uint32_t ring_head;
+// Records dropped because the ring was full
+static _Atomic uint32_t dropped_records;
+// Set by the background thread before sleeping, used as a futex
+static _Atomic uint32_t drainer_sleeping;
+// Tells the background thread to exit
+static _Atomic bool drainer_stopping;
+static pthread_t drainer_thread;
+static bool drainer_started = false;
+
+static log_rate_t rates[LOG_CAT_AMOUNT];
+#ifdef DEBUG
+static _Atomic int current_level = LOG_LEVEL_DEBUG;
+#else
+static _Atomic int current_level = LOG_LEVEL_INFO;
+#endif
+
+// Parses the printf conversion starting after a '%'.
+// Returns a pointer past it, and the kind of argument it takes
+static const char *parse_conversion(const char *p, arg_kind_t *kind) {
+  int longs = 0;
+  bool size = false;
+
+  // flags, width and precision
+  while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL) {
+    p++;
+  }
+
+  // length modifiers
+  for (;; p++) {
+    if (*p == 'l') {
+      longs++;
+    } else if (*p == 'j') {
+      longs = 2;
+    } else if (*p == 'z' || *p == 't') {
+      size = true;
+    } else if (*p != 'h') {
+      break;
+    }
+  }
+
+  switch (*p) {
+  case '%':
+    *kind = ARG_NONE;
+    break;
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    *kind = ARG_DOUBLE;
+    break;
+  case 's':
+  case 'p':
+    *kind = ARG_PTR;
+    break;
+  default:
+    *kind = size ? ARG_SIZE : longs >= 2 ? ARG_LLONG : longs ? ARG_LONG
+                                                           : ARG_INT;
+    break;
+  }
+
+  return *p != '\0' ? p + 1 : p;
+}
+
+// Stores the arguments of a call in a record, according to its format
+static int capture_args(const char *format, va_list args, uint64_t *out) {
+  int argc = 0;
+
+  for (const char *p = format; *p != '\0' && argc < LOG_MAX_ARGS;) {
+    if (*p++ != '%')
+      continue;
+
+    arg_kind_t kind;
+    p = parse_conversion(p, &kind);
+
+    switch (kind) {
+    case ARG_NONE:
+      break;
+    case ARG_INT:
+      out[argc++] = (uint64_t)va_arg(args, int);
+      break;
+    case ARG_LONG:
+      out[argc++] = (uint64_t)va_arg(args, long);
+      break;
+    case ARG_LLONG:
+      out[argc++] = (uint64_t)va_arg(args, long long);
+      break;
+    case ARG_SIZE:
+      out[argc++] = (uint64_t)va_arg(args, size_t);
+      break;
+    case ARG_DOUBLE: {
+      double value = va_arg(args, double);
+      memcpy(&out[argc++], &value, sizeof(double));
+      break;
+    }
+    case ARG_PTR:
+      out[argc++] = (uint64_t)(uintptr_t)va_arg(args, void *);
+      break;
+    }
+  }
+
+  return argc;
+}
+
+// Formats a record's message, one conversion at a time
+static void render_message(const log_record_t *record, char *buf,
+                           size_t size) {
+  size_t len = 0;
+  int argi = 0;
+  const char *p = record->format;
+
+  while (*p != '\0' && len + 1 < size) {
+    if (*p != '%') {
+      buf[len++] = *p++;
+      continue;
+    }
+
+    // Copy this conversion alone and format it with its argument
+    arg_kind_t kind;
+    const char *end = parse_conversion(p + 1, &kind);
+    char spec[32];
+    size_t spec_len = (size_t)(end - p) < sizeof(spec) - 1
+                          ? (size_t)(end - p)
+                          : sizeof(spec) - 1;
+    memcpy(spec, p, spec_len);
+    spec[spec_len] = '\0';
+    p = end;
+
+    uint64_t arg = (kind != ARG_NONE && argi < record->argc)
+                       ? record->args[argi++]
+                       : 0;
+    int written;
+
+    switch (kind) {
+    case ARG_NONE:
+      written = snprintf(buf + len, size - len, "%%");
+      break;
+    case ARG_INT:
+      written = snprintf(buf + len, size - len, spec, (int)arg);
+      break;
+    case ARG_LONG:
+      written = snprintf(buf + len, size - len, spec, (long)arg);
+      break;
+    case ARG_LLONG:
+      written = snprintf(buf + len, size - len, spec, (long long)arg);
+      break;
+    case ARG_SIZE:
+      written = snprintf(buf + len, size - len, spec, (size_t)arg);
+      break;
+    case ARG_DOUBLE: {
+      double value;
+      memcpy(&value, &arg, sizeof(double));
+      written = snprintf(buf + len, size - len, spec, value);
+      break;
+    }
+    default:
+      written = snprintf(buf + len, size - len, spec, (void *)(uintptr_t)arg);
+      break;
+    }
+
+    if (written > 0) {
+      len += (size_t)written < size - len ? (size_t)written : size - len - 1;
+    }
+  }
+
+  buf[len] = '\0';
+}
+
+// Prints a record with its timestamp prefix
+static void print_record(const log_record_t *record) {
+  char text[512];
+  struct tm tm_info;
+  time_t seconds = record->timestamp_ns / 1000000000ULL;
+
+  render_message(record, text, sizeof(text));
+  localtime_r(&seconds, &tm_info);
+
+  // Print timestamp with hours, minutes, seconds, and centiseconds
+  printf("[%02d:%02d:%02d.%02lu] %s\n", tm_info.tm_hour, tm_info.tm_min,
+         tm_info.tm_sec,
+         (unsigned long)(record->timestamp_ns % 1000000000ULL) / 10000000,
+         text);
+}
+
+// Prints every published record, then reports drops and suppressions.
+// Only one thread calls this at a time
+static void drain_records(void) {
+  for (;;) {
+    log_record_t *record = &ring[ring_head & (LOG_RING_SIZE - 1)];
+
+    if (atomic_load_explicit(&record->sequence, memory_order_acquire) !=
+        ring_head + 1)
+      break;
+
+    print_record(record);
+
+    // Hand the slot back to producers for the next lap
+    atomic_store_explicit(&record->sequence, ring_head + LOG_RING_SIZE,
+                          memory_order_release);
+    ring_head++;
+  }
+
+  uint32_t dropped = atomic_exchange(&dropped_records, 0);
+  if (dropped > 0) {
+    printf("[log] %u records dropped, ring full\n", dropped);
+  }
+
+  for (int i = 0; i < LOG_CAT_AMOUNT; i++) {
+    uint32_t suppressed = atomic_exchange(&rates[i].suppressed, 0);
+
+    if (suppressed > 0) {
+      printf("[log] %u %s records suppressed by rate limit\n", suppressed,
+             LOG_CAT_STR[i]);
+    }
+  }
+
+  fflush(stdout);
+}
+
+// Whether any record is waiting to be printed
+static bool has_pending_records(void) {
+  log_record_t *record = &ring[ring_head & (LOG_RING_SIZE - 1)];
+
+  return atomic_load(&record->sequence) == ring_head + 1;
+}
+
+// Background thread, prints records in batches with a single fflush
+static void *drainer_main(void *arg) {
+  struct timespec idle_wait = {.tv_sec = 0,
+                               .tv_nsec = LOG_IDLE_WAIT_MS * 1000000L};
+
+  while (!atomic_load(&drainer_stopping)) {
+    drain_records();
+
+    // Sleep until a producer wakes us, rechecking after announcing it
+    atomic_store(&drainer_sleeping, 1);
+    if (!has_pending_records() && !atomic_load(&drainer_stopping)) {
+      futex_wait(&drainer_sleeping, 1, &idle_wait);
+    }
+    atomic_store(&drainer_sleeping, 0);
+  }
+
+  return NULL;
+}
+
+// Whether the category may log one more record in the current second
+static bool within_rate_limit(log_cat_t cat) {
+#if LOG_RATE_LIMIT > 0
+  log_rate_t *rate = &rates[cat];
+  uint64_t now = get_real_time_ns() / 1000000000ULL;
+  uint64_t window = atomic_load_explicit(&rate->window, memory_order_relaxed);
+
+  // New second, restart the count. Losing this race only miscounts a bit
+  if (window != now &&
+      atomic_compare_exchange_strong(&rate->window, &window, now)) {
+    atomic_store_explicit(&rate->count, 0, memory_order_relaxed);
+  }
+
+  if (atomic_fetch_add_explicit(&rate->count, 1, memory_order_relaxed) >=
+      LOG_RATE_LIMIT) {
+    atomic_fetch_add_explicit(&rate->suppressed, 1, memory_order_relaxed);
+    return false;
+  }
+#endif
+
+  return true;
+}
+
+// Publishes a record to the ring, or drops it if the ring is full
+static void push_record(log_level_t level, log_cat_t cat, const char *format,
+                        va_list args) {
+  struct timespec ts;
+  uint32_t pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+  log_record_t *record;
+
+  // Claim the slot at tail, competing with other threads and handlers
+  for (;;) {
+    record = &ring[pos & (LOG_RING_SIZE - 1)];
+    uint32_t seq =
+        atomic_load_explicit(&record->sequence, memory_order_acquire);
+    int32_t diff = (int32_t)(seq - pos);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring_tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      atomic_fetch_add_explicit(&dropped_records, 1, memory_order_relaxed);
+      return;
+    } else {
+      pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    }
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  record->level = level;
+  record->category = cat;
+  record->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  record->format = format;
+  record->argc = capture_args(format, args, record->args);
+
+  // Publish, then wake the background thread if it's sleeping
+  atomic_store(&record->sequence, pos + 1);
+  if (atomic_exchange(&drainer_sleeping, 0) == 1) {
+    futex_wake(&drainer_sleeping);
+  }
+}
+
+// Common path of every logging function
+static void vlog_msg(log_level_t level, log_cat_t cat, const char *format,
+                     va_list args) {
+  if ((int)level > atomic_load_explicit(&current_level, memory_order_relaxed))
+    return;
+  if (!within_rate_limit(cat))
+    return;
+
+  if (drainer_started) {
+    push_record(level, cat, format, args);
+  } else {
+    // No background thread in this process, print right away
+    log_record_t record = {.level = level, .category = cat, .format = format};
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    record.timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    record.argc = capture_args(format, args, record.args);
+    print_record(&record);
+    fflush(stdout);
+  }
+}
+
+// Only the forking thread survives in the child, which prints directly
+static void log_after_fork_child(void) { drainer_started = false; }
+
+void log_init(void) {
+  // Runtime log level from the environment, inherited by children
+  const char *level = getenv("KERNELSIM_LOG_LEVEL");
+  if (level != NULL) {
+    if (strcmp(level, "error") == 0) {
+      log_set_level(LOG_LEVEL_ERROR);
+    } else if (strcmp(level, "info") == 0) {
+      log_set_level(LOG_LEVEL_INFO);
+    } else if (strcmp(level, "debug") == 0) {
+      log_set_level(LOG_LEVEL_DEBUG);
+    }
+  }
+
+  for (uint32_t i = 0; i < LOG_RING_SIZE; i++) {
+    atomic_init(&ring[i].sequence, i);
+  }
+
+  // The thread starts with every signal blocked, so handlers always run on
+  // the threads that expect them
+  sigset_t all_mask, orig_mask;
+  sigfillset(&all_mask);
+  pthread_sigmask(SIG_BLOCK, &all_mask, &orig_mask);
+  drainer_started =
+      pthread_create(&drainer_thread, NULL, drainer_main, NULL) == 0;
+  pthread_sigmask(SIG_SETMASK, &orig_mask, NULL);
+
+  pthread_atfork(NULL, NULL, log_after_fork_child);
+  atexit(log_shutdown);
+}
+
+void log_shutdown(void) {
+  if (!drainer_started)
+    return;
+
+  atomic_store(&drainer_stopping, true);
+  atomic_store(&drainer_sleeping, 0);
+  futex_wake(&drainer_sleeping);
+  pthread_join(drainer_thread, NULL);
+  drainer_started = false;
+
+  // Print whatever was published while the thread was exiting
+  drain_records();
+}
+
+void log_set_level(log_level_t level) { atomic_store(&current_level, level); }
+
+void log_msg(log_level_t level, log_cat_t cat, const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vlog_msg(level, cat, format, args);
+  va_end(args);
+}
+
+void msg(const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vlog_msg(LOG_LEVEL_INFO, LOG_CAT_GENERAL, format, args);
+  va_end(args);
+}
+
+void dmsg(const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vlog_msg(LOG_LEVEL_DEBUG, LOG_CAT_GENERAL, format, args);
+  va_end(args);
+}
+
+void cmsg(log_cat_t cat, const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vlog_msg(LOG_LEVEL_INFO, cat, format, args);
+  va_end(args);
+}
+
+void cdmsg(log_cat_t cat, const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vlog_msg(LOG_LEVEL_DEBUG, cat, format, args);
+  va_end(args);
+}
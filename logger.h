@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+// Max amount of arguments stored in a log record
+#define LOG_MAX_ARGS 6
+
+// Log levels, messages above the current level are discarded
+typedef enum {
+  LOG_LEVEL_ERROR, // Only errors
+  LOG_LEVEL_INFO,  // msg() output
+  LOG_LEVEL_DEBUG  // dmsg() output
+} log_level_t;
+
+// Log categories, each one rate limited separately
+typedef enum {
+  LOG_CAT_GENERAL,  // Boot, shutdown and pause dumps
+  LOG_CAT_DISPATCH, // Dispatcher decisions
+  LOG_CAT_IRQ,      // Interrupts sent and received
+  LOG_CAT_SYSCALL,  // Syscall requests and blocking
+  LOG_CAT_APP,      // App progress
+  LOG_CAT_AMOUNT
+} log_cat_t;
+
+// Starts the background thread that formats and prints log records,
+// and registers log_shutdown() to run at exit. Called once per process
+void log_init(void);
+
+// Prints every pending record and stops the background thread
+void log_shutdown(void);
+
+// Sets the runtime log level
+void log_set_level(log_level_t level);
+
+// Queues a log record with a timestamp, printed later by the background
+// thread. Never blocks or allocates, so it's safe in signal handlers.
+// Only the format string pointer and up to LOG_MAX_ARGS arguments are
+// stored, so %s arguments must point to static storage, and * widths
+// aren't supported
+void log_msg(log_level_t level, log_cat_t cat, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// printf + timestamp
+void msg(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// printf + timestamp for DEBUG only
+void dmsg(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// printf + timestamp, rate limited in the given category
+void cmsg(log_cat_t cat, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// printf + timestamp for DEBUG only, rate limited in the given category
+void cdmsg(log_cat_t cat, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+// Seeded xoshiro256** generator. Each process draws from its own state, and
+// every user of the run's base seed gets a separate stream of it, so a seed
+// reproduces the whole run regardless of which process draws first
+
+// Streams derived from the base seed, apps use PRNG_STREAM_APPS + app_id
+typedef enum {
+  PRNG_STREAM_IRQ,     // Random device interrupts, intersim or virtual time
+  PRNG_STREAM_LOTTERY, // Lottery scheduler draws
+  PRNG_STREAM_DEVICES, // Service times, plus the device's irq_t
+  PRNG_STREAM_APPS = PRNG_STREAM_DEVICES + 4
+} prng_stream_t;
+
+// Memory access streams of apps, plus the app_id, past every app stream
+#define PRNG_STREAM_MEMORY (1ULL << 32)
+
+typedef struct {
+  uint64_t s[4];
+} prng_t;
+
+static inline uint64_t prng_rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+// Fills the state from a base seed and stream with splitmix64, which never
+// yields the all-zero state
+static inline void prng_seed(prng_t *prng, uint64_t seed, uint64_t stream) {
+  uint64_t x = seed ^ (stream * 0x9e3779b97f4a7c15ULL);
+
+  for (int i = 0; i < 4; i++) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    prng->s[i] = z ^ (z >> 31);
+  }
+}
+
+static inline uint64_t prng_next(prng_t *prng) {
+  uint64_t *s = prng->s;
+  uint64_t result = prng_rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = prng_rotl(s[3], 45);
+
+  return result;
+}
+
+// Uniform in [0, bound), the modulo bias is negligible for our bounds
+static inline uint64_t prng_below(prng_t *prng, uint64_t bound) {
+  return prng_next(prng) % bound;
+}
+
+// Uniform in [0, 1), with 53 random bits
+static inline double prng_unit(prng_t *prng) {
+  return (prng_next(prng) >> 11) * 0x1.0p-53;
+}
@@ -0,0 +1,289 @@
+#include "rbtree.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Node of an app_id or the sentinel
+#define N(id) (tree->nodes[id])
+
+// Whether a is ordered before b
+static inline bool rb_less(const rb_tree_t *tree, int a, int b) {
+  return N(a).key < N(b).key || (N(a).key == N(b).key && a < b);
+}
+
+static void rotate_left(rb_tree_t *tree, int x) {
+  int y = N(x).right;
+
+  N(x).right = N(y).left;
+  if (N(y).left != tree->nil) {
+    N(N(y).left).parent = x;
+  }
+  N(y).parent = N(x).parent;
+  if (N(x).parent == tree->nil) {
+    tree->root = y;
+  } else if (x == N(N(x).parent).left) {
+    N(N(x).parent).left = y;
+  } else {
+    N(N(x).parent).right = y;
+  }
+  N(y).left = x;
+  N(x).parent = y;
+}
+
+static void rotate_right(rb_tree_t *tree, int x) {
+  int y = N(x).left;
+
+  N(x).left = N(y).right;
+  if (N(y).right != tree->nil) {
+    N(N(y).right).parent = x;
+  }
+  N(y).parent = N(x).parent;
+  if (N(x).parent == tree->nil) {
+    tree->root = y;
+  } else if (x == N(N(x).parent).right) {
+    N(N(x).parent).right = y;
+  } else {
+    N(N(x).parent).left = y;
+  }
+  N(y).right = x;
+  N(x).parent = y;
+}
+
+// Leftmost node of the subtree rooted at x
+static int subtree_first(const rb_tree_t *tree, int x) {
+  while (N(x).left != tree->nil) {
+    x = N(x).left;
+  }
+
+  return x;
+}
+
+// Replaces the subtree rooted at u with the one rooted at v
+static void transplant(rb_tree_t *tree, int u, int v) {
+  if (N(u).parent == tree->nil) {
+    tree->root = v;
+  } else if (u == N(N(u).parent).left) {
+    N(N(u).parent).left = v;
+  } else {
+    N(N(u).parent).right = v;
+  }
+  N(v).parent = N(u).parent;
+}
+
+rb_node_t *rb_create_nodes(int max_id) {
+  rb_node_t *nodes = (rb_node_t *)malloc((max_id + 1) * sizeof(rb_node_t));
+  if (nodes == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  // The sentinel is always black
+  nodes[max_id] = (rb_node_t){
+      .left = max_id, .right = max_id, .parent = max_id, .red = false};
+
+  return nodes;
+}
+
+void rb_init(rb_tree_t *tree, rb_node_t *nodes, int max_id) {
+  tree->nodes = nodes;
+  tree->nil = max_id;
+  tree->root = tree->first = max_id;
+  tree->length = 0;
+}
+
+void rb_insert(rb_tree_t *tree, int z, uint64_t key) {
+  assert(z >= 0 && z < tree->nil);
+
+  N(z) = (rb_node_t){.left = tree->nil,
+                     .right = tree->nil,
+                     .parent = tree->nil,
+                     .red = true,
+                     .key = key};
+
+  // Plain BST insert
+  int y = tree->nil;
+  for (int x = tree->root; x != tree->nil;) {
+    y = x;
+    x = rb_less(tree, z, x) ? N(x).left : N(x).right;
+  }
+  N(z).parent = y;
+  if (y == tree->nil) {
+    tree->root = z;
+  } else if (rb_less(tree, z, y)) {
+    N(y).left = z;
+  } else {
+    N(y).right = z;
+  }
+
+  if (tree->first == tree->nil || rb_less(tree, z, tree->first)) {
+    tree->first = z;
+  }
+  tree->length++;
+
+  // Fix red parents going up
+  while (N(N(z).parent).red) {
+    int p = N(z).parent;
+    int g = N(p).parent;
+
+    if (p == N(g).left) {
+      int uncle = N(g).right;
+
+      if (N(uncle).red) {
+        N(p).red = N(uncle).red = false;
+        N(g).red = true;
+        z = g;
+      } else {
+        if (z == N(p).right) {
+          z = p;
+          rotate_left(tree, z);
+          p = N(z).parent;
+        }
+        N(p).red = false;
+        N(g).red = true;
+        rotate_right(tree, g);
+      }
+    } else {
+      int uncle = N(g).left;
+
+      if (N(uncle).red) {
+        N(p).red = N(uncle).red = false;
+        N(g).red = true;
+        z = g;
+      } else {
+        if (z == N(p).left) {
+          z = p;
+          rotate_right(tree, z);
+          p = N(z).parent;
+        }
+        N(p).red = false;
+        N(g).red = true;
+        rotate_left(tree, g);
+      }
+    }
+  }
+  N(tree->root).red = false;
+}
+
+void rb_remove(rb_tree_t *tree, int z) {
+  assert(z >= 0 && z < tree->nil && tree->length > 0);
+
+  // The leftmost node has no left child, its successor is easy to find
+  if (z == tree->first) {
+    tree->first = N(z).right != tree->nil ? subtree_first(tree, N(z).right)
+                                          : N(z).parent;
+  }
+  tree->length--;
+
+  int y = z;
+  bool y_was_red = N(y).red;
+  int x;
+
+  if (N(z).left == tree->nil) {
+    x = N(z).right;
+    transplant(tree, z, N(z).right);
+  } else if (N(z).right == tree->nil) {
+    x = N(z).left;
+    transplant(tree, z, N(z).left);
+  } else {
+    y = subtree_first(tree, N(z).right);
+    y_was_red = N(y).red;
+    x = N(y).right;
+    if (N(y).parent == z) {
+      N(x).parent = y;
+    } else {
+      transplant(tree, y, N(y).right);
+      N(y).right = N(z).right;
+      N(N(y).right).parent = y;
+    }
+    transplant(tree, z, y);
+    N(y).left = N(z).left;
+    N(N(y).left).parent = y;
+    N(y).red = N(z).red;
+  }
+
+  if (y_was_red)
+    return;
+
+  // Removed a black node, fix the black heights going up
+  while (x != tree->root && !N(x).red) {
+    int p = N(x).parent;
+
+    if (x == N(p).left) {
+      int w = N(p).right;
+
+      if (N(w).red) {
+        N(w).red = false;
+        N(p).red = true;
+        rotate_left(tree, p);
+        w = N(p).right;
+      }
+      if (!N(N(w).left).red && !N(N(w).right).red) {
+        N(w).red = true;
+        x = p;
+      } else {
+        if (!N(N(w).right).red) {
+          N(N(w).left).red = false;
+          N(w).red = true;
+          rotate_right(tree, w);
+          w = N(p).right;
+        }
+        N(w).red = N(p).red;
+        N(p).red = false;
+        N(N(w).right).red = false;
+        rotate_left(tree, p);
+        x = tree->root;
+      }
+    } else {
+      int w = N(p).left;
+
+      if (N(w).red) {
+        N(w).red = false;
+        N(p).red = true;
+        rotate_right(tree, p);
+        w = N(p).left;
+      }
+      if (!N(N(w).right).red && !N(N(w).left).red) {
+        N(w).red = true;
+        x = p;
+      } else {
+        if (!N(N(w).left).red) {
+          N(N(w).right).red = false;
+          N(w).red = true;
+          rotate_left(tree, w);
+          w = N(p).left;
+        }
+        N(w).red = N(p).red;
+        N(p).red = false;
+        N(N(w).left).red = false;
+        rotate_right(tree, p);
+        x = tree->root;
+      }
+    }
+  }
+  N(x).red = false;
+}
+
+int rb_items(const rb_tree_t *tree, int *app_ids) {
+  int amount = 0;
+  int x = tree->first;
+
+  // In order: the successor is the first of the right subtree, or the
+  // nearest ancestor we're on the left of
+  while (x != tree->nil) {
+    app_ids[amount++] = x;
+
+    if (N(x).right != tree->nil) {
+      x = subtree_first(tree, N(x).right);
+    } else {
+      int parent = N(x).parent;
+
+      while (parent != tree->nil && x == N(parent).right) {
+        x = parent;
+        parent = N(x).parent;
+      }
+      x = parent;
+    }
+  }
+
+  return amount;
+}
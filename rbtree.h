@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Red-black tree of app_ids ordered by a 64-bit key, ties broken by
+// app_id. Nodes live in a preallocated array indexed by app_id, shared by
+// every tree built on it, since an app is in at most one tree at a time.
+// Nothing is allocated after rb_create_nodes
+
+// Node of an app_id, links are app_ids or the sentinel
+typedef struct {
+  int left;
+  int right;
+  int parent;
+  bool red;
+  uint64_t key;
+} rb_node_t;
+
+typedef struct {
+  rb_node_t *nodes; // Shared node array, with the sentinel at nil
+  int nil;          // Sentinel index, same as max_id
+  int root;
+  int first; // Leftmost app_id, kept up to date for O(1) minimum
+  int length;
+} rb_tree_t;
+
+// Allocates nodes for app_ids in [0, max_id), plus the sentinel
+rb_node_t *rb_create_nodes(int max_id);
+
+// Initializes an empty tree using the given node array
+void rb_init(rb_tree_t *tree, rb_node_t *nodes, int max_id);
+
+// Inserts an app_id, which must not be in any tree, with the given key
+void rb_insert(rb_tree_t *tree, int app_id, uint64_t key);
+
+// Removes an app_id from the tree it's in
+void rb_remove(rb_tree_t *tree, int app_id);
+
+// Copies the app_ids in the tree into app_ids, smallest key first.
+// Returns how many there are
+int rb_items(const rb_tree_t *tree, int *app_ids);
+
+// Returns the app_id with the smallest key, or -1 if the tree is empty
+static inline int rb_first(const rb_tree_t *tree) {
+  return tree->first == tree->nil ? -1 : tree->first;
+}
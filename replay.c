@@ -0,0 +1,109 @@
+#include "replay.h"
+#include <stdlib.h>
+
+// stdio buffer of the recording, records are small and frequent
+#define REPLAY_BUFFER_SIZE (1 << 20)
+
+static replay_t *alloc_replay(const char *path, const char *mode) {
+  replay_t *replay = (replay_t *)calloc(1, sizeof(replay_t));
+  if (replay == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  replay->file = fopen(path, mode);
+  if (replay->file == NULL) {
+    fprintf(stderr, "Replay file error\n");
+    exit(20);
+  }
+  setvbuf(replay->file, NULL, _IOFBF, REPLAY_BUFFER_SIZE);
+
+  return replay;
+}
+
+// Writes the header at the start of the file
+static void write_header(replay_t *replay) {
+  if (fseek(replay->file, 0, SEEK_SET) == -1 ||
+      fwrite(&replay->header, sizeof(replay_header_t), 1, replay->file) != 1) {
+    fprintf(stderr, "Replay file error\n");
+    exit(20);
+  }
+}
+
+replay_t *replay_create(const char *path, const replay_header_t *header) {
+  replay_t *replay = alloc_replay(path, "wb");
+
+  replay->header = *header;
+  replay->header.magic = REPLAY_MAGIC;
+  replay->header.version = REPLAY_VERSION;
+  replay->header.record_size = sizeof(replay_record_t);
+  replay->header.count = 0;
+  write_header(replay);
+
+  return replay;
+}
+
+void replay_append(replay_t *replay, uint64_t time_ns, replay_type_t type,
+                   int value, int arg) {
+  replay_record_t record = {
+      .time_ns = time_ns, .type = type, .value = value, .arg = arg};
+
+  if (fwrite(&record, sizeof(record), 1, replay->file) != 1) {
+    fprintf(stderr, "Replay file error\n");
+    exit(20);
+  }
+  replay->position++;
+}
+
+void replay_finish(replay_t *replay, uint64_t checksum) {
+  replay->header.count = replay->position;
+  replay->header.checksum = checksum;
+  write_header(replay);
+
+  if (fclose(replay->file) != 0) {
+    fprintf(stderr, "Replay file error\n");
+    exit(20);
+  }
+  free(replay);
+}
+
+replay_t *replay_open(const char *path) {
+  replay_t *replay = alloc_replay(path, "rb");
+  replay_header_t *header = &replay->header;
+
+  if (fread(header, sizeof(replay_header_t), 1, replay->file) != 1 ||
+      header->magic != REPLAY_MAGIC || header->version != REPLAY_VERSION ||
+      header->record_size != sizeof(replay_record_t) ||
+      header->config.app_amount <= 0 || header->config.cpu_amount <= 0) {
+    fprintf(stderr, "Replay version mismatch\n");
+    exit(20);
+  }
+
+  return replay;
+}
+
+bool replay_peek(replay_t *replay, replay_record_t *record) {
+  if (!replay->peeked) {
+    if (replay->position >= replay->header.count)
+      return false;
+
+    if (fread(&replay->next, sizeof(replay_record_t), 1, replay->file) != 1) {
+      fprintf(stderr, "Replay file truncated\n");
+      exit(20);
+    }
+    replay->peeked = true;
+  }
+
+  *record = replay->next;
+  return true;
+}
+
+void replay_skip(replay_t *replay) {
+  replay->peeked = false;
+  replay->position++;
+}
+
+void replay_close(replay_t *replay) {
+  fclose(replay->file);
+  free(replay);
+}
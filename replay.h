@@ -0,0 +1,102 @@
+#pragma once
+
+#include "config.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Record/replay of a run's nondeterministic inputs. The kernel records, in
+// the order it handles them, every interrupt, every syscall request and
+// every preemption that lost the race with an app's syscall. Fed back in
+// the same order and at the same times, they make the kernel take exactly
+// the same scheduling decisions, without running apps or intersim
+
+#define REPLAY_MAGIC 0x50524b53 // "SKRP"
+#define REPLAY_VERSION 4
+
+// Kinds of recorded inputs
+typedef enum {
+  REPLAY_IRQ,         // Kernel handled an interrupt
+  REPLAY_SYSCALL,     // Kernel handled a syscall request from an app
+  REPLAY_PREEMPT_SKIP // Dispatcher found the app claiming a syscall
+} replay_type_t;
+
+// Fixed-size binary record, appended to the recording
+typedef struct {
+  uint64_t time_ns; // Simulation time since the kernel started
+  uint8_t type;     // replay_type_t
+  uint8_t value;    // irq_t, or the syscall_t of a request
+  int16_t reserved; // Zero
+  // Target CPU of an IRQ_TIME, requests completed by a device interrupt,
+  // or the app of a request or of a skipped preemption
+  int32_t arg;
+} replay_record_t;
+
+_Static_assert(sizeof(replay_record_t) == 16,
+               "replay_record_t must be 16 bytes");
+
+// Header at the start of the recording, followed by the records. The
+// parameters the schedule depends on are replayed from here
+typedef struct {
+  uint32_t magic;         // REPLAY_MAGIC
+  uint32_t version;       // REPLAY_VERSION
+  uint32_t record_size;   // sizeof(replay_record_t)
+  config_t config;        // Configuration of the run
+  uint32_t seed;          // Base seed of the run
+  uint32_t sched_policy;  // sched_policy_t
+  int32_t workload_weights[WORKLOAD_AMOUNT]; // Workload mix of the apps
+  uint64_t count;         // Records in the file
+  uint64_t checksum;      // Schedule checksum of the recorded run
+} replay_header_t;
+
+// Recording being written, or replayed
+typedef struct {
+  replay_header_t header;
+  FILE *file;
+  uint64_t position;    // Records appended, or consumed by a replay
+  replay_record_t next; // Record returned by the last peek
+  bool peeked;          // Whether next holds an unconsumed record
+} replay_t;
+
+// Creates a recording, filled in as records are appended
+replay_t *replay_create(const char *path, const replay_header_t *header);
+
+// Appends a record, buffered until replay_finish
+void replay_append(replay_t *replay, uint64_t time_ns, replay_type_t type,
+                   int value, int arg);
+
+// Writes the final record count and schedule checksum, and closes the file
+void replay_finish(replay_t *replay, uint64_t checksum);
+
+// Opens a recording for replay and validates its header
+replay_t *replay_open(const char *path);
+
+// Reads the next record without consuming it.
+// Returns false after the last record
+bool replay_peek(replay_t *replay, replay_record_t *record);
+
+// Consumes the record returned by the last peek
+void replay_skip(replay_t *replay);
+
+// Closes a recording opened for replay
+void replay_close(replay_t *replay);
+
+// Folds a scheduling decision into a running FNV-1a schedule checksum
+static inline uint64_t replay_checksum(uint64_t checksum, uint64_t time_ns,
+                                       int app_id, int state, int cpu_id) {
+  uint64_t words[] = {time_ns, (uint64_t)app_id, (uint64_t)state,
+                      (uint64_t)cpu_id};
+
+  for (int i = 0; i < 4; i++) {
+    for (int byte = 0; byte < 8; byte++) {
+      checksum ^= (words[i] >> (byte * 8)) & 0xff;
+      checksum *= 0x100000001b3ULL;
+    }
+  }
+
+  return checksum;
+}
+
+// Initial value of the schedule checksum
+#define REPLAY_CHECKSUM_INIT 0xcbf29ce484222325ULL
@@ -0,0 +1,672 @@
+#include "scheduler.h"
+#include "cfg.h"
+#include "config.h"
+#include "prng.h"
+#include "rbtree.h"
+#include "util.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Length of a timeslice in nanoseconds
+#define TICK_NS (config.intersim_tick_us * 1000ULL)
+
+// Ops table of the selected policy
+static const sched_ops_t *ops;
+// Run queue of each CPU, created by the policy
+static void **rqs;
+static int rq_amount;
+static int app_amount;
+// Per-app accounting, and when the running apps were last charged
+static sched_stats_t *stats;
+static uint64_t *charged_ns;
+// Whether the app's next dispatch ends a response time
+static bool *awaiting_response;
+// Share of each app, tickets for lottery, and stride and CFS weight
+static uint64_t *weights;
+// Draws of the lottery policy
+static prng_t lottery_prng;
+
+// State of the ordered policies: pass for stride, vruntime for CFS
+static uint64_t *keys;
+static rb_node_t *rb_nodes;
+
+// MLFQ state: current level and ticks used at it, and the last boost
+static int *mlfq_levels;
+static int *mlfq_used_ticks;
+static uint64_t mlfq_boost_ns;
+
+// Allocates an array for every app, zeroed
+static void *alloc_per_app(size_t size) {
+  void *array = calloc(app_amount, size);
+  if (array == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  return array;
+}
+
+// Round-robin: a single FIFO, every app gives up the CPU at each tick
+
+static void *rr_create_rq(int max_id) { return create_queue(max_id); }
+
+static void rr_free_rq(void *rq) { free_queue((queue_t *)rq); }
+
+static void rr_enqueue(void *rq, int app_id) { enqueue((queue_t *)rq, app_id); }
+
+static int rr_pick_next(void *rq) { return dequeue((queue_t *)rq); }
+
+static int rr_length(const void *rq) {
+  return queue_length((const queue_t *)rq);
+}
+
+static bool rr_on_tick(void *rq, int app_id, uint64_t ran_ns) { return true; }
+
+static void rr_on_block(int app_id, uint64_t ran_ns) {}
+
+static void rr_on_wakeup(void *rq, int app_id) {}
+
+static int rr_save_rq(const void *rq, int *app_ids, uint64_t *key) {
+  *key = 0;
+  return queue_items((const queue_t *)rq, app_ids);
+}
+
+static void rr_restore_rq(void *rq, uint64_t key) {}
+
+static const sched_ops_t rr_ops = {
+    .create_rq = rr_create_rq,
+    .free_rq = rr_free_rq,
+    .enqueue = rr_enqueue,
+    .pick_next = rr_pick_next,
+    .length = rr_length,
+    .on_tick = rr_on_tick,
+    .on_block = rr_on_block,
+    .on_wakeup = rr_on_wakeup,
+    .save_rq = rr_save_rq,
+    .restore_rq = rr_restore_rq,
+};
+
+// Multi-level feedback queue: a FIFO per level, level i gets 2^i ticks.
+// Using up a timeslice demotes an app, while blocking keeps its level and
+// the ticks it used there, so I/O-bound apps stay on top without gaming
+// it. Every app is boosted back to the top every sched_mlfq_boost_ticks
+
+typedef struct {
+  queue_t *levels[SCHED_MLFQ_LEVELS];
+  int length;
+} mlfq_rq_t;
+
+static void *mlfq_create_rq(int max_id) {
+  mlfq_rq_t *rq = (mlfq_rq_t *)malloc(sizeof(mlfq_rq_t));
+  if (rq == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  for (int i = 0; i < SCHED_MLFQ_LEVELS; i++) {
+    rq->levels[i] = create_queue(max_id);
+  }
+  rq->length = 0;
+
+  return rq;
+}
+
+static void mlfq_free_rq(void *rq) {
+  for (int i = 0; i < SCHED_MLFQ_LEVELS; i++) {
+    free_queue(((mlfq_rq_t *)rq)->levels[i]);
+  }
+  free(rq);
+}
+
+static void mlfq_enqueue(void *rq, int app_id) {
+  mlfq_rq_t *mlfq = (mlfq_rq_t *)rq;
+
+  enqueue(mlfq->levels[mlfq_levels[app_id]], app_id);
+  mlfq->length++;
+}
+
+static int mlfq_pick_next(void *rq) {
+  mlfq_rq_t *mlfq = (mlfq_rq_t *)rq;
+
+  for (int i = 0; i < SCHED_MLFQ_LEVELS; i++) {
+    int app_id = dequeue(mlfq->levels[i]);
+
+    if (app_id != -1) {
+      mlfq->length--;
+      return app_id;
+    }
+  }
+
+  return -1;
+}
+
+static int mlfq_length(const void *rq) {
+  return ((const mlfq_rq_t *)rq)->length;
+}
+
+// Moves every app back to the top level, requeueing the ready ones
+static void mlfq_boost(void) {
+  for (int i = 0; i < app_amount; i++) {
+    mlfq_levels[i] = 0;
+    mlfq_used_ticks[i] = 0;
+  }
+
+  for (int cpu = 0; cpu < rq_amount; cpu++) {
+    mlfq_rq_t *mlfq = (mlfq_rq_t *)rqs[cpu];
+
+    for (int level = 1; level < SCHED_MLFQ_LEVELS; level++) {
+      int app_id;
+
+      while ((app_id = dequeue(mlfq->levels[level])) != -1) {
+        enqueue(mlfq->levels[0], app_id);
+      }
+    }
+  }
+}
+
+static bool mlfq_on_tick(void *rq, int app_id, uint64_t ran_ns) {
+  mlfq_rq_t *mlfq = (mlfq_rq_t *)rq;
+  uint64_t now = get_time_ns();
+
+  if (now - mlfq_boost_ns >= config.sched_mlfq_boost_ticks * TICK_NS) {
+    mlfq_boost_ns = now;
+    mlfq_boost();
+    cdmsg(LOG_CAT_DISPATCH, "MLFQ boosted every app to the top level");
+  }
+
+  int level = mlfq_levels[app_id];
+  if (++mlfq_used_ticks[app_id] >= 1 << level) {
+    // Used up its timeslice at this level
+    mlfq_used_ticks[app_id] = 0;
+    if (level < SCHED_MLFQ_LEVELS - 1) {
+      mlfq_levels[app_id]++;
+      cdmsg(LOG_CAT_DISPATCH, "MLFQ demoted app %d to level %d", app_id + 1,
+            level + 1);
+    }
+    return true;
+  }
+
+  // Apps at higher levels always go first
+  for (int i = 0; i < level; i++) {
+    if (queue_length(mlfq->levels[i]) > 0)
+      return true;
+  }
+
+  return false;
+}
+
+static void mlfq_on_block(int app_id, uint64_t ran_ns) {}
+
+static void mlfq_on_wakeup(void *rq, int app_id) {}
+
+// Levels in order, each app goes back to its level on enqueue
+static int mlfq_save_rq(const void *rq, int *app_ids, uint64_t *key) {
+  const mlfq_rq_t *mlfq = (const mlfq_rq_t *)rq;
+  int amount = 0;
+
+  for (int i = 0; i < SCHED_MLFQ_LEVELS; i++) {
+    amount += queue_items(mlfq->levels[i], app_ids + amount);
+  }
+  *key = 0;
+
+  return amount;
+}
+
+static const sched_ops_t mlfq_ops = {
+    .create_rq = mlfq_create_rq,
+    .free_rq = mlfq_free_rq,
+    .enqueue = mlfq_enqueue,
+    .pick_next = mlfq_pick_next,
+    .length = mlfq_length,
+    .on_tick = mlfq_on_tick,
+    .on_block = mlfq_on_block,
+    .on_wakeup = mlfq_on_wakeup,
+    .save_rq = mlfq_save_rq,
+    .restore_rq = rr_restore_rq,
+};
+
+// Lottery: each pick draws a ticket among the ready apps' tickets.
+// The run queue is a dense array, so removing is a swap with the last
+
+typedef struct {
+  int *app_ids;
+  int *index; // Position of each app_id in app_ids
+  int length;
+  uint64_t tickets; // Sum of the queued apps' tickets
+} lottery_rq_t;
+
+static void *lottery_create_rq(int max_id) {
+  lottery_rq_t *rq = (lottery_rq_t *)malloc(sizeof(lottery_rq_t));
+  int *app_ids = (int *)malloc(max_id * sizeof(int));
+  int *index = (int *)malloc(max_id * sizeof(int));
+  if (rq == NULL || app_ids == NULL || index == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  rq->app_ids = app_ids;
+  rq->index = index;
+  rq->length = 0;
+  rq->tickets = 0;
+
+  return rq;
+}
+
+static void lottery_free_rq(void *rq) {
+  free(((lottery_rq_t *)rq)->app_ids);
+  free(((lottery_rq_t *)rq)->index);
+  free(rq);
+}
+
+static void lottery_enqueue(void *rq, int app_id) {
+  lottery_rq_t *lottery = (lottery_rq_t *)rq;
+
+  lottery->index[app_id] = lottery->length;
+  lottery->app_ids[lottery->length++] = app_id;
+  lottery->tickets += weights[app_id];
+}
+
+static int lottery_pick_next(void *rq) {
+  lottery_rq_t *lottery = (lottery_rq_t *)rq;
+
+  if (lottery->length == 0)
+    return -1;
+
+  // Walk the queued apps until the drawn ticket
+  uint64_t draw = prng_below(&lottery_prng, lottery->tickets);
+  int pos = 0;
+  while (draw >= weights[lottery->app_ids[pos]]) {
+    draw -= weights[lottery->app_ids[pos]];
+    pos++;
+  }
+
+  int app_id = lottery->app_ids[pos];
+  int last_id = lottery->app_ids[--lottery->length];
+  lottery->app_ids[pos] = last_id;
+  lottery->index[last_id] = pos;
+  lottery->tickets -= weights[app_id];
+
+  return app_id;
+}
+
+static int lottery_length(const void *rq) {
+  return ((const lottery_rq_t *)rq)->length;
+}
+
+// Draws walk the array, so it's rebuilt in the same order
+static int lottery_save_rq(const void *rq, int *app_ids, uint64_t *key) {
+  const lottery_rq_t *lottery = (const lottery_rq_t *)rq;
+
+  for (int i = 0; i < lottery->length; i++) {
+    app_ids[i] = lottery->app_ids[i];
+  }
+  *key = 0;
+
+  return lottery->length;
+}
+
+static const sched_ops_t lottery_ops = {
+    .create_rq = lottery_create_rq,
+    .free_rq = lottery_free_rq,
+    .enqueue = lottery_enqueue,
+    .pick_next = lottery_pick_next,
+    .length = lottery_length,
+    .on_tick = rr_on_tick,
+    .on_block = rr_on_block,
+    .on_wakeup = rr_on_wakeup,
+    .save_rq = lottery_save_rq,
+    .restore_rq = rr_restore_rq,
+};
+
+// Ordered policies: a red-black tree keyed by each app's pass or vruntime,
+// and the key of the last picked app, which new wakeups start from
+
+typedef struct {
+  rb_tree_t tree;
+  uint64_t min_key;
+} ordered_rq_t;
+
+static void *ordered_create_rq(int max_id) {
+  ordered_rq_t *rq = (ordered_rq_t *)malloc(sizeof(ordered_rq_t));
+  if (rq == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  rb_init(&rq->tree, rb_nodes, max_id);
+  rq->min_key = 0;
+
+  return rq;
+}
+
+static void ordered_free_rq(void *rq) { free(rq); }
+
+static void ordered_enqueue(void *rq, int app_id) {
+  rb_insert(&((ordered_rq_t *)rq)->tree, app_id, keys[app_id]);
+}
+
+static int ordered_pick_next(void *rq) {
+  ordered_rq_t *ordered = (ordered_rq_t *)rq;
+  int app_id = rb_first(&ordered->tree);
+
+  if (app_id != -1) {
+    rb_remove(&ordered->tree, app_id);
+    if (keys[app_id] > ordered->min_key) {
+      ordered->min_key = keys[app_id];
+    }
+  }
+
+  return app_id;
+}
+
+static int ordered_length(const void *rq) {
+  return ((const ordered_rq_t *)rq)->tree.length;
+}
+
+// Any order rebuilds the tree, ties are broken by app_id
+static int ordered_save_rq(const void *rq, int *app_ids, uint64_t *key) {
+  const ordered_rq_t *ordered = (const ordered_rq_t *)rq;
+
+  *key = ordered->min_key;
+  return rb_items(&ordered->tree, app_ids);
+}
+
+static void ordered_restore_rq(void *rq, uint64_t key) {
+  ((ordered_rq_t *)rq)->min_key = key;
+}
+
+// Stride: an app's pass advances by its stride, inversely proportional to
+// its tickets, per timeslice it runs. The lowest pass runs next
+
+static void stride_charge(int app_id, uint64_t ran_ns) {
+  keys[app_id] += SCHED_STRIDE1 / weights[app_id] * ran_ns / TICK_NS;
+}
+
+static bool stride_on_tick(void *rq, int app_id, uint64_t ran_ns) {
+  stride_charge(app_id, ran_ns);
+  return true;
+}
+
+static void stride_on_block(int app_id, uint64_t ran_ns) {
+  stride_charge(app_id, ran_ns);
+}
+
+// A woken app can't have banked pass while blocked
+static void ordered_on_wakeup(void *rq, int app_id) {
+  uint64_t min_key = ((ordered_rq_t *)rq)->min_key;
+
+  if (keys[app_id] < min_key) {
+    keys[app_id] = min_key;
+  }
+}
+
+static const sched_ops_t stride_ops = {
+    .create_rq = ordered_create_rq,
+    .free_rq = ordered_free_rq,
+    .enqueue = ordered_enqueue,
+    .pick_next = ordered_pick_next,
+    .length = ordered_length,
+    .on_tick = stride_on_tick,
+    .on_block = stride_on_block,
+    .on_wakeup = ordered_on_wakeup,
+    .save_rq = ordered_save_rq,
+    .restore_rq = ordered_restore_rq,
+};
+
+// CFS-style: an app's vruntime advances by the time it runs, scaled by
+// its weight. The running app keeps the CPU until it's no longer the
+// lowest, and woken apps get half a timeslice of credit
+
+static void cfs_charge(int app_id, uint64_t ran_ns) {
+  keys[app_id] += ran_ns * SCHED_DEFAULT_WEIGHT / weights[app_id];
+}
+
+static bool cfs_on_tick(void *rq, int app_id, uint64_t ran_ns) {
+  int first = rb_first(&((ordered_rq_t *)rq)->tree);
+
+  cfs_charge(app_id, ran_ns);
+
+  return first != -1 && keys[first] < keys[app_id];
+}
+
+static void cfs_on_block(int app_id, uint64_t ran_ns) {
+  cfs_charge(app_id, ran_ns);
+}
+
+static void cfs_on_wakeup(void *rq, int app_id) {
+  uint64_t min_key = ((ordered_rq_t *)rq)->min_key;
+  uint64_t floor = min_key > TICK_NS / 2 ? min_key - TICK_NS / 2 : 0;
+
+  if (keys[app_id] < floor) {
+    keys[app_id] = floor;
+  }
+}
+
+static const sched_ops_t cfs_ops = {
+    .create_rq = ordered_create_rq,
+    .free_rq = ordered_free_rq,
+    .enqueue = ordered_enqueue,
+    .pick_next = ordered_pick_next,
+    .length = ordered_length,
+    .on_tick = cfs_on_tick,
+    .on_block = cfs_on_block,
+    .on_wakeup = cfs_on_wakeup,
+    .save_rq = ordered_save_rq,
+    .restore_rq = ordered_restore_rq,
+};
+
+// Ops tables indexed by sched_policy_t
+static const sched_ops_t *POLICY_OPS[] = {&rr_ops, &mlfq_ops, &lottery_ops,
+                                          &stride_ops, &cfs_ops};
+
+void sched_init(sched_policy_t policy, int apps, int cpu_amount,
+                unsigned int seed) {
+  ops = POLICY_OPS[policy];
+  app_amount = apps;
+  prng_seed(&lottery_prng, seed, PRNG_STREAM_LOTTERY);
+
+  stats = (sched_stats_t *)alloc_per_app(sizeof(sched_stats_t));
+  charged_ns = (uint64_t *)alloc_per_app(sizeof(uint64_t));
+  awaiting_response = (bool *)alloc_per_app(sizeof(bool));
+  weights = (uint64_t *)alloc_per_app(sizeof(uint64_t));
+  keys = (uint64_t *)alloc_per_app(sizeof(uint64_t));
+  mlfq_levels = (int *)alloc_per_app(sizeof(int));
+  mlfq_used_ticks = (int *)alloc_per_app(sizeof(int));
+  rb_nodes = rb_create_nodes(app_amount);
+  mlfq_boost_ns = get_time_ns();
+
+  for (int i = 0; i < app_amount; i++) {
+    weights[i] = SCHED_DEFAULT_WEIGHT;
+  }
+
+  rq_amount = cpu_amount;
+  rqs = (void **)malloc(cpu_amount * sizeof(void *));
+  if (rqs == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+  for (int i = 0; i < cpu_amount; i++) {
+    rqs[i] = ops->create_rq(app_amount);
+  }
+}
+
+void sched_free(void) {
+  for (int i = 0; i < rq_amount; i++) {
+    ops->free_rq(rqs[i]);
+  }
+
+  free(rqs);
+  free(stats);
+  free(charged_ns);
+  free(awaiting_response);
+  free(weights);
+  free(keys);
+  free(mlfq_levels);
+  free(mlfq_used_ticks);
+  free(rb_nodes);
+}
+
+// Marks an app ready at the current time, ending its wait on dispatch
+static void make_ready(int cpu_id, int app_id) {
+  charged_ns[app_id] = get_time_ns();
+  ops->enqueue(rqs[cpu_id], app_id);
+}
+
+// Charges a running app for the time since it was last charged
+static uint64_t charge_running(int app_id) {
+  uint64_t now = get_time_ns();
+  uint64_t ran_ns = now - charged_ns[app_id];
+
+  stats[app_id].run_ns += ran_ns;
+  charged_ns[app_id] = now;
+
+  return ran_ns;
+}
+
+void sched_add(int cpu_id, int app_id) {
+  stats[app_id].arrival_ns = get_time_ns();
+  awaiting_response[app_id] = true;
+  make_ready(cpu_id, app_id);
+}
+
+int sched_pick_next(int cpu_id) {
+  int app_id = ops->pick_next(rqs[cpu_id]);
+
+  if (app_id != -1) {
+    uint64_t now = get_time_ns();
+    uint64_t waited_ns = now - charged_ns[app_id];
+
+    stats[app_id].wait_ns += waited_ns;
+    stats[app_id].dispatches++;
+    if (awaiting_response[app_id]) {
+      awaiting_response[app_id] = false;
+      stats[app_id].response_sum_ns += waited_ns;
+      stats[app_id].responses++;
+    }
+    charged_ns[app_id] = now;
+  }
+
+  return app_id;
+}
+
+int sched_queue_length(int cpu_id) { return ops->length(rqs[cpu_id]); }
+
+bool sched_tick(int cpu_id, int app_id) {
+  return ops->on_tick(rqs[cpu_id], app_id, charge_running(app_id));
+}
+
+void sched_preempt(int cpu_id, int app_id) {
+  stats[app_id].preemptions++;
+  make_ready(cpu_id, app_id);
+}
+
+void sched_block(int app_id) {
+  stats[app_id].blocks++;
+  ops->on_block(app_id, charge_running(app_id));
+}
+
+void sched_wakeup(int cpu_id, int app_id) {
+  // Charged when it blocked
+  stats[app_id].blocked_ns += get_time_ns() - charged_ns[app_id];
+  awaiting_response[app_id] = true;
+  ops->on_wakeup(rqs[cpu_id], app_id);
+  make_ready(cpu_id, app_id);
+}
+
+void sched_finish(int app_id) {
+  charge_running(app_id);
+  stats[app_id].finish_ns = get_time_ns();
+}
+
+const sched_stats_t *sched_get_stats(int app_id) { return &stats[app_id]; }
+
+// Policy state that isn't per app
+typedef struct {
+  uint64_t mlfq_boost_ns;
+  prng_t lottery_prng;
+} sched_image_t;
+
+void sched_checkpoint(checkpoint_t *ckpt) {
+  sched_image_t image = {.mlfq_boost_ns = mlfq_boost_ns,
+                         .lottery_prng = lottery_prng};
+  int *queued = (int *)alloc_per_app(sizeof(int));
+  int *lengths = (int *)calloc(rq_amount, sizeof(int));
+  uint64_t *rq_keys = (uint64_t *)calloc(rq_amount, sizeof(uint64_t));
+  int amount = 0;
+
+  if (lengths == NULL || rq_keys == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  // An app is queued on at most one CPU, so app_amount ids fit them all
+  for (int cpu = 0; cpu < rq_amount; cpu++) {
+    lengths[cpu] = ops->save_rq(rqs[cpu], queued + amount, &rq_keys[cpu]);
+    amount += lengths[cpu];
+  }
+
+  checkpoint_write(ckpt, "sched", &image, sizeof(image));
+  checkpoint_write(ckpt, "sched.stats", stats, app_amount * sizeof(*stats));
+  checkpoint_write(ckpt, "sched.charged", charged_ns,
+                   app_amount * sizeof(*charged_ns));
+  checkpoint_write(ckpt, "sched.awaiting", awaiting_response,
+                   app_amount * sizeof(*awaiting_response));
+  checkpoint_write(ckpt, "sched.weights", weights,
+                   app_amount * sizeof(*weights));
+  checkpoint_write(ckpt, "sched.keys", keys, app_amount * sizeof(*keys));
+  checkpoint_write(ckpt, "sched.mlfq_levels", mlfq_levels,
+                   app_amount * sizeof(*mlfq_levels));
+  checkpoint_write(ckpt, "sched.mlfq_used", mlfq_used_ticks,
+                   app_amount * sizeof(*mlfq_used_ticks));
+  checkpoint_write(ckpt, "sched.rq_lengths", lengths, rq_amount * sizeof(int));
+  checkpoint_write(ckpt, "sched.rq_keys", rq_keys,
+                   rq_amount * sizeof(uint64_t));
+  checkpoint_write(ckpt, "sched.rq_apps", queued, amount * sizeof(int));
+
+  free(lengths);
+  free(queued);
+  free(rq_keys);
+}
+
+void sched_restore(const checkpoint_t *ckpt) {
+  sched_image_t image;
+  const int *lengths = (const int *)checkpoint_section(
+      ckpt, "sched.rq_lengths", rq_amount * sizeof(int));
+  const uint64_t *rq_keys = (const uint64_t *)checkpoint_section(
+      ckpt, "sched.rq_keys", rq_amount * sizeof(uint64_t));
+  int amount = 0;
+
+  checkpoint_read(ckpt, "sched", &image, sizeof(image));
+  mlfq_boost_ns = image.mlfq_boost_ns;
+  lottery_prng = image.lottery_prng;
+  checkpoint_read(ckpt, "sched.stats", stats, app_amount * sizeof(*stats));
+  checkpoint_read(ckpt, "sched.charged", charged_ns,
+                  app_amount * sizeof(*charged_ns));
+  checkpoint_read(ckpt, "sched.awaiting", awaiting_response,
+                  app_amount * sizeof(*awaiting_response));
+  checkpoint_read(ckpt, "sched.weights", weights,
+                  app_amount * sizeof(*weights));
+  checkpoint_read(ckpt, "sched.keys", keys, app_amount * sizeof(*keys));
+  checkpoint_read(ckpt, "sched.mlfq_levels", mlfq_levels,
+                  app_amount * sizeof(*mlfq_levels));
+  checkpoint_read(ckpt, "sched.mlfq_used", mlfq_used_ticks,
+                  app_amount * sizeof(*mlfq_used_ticks));
+
+  for (int cpu = 0; cpu < rq_amount; cpu++) {
+    if (lengths[cpu] < 0 || lengths[cpu] > app_amount - amount) {
+      fprintf(stderr, "Checkpoint version mismatch\n");
+      exit(22);
+    }
+    amount += lengths[cpu];
+  }
+
+  const int *queued = (const int *)checkpoint_section(ckpt, "sched.rq_apps",
+                                                      amount * sizeof(int));
+  for (int cpu = 0, i = 0; cpu < rq_amount; cpu++) {
+    for (int end = i + lengths[cpu]; i < end; i++) {
+      ops->enqueue(rqs[cpu], queued[i]);
+    }
+    ops->restore_rq(rqs[cpu], rq_keys[cpu]);
+  }
+}
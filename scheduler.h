@@ -0,0 +1,91 @@
+#pragma once
+
+#include "checkpoint.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Scheduler ops table, one per policy. Each CPU has its own run queue,
+// created by the policy, while per-app policy state is shared so apps
+// can be stolen by other CPUs. Times are in simulation nanoseconds
+typedef struct {
+  void *(*create_rq)(int max_id);
+  void (*free_rq)(void *rq);
+  // Adds a ready app to the run queue
+  void (*enqueue)(void *rq, int app_id);
+  // Removes and returns the app to run next, or -1 if the queue is empty
+  int (*pick_next)(void *rq);
+  // Amount of ready apps in the run queue
+  int (*length)(const void *rq);
+  // Charges the running app for a timeslice it ran ran_ns of.
+  // Returns whether it should give the CPU to a ready app
+  bool (*on_tick)(void *rq, int app_id, uint64_t ran_ns);
+  // Charges an app that blocked on a syscall after running ran_ns
+  void (*on_block)(int app_id, uint64_t ran_ns);
+  // Called before a blocked app is enqueued again
+  void (*on_wakeup)(void *rq, int app_id);
+  // Copies the queued app_ids, in an order enqueue rebuilds the queue
+  // from. Returns how many there are, and the rest of the queue's state
+  // in key
+  int (*save_rq)(const void *rq, int *app_ids, uint64_t *key);
+  // Sets the rest of the queue's state, after enqueueing its app_ids
+  void (*restore_rq)(void *rq, uint64_t key);
+} sched_ops_t;
+
+// Per-app accounting, the same for every policy
+typedef struct {
+  uint64_t arrival_ns;      // When it was first enqueued
+  uint64_t finish_ns;       // When it finished, 0 while it hasn't
+  uint64_t run_ns;          // Total time running
+  uint64_t wait_ns;         // Total time ready but not running
+  uint64_t blocked_ns;      // Total time blocked on a syscall
+  uint64_t response_sum_ns; // Sum of arrival/wakeup to next dispatch times
+  uint32_t responses;       // Amount of response times summed
+  uint32_t dispatches;      // Times it was picked to run
+  uint32_t preemptions;     // Times it gave up the CPU at a timeslice end
+  uint32_t blocks;          // Times it blocked on a syscall
+} sched_stats_t;
+
+// Selects the policy and creates a run queue for each CPU. The seed is
+// used by randomized policies
+void sched_init(sched_policy_t policy, int app_amount, int cpu_amount,
+                unsigned int seed);
+
+// Frees every run queue and the per-app state
+void sched_free(void);
+
+// Enqueues a new app on a CPU
+void sched_add(int cpu_id, int app_id);
+
+// Removes the next app to run from a CPU's run queue and accounts its
+// dispatch. Returns -1 if the queue is empty
+int sched_pick_next(int cpu_id);
+
+// Amount of ready apps in a CPU's run queue
+int sched_queue_length(int cpu_id);
+
+// Charges the app running on a CPU at a timeslice end.
+// Returns whether it should be preempted if another app is ready
+bool sched_tick(int cpu_id, int app_id);
+
+// Enqueues an app that was preempted at a timeslice end
+void sched_preempt(int cpu_id, int app_id);
+
+// Accounts a running app that blocked on a syscall
+void sched_block(int app_id);
+
+// Enqueues a blocked app again on a CPU
+void sched_wakeup(int cpu_id, int app_id);
+
+// Accounts a running app that finished
+void sched_finish(int app_id);
+
+// Accounting of an app
+const sched_stats_t *sched_get_stats(int app_id);
+
+// Writes every run queue and the per-app policy state to a checkpoint
+void sched_checkpoint(checkpoint_t *ckpt);
+
+// Restores the state written by sched_checkpoint, right after sched_init
+// with the same policy and before any app is added
+void sched_restore(const checkpoint_t *ckpt);
@@ -0,0 +1,149 @@
+#include "stats.h"
+#include "cfg.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Offsets of the CPUs and apps, each app on its own cache lines
+static size_t cpu_offset(void) { return sizeof(stats_shm_t); }
+
+static size_t app_offset(int cpu_amount) {
+  size_t offset = cpu_offset() + cpu_amount * sizeof(stats_cpu_t);
+
+  return (offset + _Alignof(stats_app_t) - 1) & ~(_Alignof(stats_app_t) - 1);
+}
+
+stats_shm_t *stats_create(const char *name, int app_amount, int cpu_amount,
+                          const char *policy, bool virtual_time) {
+  size_t size = app_offset(cpu_amount) + app_amount * sizeof(stats_app_t);
+
+  shm_unlink(name); // remove any existing segment
+  // Readable by kernelstat, only the kernel writes
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd == -1 || ftruncate(fd, size) == -1) {
+    fprintf(stderr, "Shm alloc error\n");
+    exit(3);
+  }
+
+  // Pages come zeroed from ftruncate
+  stats_shm_t *stats = (stats_shm_t *)mmap(
+      NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (stats == MAP_FAILED) {
+    fprintf(stderr, "Shm map error\n");
+    exit(3);
+  }
+
+  stats->kernel_pid = getpid();
+  stats->app_amount = app_amount;
+  stats->cpu_amount = cpu_amount;
+  stats->virtual_time = virtual_time;
+  snprintf(stats->policy, sizeof(stats->policy), "%s", policy);
+  stats->cpu_offset = cpu_offset();
+  stats->app_offset = app_offset(cpu_amount);
+  stats->size = size;
+  atomic_init(&stats->seq, 0);
+  for (int i = 0; i < app_amount; i++) {
+    atomic_init(&stats_apps(stats)[i].seq, 0);
+  }
+  stats->version = STATS_VERSION;
+  // Written last, readers ignore the segment until it's set
+  atomic_thread_fence(memory_order_release);
+  stats->magic = STATS_MAGIC;
+
+  return stats;
+}
+
+stats_shm_t *stats_attach(const char *name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  struct stat st;
+  if (fd == -1)
+    return NULL;
+  if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(stats_shm_t)) {
+    close(fd);
+    return NULL;
+  }
+
+  stats_shm_t *stats =
+      (stats_shm_t *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (stats == MAP_FAILED) {
+    fprintf(stderr, "Shm map error\n");
+    exit(3);
+  }
+
+  // The kernel sets the magic last, so a zero one is a segment still
+  // being set up rather than a foreign one
+  const struct timespec interval = {.tv_sec = 0, .tv_nsec = 1000000L};
+  const volatile uint32_t *magic = &stats->magic;
+  int waited_ms = 0;
+  while (*magic == 0 && waited_ms++ < KERNELSTAT_ATTACH_WAIT_MS) {
+    nanosleep(&interval, NULL);
+  }
+  if (*magic == 0) {
+    munmap(stats, st.st_size);
+    return NULL;
+  }
+  atomic_thread_fence(memory_order_acquire);
+
+  if (stats->magic != STATS_MAGIC || stats->version != STATS_VERSION ||
+      stats->size != (uint64_t)st.st_size) {
+    fprintf(stderr, "Shm version mismatch\n");
+    exit(3);
+  }
+
+  return stats;
+}
+
+void stats_detach(stats_shm_t *stats) { munmap(stats, stats->size); }
+
+void stats_destroy(stats_shm_t *stats, const char *name) {
+  stats_detach(stats);
+  shm_unlink(name);
+}
+
+// Reader side of a seqlock: copies size bytes from src until no write
+// began or ended during the copy. The copy may race with the writer, but
+// a torn copy is always thrown away
+static void seqlock_read(const _Atomic uint32_t *seq, void *dst,
+                         const void *src, size_t size) {
+  uint32_t begin, end;
+
+  do {
+    while ((begin = atomic_load_explicit(seq, memory_order_acquire)) & 1) {
+      sched_yield();
+    }
+    memcpy(dst, src, size);
+    atomic_thread_fence(memory_order_acquire);
+    end = atomic_load_explicit(seq, memory_order_relaxed);
+  } while (begin != end);
+}
+
+void stats_read_app(const stats_shm_t *stats, int app_id, stats_app_t *out) {
+  const stats_app_t *app = &stats_apps(stats)[app_id];
+
+  seqlock_read(&app->seq, out, app, sizeof(stats_app_t));
+}
+
+void stats_read_kernel(const stats_shm_t *stats, stats_kernel_t *kernel,
+                       stats_cpu_t *cpus) {
+  uint32_t begin, end;
+
+  // Both parts share the header's seqlock
+  do {
+    while ((begin = atomic_load_explicit(&stats->seq, memory_order_acquire)) &
+           1) {
+      sched_yield();
+    }
+    memcpy(kernel, &stats->kernel, sizeof(stats_kernel_t));
+    memcpy(cpus, stats_cpus(stats), stats->cpu_amount * sizeof(stats_cpu_t));
+    atomic_thread_fence(memory_order_acquire);
+    end = atomic_load_explicit(&stats->seq, memory_order_relaxed);
+  } while (begin != end);
+}
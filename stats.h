@@ -0,0 +1,121 @@
+#pragma once
+
+#include "types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Live stats segment, published by kernelsim and read by kernelstat
+// without pausing or signaling anything. The kernel is the only writer,
+// and each part of the segment is guarded by its own seqlock, so readers
+// retry instead of blocking it and a busy app never starves the others
+
+#define STATS_MAGIC 0x54415453 // "STAT"
+#define STATS_VERSION 2
+
+// Counters of an app
+typedef struct {
+  _Alignas(64) _Atomic uint32_t seq; // Seqlock, odd while being written
+  int32_t state;                     // proc_state_t
+  int32_t cpu_id;                    // CPU it runs or last ran on
+  int32_t D1_access_count;
+  int32_t D2_access_count;
+  int32_t read_count;
+  int32_t write_count;
+  int32_t exec_count;
+  uint32_t switches;       // Times it was dispatched
+  uint32_t preemptions;    // Times it was paused at a timeslice end
+  uint32_t blocks;         // Times it blocked on a syscall
+  uint64_t run_ns;         // Time running, up to updated_ns while running
+  uint64_t wait_ns;        // Time ready, up to its last dispatch
+  uint64_t blocked_ns;     // Time blocked, up to its last wakeup
+  uint64_t mem_accesses;   // Memory accesses, 0 without the vm model
+  uint64_t tlb_hits;       // Of them, translated by the TLB
+  uint64_t page_faults;
+  uint64_t state_since_ns; // When it entered its current state
+  uint64_t updated_ns;     // When the kernel last wrote the counters
+} stats_app_t;
+
+// Counters of a simulated CPU
+typedef struct {
+  int32_t running_app_id; // App running on it, or -1
+  uint64_t busy_ticks;
+  uint64_t idle_ticks;
+  uint64_t steals;
+  uint64_t migrations;
+} stats_cpu_t;
+
+// Kernel-wide counters
+typedef struct {
+  uint64_t start_ns;                   // Simulation time it started running
+  uint64_t now_ns;                     // Simulation time of the last update
+  int32_t state_counts[FINISHED + 1];  // Apps in each proc_state_t
+  int32_t paused;                      // Whether the kernel is paused
+  int32_t finished;                    // Whether the kernel left its loop
+  uint64_t time_irqs;                  // IRQ_TIME handled
+  uint64_t device_irqs;                // IRQ_D1/IRQ_D2 handled
+  uint64_t syscalls;                   // Syscall requests handled
+} stats_kernel_t;
+
+// Header at the start of the segment, followed by cpu_amount stats_cpu_t
+// and app_amount stats_app_t. Everything but the seqlocked parts is set
+// once, before the first reader can attach
+typedef struct {
+  uint32_t magic;       // STATS_MAGIC
+  uint32_t version;     // STATS_VERSION
+  int32_t kernel_pid;   // Pid of the kernelsim publishing it
+  int32_t app_amount;   // Amount of stats_app_t
+  int32_t cpu_amount;   // Amount of stats_cpu_t
+  int32_t virtual_time; // Whether times are virtual
+  char policy[16];      // Name of the scheduling policy
+  uint64_t cpu_offset;  // Offset of the CPUs from the start
+  uint64_t app_offset;  // Offset of the apps from the start
+  uint64_t size;        // Total mapped size in bytes
+  _Alignas(64) _Atomic uint32_t seq; // Seqlock of the kernel and CPUs
+  stats_kernel_t kernel;
+} stats_shm_t;
+
+// Creates and maps the stats segment, with every counter zeroed. Kernel only
+stats_shm_t *stats_create(const char *name, int app_amount, int cpu_amount,
+                          const char *policy, bool virtual_time);
+
+// Maps an existing stats segment read-only and validates its header.
+// Returns NULL if it doesn't exist, or kernelsim doesn't finish setting it
+// up within KERNELSTAT_ATTACH_WAIT_MS
+stats_shm_t *stats_attach(const char *name);
+
+// Unmaps the stats segment
+void stats_detach(stats_shm_t *stats);
+
+// Unmaps and removes the stats segment. Kernel only
+void stats_destroy(stats_shm_t *stats, const char *name);
+
+// CPUs and apps placed after the header
+static inline stats_cpu_t *stats_cpus(const stats_shm_t *stats) {
+  return (stats_cpu_t *)((char *)stats + stats->cpu_offset);
+}
+static inline stats_app_t *stats_apps(const stats_shm_t *stats) {
+  return (stats_app_t *)((char *)stats + stats->app_offset);
+}
+
+// Writer side of a seqlock: the sequence is odd between begin and end
+static inline void stats_write_begin(_Atomic uint32_t *seq) {
+  atomic_store_explicit(
+      seq, atomic_load_explicit(seq, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+static inline void stats_write_end(_Atomic uint32_t *seq) {
+  atomic_store_explicit(
+      seq, atomic_load_explicit(seq, memory_order_relaxed) + 1,
+      memory_order_release);
+}
+
+// Copies an app's counters, retrying while the kernel writes them
+void stats_read_app(const stats_shm_t *stats, int app_id, stats_app_t *out);
+
+// Copies the kernel counters and every CPU, retrying while the kernel
+// writes them. cpus must hold cpu_amount entries
+void stats_read_kernel(const stats_shm_t *stats, stats_kernel_t *kernel,
+                       stats_cpu_t *cpus);
@@ -0,0 +1,348 @@
+#include "config.h"
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Parameter sweep driver: runs kernelsim on every point of a cartesian grid
+// of configurations, each with a few seeds, and writes one CSV row per run
+// with its metrics. Axes are configuration keys or kernelsim options, given
+// as key=v1,v2,... and the last axis varies fastest
+
+// Max axes of a grid
+#define SWEEP_MAX_AXES 16
+// Max length of a CSV row
+#define SWEEP_MAX_ROW 1024
+
+// Passed to children, which inherit our environment
+extern char **environ;
+
+// Axes that select a kernelsim option instead of a configuration key
+static const struct {
+  const char *name;
+  const char *flag;
+} OPTION_AXES[] = {
+    {"policy", "-p"}, {"engine", "-e"}, {"switch", "-s"}, {"devices", "-d"}};
+
+// Metrics written by kernelsim -m, in CSV column order
+static const char *METRICS[] = {
+    "finished_apps", "elapsed_s",   "throughput", "turnaround_ms",
+    "response_ms",   "wait_ms",     "dispatches", "preemptions",
+    "blocks",        "time_irqs",   "device_irqs", "syscalls",
+    "cpu_busy_pct",  "context_kb_per_switch", "context_us_per_switch",
+    "page_faults",   "fault_rate_pct", "tlb_hit_pct", "checksum"};
+
+#define METRIC_AMOUNT (int)(sizeof(METRICS) / sizeof(METRICS[0]))
+
+// A dimension of the grid
+typedef struct {
+  const char *name;
+  const char *flag; // kernelsim option, or NULL for a configuration key
+  char *values[64];
+  int amount;
+} axis_t;
+
+// A kernelsim run in progress
+typedef struct {
+  pid_t pid; // 0 while the slot is free
+  int index;
+  char metrics_path[64];
+} job_t;
+
+static axis_t axes[SWEEP_MAX_AXES];
+static int axis_amount = 0;
+// kernelsim options given after --, passed to every run
+static char **extra_args;
+static int extra_amount = 0;
+static int repeats = 1;
+static unsigned int base_seed = 1;
+// Rows of finished runs, printed in grid order
+static char **rows;
+static int next_row = 0;
+
+static void print_usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-r repeats] [-j jobs] [-S seed] [-o csv_file] "
+          "key=value,... [key=value,...] [-- kernelsim options]\n"
+          "Keys are configuration keys, or policy, engine, switch and "
+          "devices\n",
+          prog);
+}
+
+// Parses an axis, modifying spec in place. Returns false if invalid
+static bool parse_axis(char *spec, axis_t *axis) {
+  char *equals = strchr(spec, '=');
+  char *save, *value;
+
+  if (equals == NULL)
+    return false;
+  *equals = '\0';
+  axis->name = spec;
+  axis->flag = NULL;
+  for (size_t i = 0; i < sizeof(OPTION_AXES) / sizeof(OPTION_AXES[0]); i++) {
+    if (strcmp(spec, OPTION_AXES[i].name) == 0) {
+      axis->flag = OPTION_AXES[i].flag;
+    }
+  }
+  if (axis->flag == NULL && !config_has_key(spec))
+    return false;
+
+  axis->amount = 0;
+  for (value = strtok_r(equals + 1, ",", &save); value != NULL;
+       value = strtok_r(NULL, ",", &save)) {
+    // Configuration values are checked now rather than failing every run
+    if (axis->amount == 64 ||
+        (axis->flag == NULL && !config_set(axis->name, value)))
+      return false;
+    axis->values[axis->amount++] = value;
+  }
+
+  return axis->amount > 0;
+}
+
+// The value of each axis and the seed of a run
+static void decode_run(int index, int *value_ids, unsigned int *seed) {
+  *seed = base_seed + index % repeats;
+  index /= repeats;
+
+  for (int a = axis_amount - 1; a >= 0; a--) {
+    value_ids[a] = index % axes[a].amount;
+    index /= axes[a].amount;
+  }
+}
+
+// Spawns kernelsim for a run, with its output discarded
+static pid_t spawn_run(int index, job_t *job) {
+  int value_ids[SWEEP_MAX_AXES];
+  char pairs[SWEEP_MAX_AXES][128];
+  char seed_str[12];
+  char *argv[extra_amount + axis_amount * 2 + 6];
+  int argc = 0;
+  unsigned int seed;
+  pid_t pid;
+
+  decode_run(index, value_ids, &seed);
+  snprintf(job->metrics_path, sizeof(job->metrics_path),
+           "/tmp/sweepsim_%d_%d", getpid(), index);
+  sprintf(seed_str, "%u", seed);
+
+  argv[argc++] = "./kernelsim";
+  for (int i = 0; i < extra_amount; i++) {
+    argv[argc++] = extra_args[i];
+  }
+  for (int a = 0; a < axis_amount; a++) {
+    const char *value = axes[a].values[value_ids[a]];
+
+    if (axes[a].flag != NULL) {
+      argv[argc++] = (char *)axes[a].flag;
+      argv[argc++] = (char *)value;
+    } else {
+      snprintf(pairs[a], sizeof(pairs[a]), "%s=%s", axes[a].name, value);
+      argv[argc++] = "-o";
+      argv[argc++] = pairs[a];
+    }
+  }
+  argv[argc++] = "-S";
+  argv[argc++] = seed_str;
+  argv[argc++] = "-m";
+  argv[argc++] = job->metrics_path;
+  argv[argc] = NULL;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                   O_WRONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+  int error = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+
+  return error == 0 ? pid : -1;
+}
+
+// Builds the CSV row of a finished run from its metrics file
+static char *format_row(int index, const char *metrics_path, int exit_code) {
+  char values[METRIC_AMOUNT][64] = {{0}};
+  char line[128];
+  int value_ids[SWEEP_MAX_AXES];
+  unsigned int seed;
+  char *row = (char *)malloc(SWEEP_MAX_ROW);
+  size_t length = 0;
+  FILE *file = fopen(metrics_path, "r");
+
+  if (row == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+    char *equals = strchr(line, '=');
+
+    if (equals == NULL)
+      continue;
+    *equals = '\0';
+    equals[strcspn(equals + 1, "\n") + 1] = '\0';
+    for (int m = 0; m < METRIC_AMOUNT; m++) {
+      if (strcmp(line, METRICS[m]) == 0) {
+        snprintf(values[m], sizeof(values[m]), "%s", equals + 1);
+      }
+    }
+  }
+  if (file != NULL) {
+    fclose(file);
+  }
+
+  decode_run(index, value_ids, &seed);
+  for (int a = 0; a < axis_amount; a++) {
+    length += snprintf(row + length, SWEEP_MAX_ROW - length, "%s,",
+                       axes[a].values[value_ids[a]]);
+  }
+  length += snprintf(row + length, SWEEP_MAX_ROW - length, "%u,%d", seed,
+                     exit_code);
+  for (int m = 0; m < METRIC_AMOUNT && length < SWEEP_MAX_ROW; m++) {
+    length += snprintf(row + length, SWEEP_MAX_ROW - length, ",%s", values[m]);
+  }
+
+  return row;
+}
+
+// Prints the rows that are next in grid order
+static void flush_rows(FILE *out, int run_amount) {
+  while (next_row < run_amount && rows[next_row] != NULL) {
+    fprintf(out, "%s\n", rows[next_row]);
+    free(rows[next_row]);
+    next_row++;
+  }
+  fflush(out);
+}
+
+int main(int argc, char **argv) {
+  const char *out_path = NULL;
+  int job_amount = 1;
+  int opt;
+
+  // Stop at the first axis, so kernelsim options come after --
+  while ((opt = getopt(argc, argv, "+r:j:S:o:")) != -1) {
+    switch (opt) {
+    case 'r':
+      repeats = atoi(optarg);
+      break;
+    case 'j':
+      job_amount = atoi(optarg);
+      break;
+    case 'S':
+      if (!config_parse_seed(optarg, &base_seed)) {
+        print_usage(argv[0]);
+        exit(16);
+      }
+      break;
+    case 'o':
+      out_path = optarg;
+      break;
+    default:
+      print_usage(argv[0]);
+      exit(16);
+    }
+  }
+
+  // getopt already skipped a -- right after the options
+  bool axes_done = optind > 1 && strcmp(argv[optind - 1], "--") == 0;
+  for (int i = optind; i < argc; i++) {
+    if (axes_done || strcmp(argv[i], "--") == 0) {
+      extra_args = &argv[axes_done ? i : i + 1];
+      extra_amount = argc - (axes_done ? i : i + 1);
+      break;
+    }
+    if (axis_amount == SWEEP_MAX_AXES ||
+        !parse_axis(argv[i], &axes[axis_amount++])) {
+      print_usage(argv[0]);
+      exit(16);
+    }
+  }
+  if (repeats <= 0 || job_amount <= 0) {
+    print_usage(argv[0]);
+    exit(16);
+  }
+
+  int run_amount = repeats;
+  for (int a = 0; a < axis_amount; a++) {
+    run_amount *= axes[a].amount;
+  }
+
+  FILE *out = out_path != NULL ? fopen(out_path, "w") : stdout;
+  rows = (char **)calloc(run_amount, sizeof(char *));
+  job_t *jobs = (job_t *)calloc(job_amount, sizeof(job_t));
+  if (out == NULL) {
+    fprintf(stderr, "Metrics file error\n");
+    exit(21);
+  }
+  if (rows == NULL || jobs == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  // Runs are quiet unless asked otherwise
+  setenv("KERNELSIM_LOG_LEVEL", "error", 0);
+
+  for (int a = 0; a < axis_amount; a++) {
+    fprintf(out, "%s,", axes[a].name);
+  }
+  fprintf(out, "seed,exit_code");
+  for (int m = 0; m < METRIC_AMOUNT; m++) {
+    fprintf(out, ",%s", METRICS[m]);
+  }
+  fprintf(out, "\n");
+
+  // Keep up to job_amount runs going, handling whichever finishes first
+  int started = 0, running = 0, done = 0;
+  while (done < run_amount) {
+    while (running < job_amount && started < run_amount) {
+      job_t *job = &jobs[0];
+
+      while (job->pid != 0) {
+        job++;
+      }
+      job->index = started;
+      job->pid = spawn_run(started, job);
+      if (job->pid < 0) {
+        fprintf(stderr, "Fork error\n");
+        exit(2);
+      }
+      started++;
+      running++;
+    }
+
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0)
+      continue;
+
+    for (int j = 0; j < job_amount; j++) {
+      if (jobs[j].pid != pid)
+        continue;
+
+      int exit_code = WIFEXITED(status) ? WEXITSTATUS(status)
+                                        : 128 + WTERMSIG(status);
+      rows[jobs[j].index] =
+          format_row(jobs[j].index, jobs[j].metrics_path, exit_code);
+      unlink(jobs[j].metrics_path);
+      jobs[j].pid = 0;
+      running--;
+      done++;
+      fprintf(stderr, "Run %d/%d finished with exit code %d\n", done,
+              run_amount, exit_code);
+    }
+
+    flush_rows(out, run_amount);
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  free(rows);
+  free(jobs);
+
+  return 0;
+}
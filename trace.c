@@ -0,0 +1,103 @@
+#include "trace.h"
+#include "config.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+trace_t *trace_open(const char *path, uint32_t capacity, int app_amount,
+                    int cpu_amount, uint64_t start_ns) {
+  trace_t *trace = (trace_t *)malloc(sizeof(trace_t));
+  if (trace == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  trace->size =
+      sizeof(trace_header_t) + (size_t)capacity * sizeof(trace_event_t);
+  trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (trace->fd == -1 || ftruncate(trace->fd, trace->size) == -1) {
+    fprintf(stderr, "Trace file error\n");
+    exit(17);
+  }
+
+  // Pages come zeroed from ftruncate and are only written back as needed
+  trace->header = (trace_header_t *)mmap(NULL, trace->size,
+                                         PROT_READ | PROT_WRITE, MAP_SHARED,
+                                         trace->fd, 0);
+  if (trace->header == MAP_FAILED) {
+    fprintf(stderr, "Trace mmap error\n");
+    exit(17);
+  }
+
+  trace->header->magic = TRACE_MAGIC;
+  trace->header->version = TRACE_VERSION;
+  trace->header->event_size = sizeof(trace_event_t);
+  trace->header->app_amount = app_amount;
+  trace->header->cpu_amount = cpu_amount;
+  trace->header->capacity = capacity;
+  trace->header->start_ns = start_ns;
+
+  return trace;
+}
+
+trace_t *trace_load(const char *path) {
+  trace_t *trace = (trace_t *)malloc(sizeof(trace_t));
+  if (trace == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  struct stat st;
+  trace->fd = open(path, O_RDONLY);
+  if (trace->fd == -1 || fstat(trace->fd, &st) == -1 ||
+      (size_t)st.st_size < sizeof(trace_header_t)) {
+    fprintf(stderr, "Trace file error\n");
+    exit(17);
+  }
+
+  trace->size = st.st_size;
+  trace->header = (trace_header_t *)mmap(NULL, trace->size, PROT_READ,
+                                         MAP_PRIVATE, trace->fd, 0);
+  if (trace->header == MAP_FAILED) {
+    fprintf(stderr, "Trace mmap error\n");
+    exit(17);
+  }
+
+  trace_header_t *header = trace->header;
+  if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION ||
+      header->event_size != sizeof(trace_event_t)) {
+    fprintf(stderr, "Trace version mismatch\n");
+    exit(17);
+  }
+
+  // Sizes come from the file, bound them before anyone allocates by them
+  if (header->app_amount < 1 || header->app_amount > APP_AMOUNT_MAX ||
+      header->cpu_amount < 1 || header->cpu_amount > CPU_AMOUNT_MAX ||
+      header->count > (trace->size - sizeof(trace_header_t)) /
+                          sizeof(trace_event_t)) {
+    fprintf(stderr, "Trace file error\n");
+    exit(17);
+  }
+
+  return trace;
+}
+
+void trace_close(trace_t *trace) {
+  bool writable = (fcntl(trace->fd, F_GETFL) & O_ACCMODE) == O_RDWR;
+  size_t used = sizeof(trace_header_t) +
+                trace->header->count * sizeof(trace_event_t);
+
+  munmap(trace->header, trace->size);
+
+  // Drop the unused tail of the preallocated file
+  if (writable && ftruncate(trace->fd, used) == -1) {
+    fprintf(stderr, "Trace file error\n");
+  }
+
+  close(trace->fd);
+  free(trace);
+}
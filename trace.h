@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x43525453 // "STRC"
+#define TRACE_VERSION 2
+
+// Kinds of trace events
+typedef enum {
+  TRACE_APP_STATE, // App moved to a new proc_state_t
+  TRACE_IRQ        // Kernel handled an interrupt from intersim
+} trace_type_t;
+
+// Fixed-size binary trace event, appended to the trace file
+typedef struct {
+  uint64_t timestamp_ns; // Simulation time of the event, may be virtual
+  int32_t cpu_id;        // CPU of the app, or target CPU of an IRQ_TIME
+  int32_t app_id;        // App changing state, -1 for IRQs
+  uint8_t type;          // trace_type_t
+  uint8_t value;         // New proc_state_t, or the irq_t
+  int16_t device;        // Device a blocked app waits on (1 or 2), else 0
+  uint32_t reserved;     // Padding, always 0
+} trace_event_t;
+
+_Static_assert(sizeof(trace_event_t) == 24, "trace_event_t must be 24 bytes");
+
+// Header at the start of the trace file, followed by the events
+typedef struct {
+  uint32_t magic;      // TRACE_MAGIC
+  uint32_t version;    // TRACE_VERSION
+  uint32_t event_size; // sizeof(trace_event_t)
+  int32_t app_amount;  // Apps in the run
+  int32_t cpu_amount;  // CPUs in the run
+  uint32_t capacity;   // Max events in the file
+  uint64_t start_ns;   // Time the trace was opened, all apps paused
+  uint64_t count;      // Events written so far
+  uint64_t dropped;    // Events lost because the file was full
+  trace_event_t events[];
+} trace_header_t;
+
+// Memory-mapped trace file
+typedef struct {
+  trace_header_t *header;
+  int fd;
+  size_t size;
+} trace_t;
+
+// Creates a trace file able to hold capacity events and maps it, starting
+// at the given simulation time
+trace_t *trace_open(const char *path, uint32_t capacity, int app_amount,
+                    int cpu_amount, uint64_t start_ns);
+
+// Maps an existing trace file read-only and validates its header
+trace_t *trace_load(const char *path);
+
+// Unmaps the trace file. A writable file is truncated to its events
+void trace_close(trace_t *trace);
+
+// Appends an event at the given time, or counts it as dropped if the file
+// is full
+static inline void trace_record(trace_t *trace, uint64_t timestamp_ns,
+                                trace_type_t type, int value, int cpu_id,
+                                int app_id, int device) {
+  trace_header_t *header = trace->header;
+
+  if (header->count >= header->capacity) {
+    header->dropped++;
+    return;
+  }
+
+  trace_event_t *event = &header->events[header->count];
+
+  event->timestamp_ns = timestamp_ns;
+  event->type = type;
+  event->value = value;
+  event->cpu_id = cpu_id;
+  event->app_id = app_id;
+  event->device = device;
+  header->count++;
+}
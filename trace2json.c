@@ -0,0 +1,189 @@
+#include "trace.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Chrome trace process ids grouping the tracks
+#define TRACK_APPS 1
+#define TRACK_DEVICES 2
+#define TRACK_CPUS 3
+
+// Whether an event was already printed, to place the commas
+static bool first_event = true;
+
+// Trace time in microseconds since the trace was opened
+static double to_us(const trace_header_t *header, uint64_t timestamp_ns) {
+  return (double)(timestamp_ns - header->start_ns) / 1000.0;
+}
+
+static void begin_event(void) {
+  printf(first_event ? "\n  " : ",\n  ");
+  first_event = false;
+}
+
+// Names a process or thread track
+static void print_track_name(const char *kind, int pid, int tid,
+                             const char *name, int number) {
+  begin_event();
+  printf("{\"ph\": \"M\", \"name\": \"%s\", \"pid\": %d, \"tid\": %d, "
+         "\"args\": {\"name\": \"%s",
+         kind, pid, tid, name);
+  if (number >= 0) {
+    printf(" %d", number);
+  }
+  printf("\"}}");
+}
+
+// Prints the interval an app spent in a state on its track
+static void print_app_interval(int app_id, proc_state_t state, int cpu_id,
+                               int device, double begin_us, double end_us) {
+  begin_event();
+  printf("{\"ph\": \"X\", \"name\": \"%s\", \"pid\": %d, \"tid\": %d, "
+         "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"cpu\": %d",
+         PROC_STATE_STR[state], TRACK_APPS, app_id + 1, begin_us,
+         end_us - begin_us, cpu_id);
+  if (state == BLOCKED) {
+    printf(", \"device\": \"D%d\"", device);
+  }
+  printf("}}");
+}
+
+// Whether an event only holds values trace_record can write, so it's safe
+// to index the per-app and per-device tables with it
+static bool valid_event(const trace_header_t *header,
+                        const trace_event_t *event) {
+  if (event->type == TRACE_IRQ) {
+    if (event->value == IRQ_TIME)
+      return event->cpu_id >= 0 && event->cpu_id < header->cpu_amount;
+    return event->value == IRQ_D1 || event->value == IRQ_D2;
+  }
+
+  return event->type == TRACE_APP_STATE && event->app_id >= 0 &&
+         event->app_id < header->app_amount && event->value <= FINISHED &&
+         event->device >= 0 && event->device < 3;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s trace_file > trace.json\n", argv[0]);
+    exit(16);
+  }
+
+  trace_t *trace = trace_load(argv[1]);
+  trace_header_t *header = trace->header;
+  int app_amount = header->app_amount;
+
+  // Current state of each app and when it began, all start paused
+  proc_state_t *states =
+      (proc_state_t *)malloc(app_amount * sizeof(proc_state_t));
+  double *since_us = (double *)calloc(app_amount, sizeof(double));
+  int *app_cpus = (int *)calloc(app_amount, sizeof(int));
+  int *app_devices = (int *)calloc(app_amount, sizeof(int));
+  if (states == NULL || since_us == NULL || app_cpus == NULL ||
+      app_devices == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+  for (int i = 0; i < app_amount; i++) {
+    states[i] = PAUSED;
+  }
+  // Apps waiting on each device, index 0 unused
+  int device_queue[3] = {0, 0, 0};
+
+  printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+  print_track_name("process_name", TRACK_APPS, 0, "Apps", -1);
+  print_track_name("process_name", TRACK_DEVICES, 0, "Devices", -1);
+  print_track_name("process_name", TRACK_CPUS, 0, "CPUs", -1);
+  for (int i = 0; i < app_amount; i++) {
+    print_track_name("thread_name", TRACK_APPS, i + 1, "App", i + 1);
+  }
+  print_track_name("thread_name", TRACK_DEVICES, IRQ_D1, "D1", -1);
+  print_track_name("thread_name", TRACK_DEVICES, IRQ_D2, "D2", -1);
+  for (int i = 0; i < header->cpu_amount; i++) {
+    print_track_name("thread_name", TRACK_CPUS, i, "CPU", i);
+  }
+
+  double last_us = 0;
+  uint64_t invalid = 0;
+  for (uint64_t i = 0; i < header->count; i++) {
+    const trace_event_t *event = &header->events[i];
+    if (!valid_event(header, event)) {
+      invalid++;
+      continue;
+    }
+
+    double now_us = to_us(header, event->timestamp_ns);
+    last_us = now_us;
+
+    if (event->type == TRACE_IRQ) {
+      // Instant on the device or CPU track that got the interrupt
+      begin_event();
+      if (event->value == IRQ_TIME) {
+        printf("{\"ph\": \"i\", \"s\": \"t\", \"name\": \"IRQ_TIME\", "
+               "\"pid\": %d, \"tid\": %d, \"ts\": %.3f}",
+               TRACK_CPUS, event->cpu_id, now_us);
+      } else {
+        printf("{\"ph\": \"i\", \"s\": \"t\", \"name\": \"IRQ_D%d\", "
+               "\"pid\": %d, \"tid\": %d, \"ts\": %.3f}",
+               event->value, TRACK_DEVICES, event->value, now_us);
+      }
+      continue;
+    }
+
+    int app_id = event->app_id;
+
+    // Close the interval of the previous state
+    print_app_interval(app_id, states[app_id], app_cpus[app_id],
+                       app_devices[app_id], since_us[app_id], now_us);
+
+    // Device queue lengths as counter tracks
+    int device = 0;
+    if (states[app_id] == BLOCKED) {
+      device = app_devices[app_id];
+      device_queue[device]--;
+    }
+    if (event->value == BLOCKED) {
+      device = event->device;
+      device_queue[device]++;
+    }
+    if (device != 0) {
+      begin_event();
+      printf("{\"ph\": \"C\", \"name\": \"D%d queue\", \"pid\": %d, "
+             "\"tid\": %d, \"ts\": %.3f, \"args\": {\"apps\": %d}}",
+             device, TRACK_DEVICES, device, now_us, device_queue[device]);
+    }
+
+    states[app_id] = event->value;
+    since_us[app_id] = now_us;
+    app_cpus[app_id] = event->cpu_id;
+    app_devices[app_id] = event->device;
+  }
+
+  // Close the intervals still open at the end of the trace
+  for (int i = 0; i < app_amount; i++) {
+    if (states[i] != FINISHED) {
+      print_app_interval(i, states[i], app_cpus[i], app_devices[i],
+                         since_us[i], last_us);
+    }
+  }
+
+  printf("\n]}\n");
+
+  if (header->dropped > 0) {
+    fprintf(stderr, "Warning: %lu events dropped, trace file was full\n",
+            (unsigned long)header->dropped);
+  }
+  if (invalid > 0) {
+    fprintf(stderr, "Warning: %lu invalid events skipped\n",
+            (unsigned long)invalid);
+  }
+
+  free(states);
+  free(since_us);
+  free(app_cpus);
+  free(app_devices);
+  trace_close(trace);
+
+  return 0;
+}
@@ -5,3 +5,11 @@ const char *SYSCALL_STR[] = {"None",       "Read from D1", "Write to D1",
                              "Exec on D2", "App finished"};
 
 const char *PROC_STATE_STR[] = {"Running", "Blocked", "Paused", "Finished"};
+
+const char *SWITCH_MODE_STR[] = {"signal", "futex"};
+const char *ENGINE_STR[] = {"process", "coroutine", "replay"};
+const char *DEVICE_MODEL_STR[] = {"random", "service"};
+const char *DIST_STR[] = {"fixed", "exp", "bimodal"};
+const char *SCHED_POLICY_STR[] = {"rr", "mlfq", "lottery", "stride", "cfs"};
+const char *VM_REPLACEMENT_STR[] = {"clock", "lru", "ws"};
+const char *WORKLOAD_STR[] = {"uniform", "cpu", "io", "bursty", "heavytail"};
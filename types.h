@@ -15,10 +15,22 @@
 11: semaphore error
 12: app segfault
 13: nanosleep error
+14: epoll error
+15: eventfd error
+16: invalid arguments
+17: trace file error
+18: timerfd error
+19: startup error
+20: replay error
+21: metrics file error
+22: checkpoint error
+23: device error
 
 */
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #define PIPE_READ 0
@@ -31,6 +43,15 @@ typedef enum {
   IRQ_D2    // Device D2 interrupt
 } irq_t;
 
+// Interrupt record sent through the interrupts pipe.
+// Intersim writes all records of a tick in a single batch
+typedef struct {
+  irq_t irq;             // Interrupt type
+  int cpu_id;            // Target CPU of an IRQ_TIME
+  int count;             // Requests completed by an IRQ_D1/IRQ_D2
+  uint64_t timestamp_ns; // CLOCK_MONOTONIC time at which it was raised
+} irq_msg_t;
+
 // System calls requested by application process
 typedef enum {
   SYSCALL_NONE,        // No syscall requested
@@ -45,12 +66,190 @@ typedef enum {
 // String description of the syscalls
 extern const char *SYSCALL_STR[];
 
+// Device request record sent by kernelsim through the device pipe, in the
+// service model, whenever it blocks an app on a device
+typedef struct {
+  syscall_t call;     // Device syscall, tells the device and operation
+  uint64_t submit_ns; // CLOCK_MONOTONIC time at which the app blocked
+} device_request_t;
+
+// How device interrupts are generated, selected at startup
+typedef enum {
+  DEVICE_MODEL_RANDOM, // Random interrupts on each tick, one app each
+  DEVICE_MODEL_SERVICE // Interrupts when queued requests are served
+} device_model_t;
+// String description of the device models
+extern const char *DEVICE_MODEL_STR[];
+
+// Service time distributions of the service model, configured per operation
+typedef enum {
+  DIST_FIXED,  // Always the configured time
+  DIST_EXP,    // Exponential with the configured mean
+  DIST_BIMODAL // The configured time, or a slow multiple of it
+} dist_t;
+// String description of the distributions, also their config values
+extern const char *DIST_STR[];
+
+// Handshake between kernelsim and an app, replaces a global semaphore.
+// Only the kernel and the app itself ever touch it
+typedef enum {
+  HANDSHAKE_IDLE,    // No syscall pending and no preemption in progress
+  HANDSHAKE_SYSCALL, // App claimed it to submit a syscall, can't be preempted
+  HANDSHAKE_PREEMPT  // Kernel claimed it to preempt the app
+} handshake_t;
+
+// How the kernel stops and continues apps, selected at startup
+typedef enum {
+  SWITCH_SIGNAL, // SIGUSR1 -> SIGSTOP, then SIGCONT
+  SWITCH_FUTEX   // Apps park on their run word at safe points
+} switch_mode_t;
+// String description of the switch modes
+extern const char *SWITCH_MODE_STR[];
+
+// What runs the apps, selected at startup
+typedef enum {
+  ENGINE_PROCESS,   // One app process per app, switched by the kernel
+  ENGINE_COROUTINE, // Coroutines inside kernelsim, switched by stack swaps
+  ENGINE_REPLAY     // No apps, their syscalls come from a recording
+} engine_t;
+// String description of the engines
+extern const char *ENGINE_STR[];
+
+// Scheduling policy of the run queues, selected at startup
+typedef enum {
+  SCHED_POLICY_RR,      // Round-robin, one tick per timeslice
+  SCHED_POLICY_MLFQ,    // Multi-level feedback queue
+  SCHED_POLICY_LOTTERY, // Random draw weighted by tickets
+  SCHED_POLICY_STRIDE,  // Deterministic proportional share
+  SCHED_POLICY_CFS      // Lowest weighted runtime first
+} sched_policy_t;
+// String description of the scheduling policies
+extern const char *SCHED_POLICY_STR[];
+
+// Workload profile of an app, assigned by the kernel at startup
+typedef enum {
+  WORKLOAD_UNIFORM,    // The original app, uniform syscall mix
+  WORKLOAD_CPU,        // Few syscalls, long runs
+  WORKLOAD_IO,         // Frequent reads and writes
+  WORKLOAD_BURSTY,     // Alternates between CPU and I/O phases
+  WORKLOAD_HEAVY_TAIL, // Pareto-distributed run lengths
+  WORKLOAD_AMOUNT
+} workload_t;
+// String description of the workload profiles
+extern const char *WORKLOAD_STR[];
+// Device syscalls an app may send, weighted by each profile
+#define WORKLOAD_SYSCALLS 6
+
+// Page replacement policy of the frame pool
+typedef enum {
+  VM_REPLACEMENT_CLOCK, // Second chance on the referenced bit
+  VM_REPLACEMENT_LRU,   // Least recently used page
+  VM_REPLACEMENT_WS     // A page out of its owner's working set window
+} vm_replacement_t;
+// String description of the replacement policies, also their config values
+extern const char *VM_REPLACEMENT_STR[];
+
+// Run word of an app in fast-switch mode, also used as a futex
+typedef enum {
+  RUN_WORD_BOOTING, // App hasn't parked for the first time yet
+  RUN_WORD_RUNNING, // Kernel resumed the app
+  RUN_WORD_PARKED   // App saved its context and waits to be resumed
+} run_word_t;
+
+// Saved context of an app in shm, along with its handshake.
+// Each slot takes a full cache line, so apps saving context don't share
+// lines with the running app or the kernel
+typedef struct {
+  _Alignas(64) int counter;   // Saved program counter
+  syscall_t syscall;          // Pending syscall, or app finished
+  _Atomic uint32_t handshake; // handshake_t, also used as a futex
+  _Atomic uint32_t app_waits; // Times the app waited for a preemption
+  _Atomic uint32_t preempt_skips; // Times the kernel found a pending syscall
+  _Atomic uint32_t run_word;      // run_word_t, fast-switch mode only
+  uint64_t park_request_ns;       // When the kernel last asked us to park
+  uint64_t park_latency_sum_ns;   // Park request to parked, summed
+  uint64_t park_latency_max_ns;   // Park request to parked, worst case
+  uint32_t parks;                 // Park requests honored
+  uint32_t workload;              // workload_t, set before the app boots
+} app_ctx_t;
+
+_Static_assert(sizeof(app_ctx_t) == 64, "app_ctx_t must fill a cache line");
+
+// Register file of a simulated app, saved whole on every switch
+typedef struct {
+  uint64_t regs[32];
+  uint64_t pc;
+  uint64_t flags;
+} reg_file_t;
+
+// Large context area of an app in shm, placed after the syscall ring and
+// followed by the saved copy of the app's working set. Only the app writes
+// it, the kernel reads the switch costs once the app finished
+typedef struct {
+  _Alignas(64) reg_file_t regs; // Saved register file
+  uint64_t saves;               // Contexts saved
+  uint64_t restores;            // Contexts restored
+  uint64_t save_ns;             // Time spent saving, summed
+  uint64_t restore_ns;          // Time spent restoring, summed
+  uint64_t bytes_saved;         // Bytes copied into the area, summed
+  uint64_t bytes_restored;      // Bytes copied out of the area, summed
+  _Alignas(64) uint8_t working_set[];
+} app_area_t;
+
+// Syscall request submitted by an app through the syscall ring
+typedef struct {
+  int app_id;         // App that submitted the request
+  syscall_t call;     // Requested syscall
+  uint64_t submit_ns; // CLOCK_MONOTONIC time of submission
+} syscall_request_t;
+
+// Syscall ring slot. The sequence tells producers and the consumer whose
+// turn it is to use the slot
+typedef struct {
+  _Atomic uint32_t sequence;
+  syscall_request_t request;
+} syscall_slot_t;
+
+// Lock-free multi-producer single-consumer ring of syscall requests,
+// placed in the shm segment right after the app contexts.
+// Apps are the producers and kernelsim is the consumer
+typedef struct {
+  _Alignas(64) _Atomic uint32_t tail; // Next position claimed by an app
+  _Alignas(64) uint32_t head;         // Next position read by the kernel
+  // Set by the kernel before going to sleep, the first app to submit
+  // a request afterwards clears it and rings the eventfd doorbell
+  _Atomic uint32_t doorbell_armed;
+  uint32_t mask;                      // Capacity - 1
+  syscall_slot_t slots[];
+} syscall_ring_t;
+
+// Identifies a kernelsim shm segment and its layout version
+#define SHM_MAGIC 0x4d49534b // "KSIM"
+#define SHM_VERSION 5
+
+// Shared memory segment between apps and kernel.
+// Layout: header, one app_ctx_t per app, the syscall ring, then one
+// app_area_t per app
+typedef struct {
+  _Alignas(64) uint32_t magic; // SHM_MAGIC
+  uint32_t version;            // SHM_VERSION
+  uint32_t ctx_size;           // sizeof(app_ctx_t), catches mismatched builds
+  uint32_t app_amount;         // Amount of app_ctx_t slots
+  uint32_t switch_mode;        // switch_mode_t chosen by the kernel
+  uint64_t ring_offset;        // Offset of the syscall ring from the start
+  uint64_t area_offset;        // Offset of the first app_area_t
+  uint64_t area_stride;        // Bytes between consecutive app_area_t
+  uint64_t working_set_size;   // Bytes of working set in each app_area_t
+  uint64_t size;               // Total mapped size in bytes
+  app_ctx_t ctxs[];
+} shm_t;
+
 // Application process states
 typedef enum {
   RUNNING, // Process is active
   BLOCKED, // Process is waiting for device interrupt
   PAUSED,  // Process is waiting for a SIGCONT
-  FINISHED // Process has finished executing (PC >= APP_MAX_PC)
+  FINISHED // Process has finished executing (PC reached its run length)
 } proc_state_t;
 // String description of app process states
 extern const char *PROC_STATE_STR[];
@@ -66,16 +265,30 @@ typedef struct {
   int write_count;     // Amount of W syscalls
   int exec_count;      // Amount of X syscalls
   proc_state_t state;  // Current state of the process
+  int cpu_id;          // CPU the app is running on, or last ran on
 } proc_info_t;
 
-// Queue node
-typedef struct node_t {
-  int data;
-  struct node_t *next;
-} node_t;
-
-// Queue of app_ids waiting for device IO
+// Fixed-capacity ring buffer queue of app_ids, preallocated on creation.
+// Capacity is a power of two, and each app_id can be queued at most once.
+// Removing an app_id from the middle leaves a stale slot, which is skipped
+// when it reaches the front
 typedef struct {
-  node_t *front;
-  node_t *rear;
+  int *slots;          // Ring storage, indexed by position & mask
+  int *position;       // Slot index of each queued app_id, -1 if not queued
+  unsigned int mask;   // Capacity - 1
+  unsigned int head;   // Position of the front slot
+  unsigned int tail;   // Position of the next free slot
+  int max_id;          // Queued app_ids must be in [0, max_id)
+  int length;          // Amount of queued app_ids, excluding stale slots
 } queue_t;
+
+// Simulated CPU, runs at most one app at a time.
+// These are all set by kernelsim
+typedef struct {
+  int cpu_id;          // CPU ID, same as cpus array index
+  int running_app_id;  // App in the RUNNING state on this CPU, or -1
+  uint64_t busy_ticks; // Timeslices that ended with an app running
+  uint64_t idle_ticks; // Timeslices that ended with no app running
+  uint64_t steals;     // Apps taken from other CPUs' run queues
+  uint64_t migrations; // Apps that ran here after running on another CPU
+} cpu_t;
@@ -2,142 +2,492 @@
 #include "cfg.h"
 #include "types.h"
 #include <assert.h>
-#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <linux/futex.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
 
-void msg(const char *format, ...) {
+// Virtual clock of the discrete-event mode, only read once enabled
+static bool virtual_clock = false;
+static uint64_t virtual_time_ns = 0;
+
+uint64_t get_time_ns(void) {
+  if (virtual_clock)
+    return virtual_time_ns;
+
+  return get_real_time_ns();
+}
+
+uint64_t get_real_time_ns(void) {
   struct timespec ts;
-  va_list args;
 
-  // Get current time with nanosecond precision
-  clock_gettime(CLOCK_REALTIME, &ts);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
 
-  // Extract hours, minutes and seconds
-  struct tm tm_info;
-  localtime_r(&ts.tv_sec, &tm_info);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void set_virtual_time_ns(uint64_t time_ns) {
+  assert(!virtual_clock || time_ns >= virtual_time_ns);
+
+  virtual_clock = true;
+  virtual_time_ns = time_ns;
+}
 
-  // Print timestamp with hours, minutes, seconds, and milliseconds
-  printf("[%02d:%02d:%02d.%02ld] ", tm_info.tm_hour, tm_info.tm_min,
-         tm_info.tm_sec, ts.tv_nsec / 10000000);
+// Capacity of the syscall ring, each app has at most one pending request
+static uint32_t syscall_ring_capacity(int app_amount) {
+  uint32_t capacity = 1;
 
-  // Print the rest of the message
-  va_start(args, format);
-  vprintf(format, args);
-  va_end(args);
+  while (capacity < (uint32_t)app_amount) {
+    capacity <<= 1;
+  }
 
-  printf("\n");
+  return capacity;
+}
 
-  // Flush the output to ensure it's displayed immediately
-  fflush(stdout);
+// Offset of the syscall ring in shm, after the header and contexts
+static size_t syscall_ring_offset(int app_amount) {
+  return sizeof(shm_t) + sizeof(app_ctx_t) * app_amount;
 }
 
-void dmsg(const char *format, ...) {
-#ifdef DEBUG
-  struct timespec ts;
-  va_list args;
+// Offset of the app areas in shm, after the syscall ring, page aligned
+static size_t app_area_offset(int app_amount) {
+  size_t end = syscall_ring_offset(app_amount) + sizeof(syscall_ring_t) +
+               sizeof(syscall_slot_t) * syscall_ring_capacity(app_amount);
+
+  return (end + 4095) & ~(size_t)4095;
+}
 
-  // Get current time with nanosecond precision
-  clock_gettime(CLOCK_REALTIME, &ts);
+// Bytes taken by each app area, keeping the next one cache line aligned
+static size_t app_area_stride(size_t working_set_size) {
+  return (sizeof(app_area_t) + working_set_size + 63) & ~(size_t)63;
+}
 
-  // Extract hours, minutes and seconds
-  struct tm tm_info;
-  localtime_r(&ts.tv_sec, &tm_info);
+// Size of the shm segment, rounded up to a huge page if requested
+static size_t shm_size(int app_amount, size_t working_set_size) {
+  size_t size = app_area_offset(app_amount) +
+                app_area_stride(working_set_size) * app_amount;
 
-  // Print timestamp with hours, minutes, seconds, and milliseconds
-  printf("[%02d:%02d:%02d.%02ld] ", tm_info.tm_hour, tm_info.tm_min,
-         tm_info.tm_sec, ts.tv_nsec / 10000000);
+#ifdef SHM_HUGE_PAGES
+  size = (size + SHM_HUGE_PAGE_SIZE - 1) & ~(size_t)(SHM_HUGE_PAGE_SIZE - 1);
+#endif
 
-  // Print the rest of the message
-  va_start(args, format);
-  vprintf(format, args);
-  va_end(args);
+  return size;
+}
 
-  printf("\n");
+// Maps an open shm fd, asking for huge pages if enabled in cfg.h
+static void *map_shm_fd(int fd, size_t size) {
+  void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "Shm map error\n");
+    exit(3);
+  }
 
-  // Flush the output to ensure it's displayed immediately
-  fflush(stdout);
+#ifdef SHM_HUGE_PAGES
+  // Best effort, depends on shmem transparent huge pages being enabled
+  madvise(addr, size, MADV_HUGEPAGE);
 #endif
+
+  return addr;
+}
+
+shm_t *create_shm(const char *name, int app_amount, switch_mode_t switch_mode,
+                  size_t working_set_size) {
+  size_t size = shm_size(app_amount, working_set_size);
+
+  shm_unlink(name); // remove any existing segment
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd == -1 || ftruncate(fd, size) == -1) {
+    fprintf(stderr, "Shm alloc error\n");
+    exit(3);
+  }
+
+  // Pages come zeroed from ftruncate
+  shm_t *shm = (shm_t *)map_shm_fd(fd, size);
+  close(fd);
+
+  shm->magic = SHM_MAGIC;
+  shm->version = SHM_VERSION;
+  shm->ctx_size = sizeof(app_ctx_t);
+  shm->app_amount = app_amount;
+  shm->switch_mode = switch_mode;
+  shm->ring_offset = syscall_ring_offset(app_amount);
+  shm->area_offset = app_area_offset(app_amount);
+  shm->area_stride = app_area_stride(working_set_size);
+  shm->working_set_size = working_set_size;
+  shm->size = size;
+
+  for (int i = 0; i < app_amount; i++) {
+    atomic_init(&shm->ctxs[i].handshake, HANDSHAKE_IDLE);
+    atomic_init(&shm->ctxs[i].app_waits, 0);
+    atomic_init(&shm->ctxs[i].preempt_skips, 0);
+  }
+  init_syscall_ring(get_syscall_ring(shm), app_amount);
+
+  return shm;
+}
+
+shm_t *attach_shm(const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    fprintf(stderr, "Shm attach error\n");
+    exit(3);
+  }
+
+  shm_t *shm = (shm_t *)map_shm_fd(fd, st.st_size);
+  close(fd);
+
+  if (shm->magic != SHM_MAGIC || shm->version != SHM_VERSION ||
+      shm->ctx_size != sizeof(app_ctx_t) || shm->size != (uint64_t)st.st_size) {
+    fprintf(stderr, "Shm version mismatch\n");
+    exit(3);
+  }
+
+  return shm;
+}
+
+void detach_shm(shm_t *shm) { munmap(shm, shm->size); }
+
+void destroy_shm(shm_t *shm, const char *name) {
+  detach_shm(shm);
+  shm_unlink(name);
+}
+
+void futex_wait(_Atomic uint32_t *addr, uint32_t expected,
+                const struct timespec *timeout) {
+  syscall(SYS_futex, addr, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+void futex_wake(_Atomic uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+void begin_app_syscall(app_ctx_t *ctx) {
+  uint32_t expected = HANDSHAKE_IDLE;
+
+  // Fast path, the kernel isn't touching us
+  while (!atomic_compare_exchange_strong(&ctx->handshake, &expected,
+                                         HANDSHAKE_SYSCALL)) {
+    // Slow path, we're about to get stopped. Wait until the kernel
+    // continues us and releases the handshake
+    assert(expected == HANDSHAKE_PREEMPT);
+    atomic_fetch_add_explicit(&ctx->app_waits, 1, memory_order_relaxed);
+    futex_wait(&ctx->handshake, HANDSHAKE_PREEMPT, NULL);
+    expected = HANDSHAKE_IDLE;
+  }
+}
+
+bool try_begin_app_syscall(app_ctx_t *ctx) {
+  uint32_t expected = HANDSHAKE_IDLE;
+
+  if (atomic_compare_exchange_strong(&ctx->handshake, &expected,
+                                     HANDSHAKE_SYSCALL))
+    return true;
+
+  // Nobody is going to stop us, the caller parks instead of waiting
+  assert(expected == HANDSHAKE_PREEMPT);
+  atomic_fetch_add_explicit(&ctx->app_waits, 1, memory_order_relaxed);
+  return false;
+}
+
+bool try_begin_preempt(app_ctx_t *ctx) {
+  uint32_t expected = HANDSHAKE_IDLE;
+
+  if (atomic_compare_exchange_strong(&ctx->handshake, &expected,
+                                     HANDSHAKE_PREEMPT))
+    return true;
+
+  atomic_fetch_add_explicit(&ctx->preempt_skips, 1, memory_order_relaxed);
+  return false;
+}
+
+void end_app_handshake(app_ctx_t *ctx) {
+  // Only wake if the app could be waiting on it
+  if (atomic_exchange(&ctx->handshake, HANDSHAKE_IDLE) == HANDSHAKE_PREEMPT) {
+    futex_wake(&ctx->handshake);
+  }
+}
+
+void request_app_park(app_ctx_t *ctx) {
+  ctx->park_request_ns = get_time_ns();
+
+  // The handshake doubles as the park request, the app sleeps on it
+  atomic_store(&ctx->handshake, HANDSHAKE_PREEMPT);
+  futex_wake(&ctx->handshake);
+}
+
+void wait_app_parked(app_ctx_t *ctx) {
+  uint32_t word;
+
+  while ((word = atomic_load(&ctx->run_word)) != RUN_WORD_PARKED) {
+    futex_wait(&ctx->run_word, word, NULL);
+  }
+}
+
+void resume_app(app_ctx_t *ctx) {
+  atomic_store(&ctx->run_word, RUN_WORD_RUNNING);
+  futex_wake(&ctx->run_word);
+}
+
+bool wait_park_request(app_ctx_t *ctx, const struct timespec *timeout) {
+  uint32_t handshake = atomic_load(&ctx->handshake);
+
+  if (handshake != HANDSHAKE_PREEMPT) {
+    futex_wait(&ctx->handshake, handshake, timeout);
+  }
+
+  return atomic_load(&ctx->handshake) == HANDSHAKE_PREEMPT;
+}
+
+void park_app(app_ctx_t *ctx) {
+  // Nothing to measure when parking at boot
+  if (ctx->park_request_ns != 0) {
+    uint64_t latency = get_time_ns() - ctx->park_request_ns;
+
+    ctx->park_latency_sum_ns += latency;
+    if (latency > ctx->park_latency_max_ns) {
+      ctx->park_latency_max_ns = latency;
+    }
+    ctx->parks++;
+    ctx->park_request_ns = 0;
+  }
+
+  // The kernel may be waiting for us to park before resuming us
+  atomic_store(&ctx->run_word, RUN_WORD_PARKED);
+  futex_wake(&ctx->run_word);
+
+  while (atomic_load(&ctx->run_word) == RUN_WORD_PARKED) {
+    futex_wait(&ctx->run_word, RUN_WORD_PARKED, NULL);
+  }
+}
+
+void init_syscall_ring(syscall_ring_t *ring, int app_amount) {
+  uint32_t capacity = syscall_ring_capacity(app_amount);
+
+  atomic_init(&ring->tail, 0);
+  ring->head = 0;
+  atomic_init(&ring->doorbell_armed, 1);
+  ring->mask = capacity - 1;
+
+  for (uint32_t i = 0; i < capacity; i++) {
+    atomic_init(&ring->slots[i].sequence, i);
+  }
+}
+
+bool push_syscall_request(syscall_ring_t *ring, int app_id, syscall_t call) {
+  uint32_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  syscall_slot_t *slot;
+
+  // Claim the slot at tail, competing with other apps
+  for (;;) {
+    slot = &ring->slots[pos & ring->mask];
+    uint32_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    int32_t diff = (int32_t)(seq - pos);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      // Full, can't happen while every app has at most one pending request
+      sched_yield();
+      pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    } else {
+      pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+  }
+
+  slot->request.app_id = app_id;
+  slot->request.call = call;
+  slot->request.submit_ns = get_time_ns();
+
+  // Publish, then check if the kernel is sleeping. Both are seq_cst so the
+  // kernel either sees this request or we see the armed doorbell
+  atomic_store(&slot->sequence, pos + 1);
+
+  return atomic_exchange(&ring->doorbell_armed, 0) != 0;
 }
 
-int get_app_counter(int *shm, int app_id) {
-  assert(shm != NULL);
-  return *(shm + (app_id * 2));
+bool pop_syscall_request(syscall_ring_t *ring, syscall_request_t *request) {
+  syscall_slot_t *slot = &ring->slots[ring->head & ring->mask];
+  uint32_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+  if (seq != ring->head + 1)
+    return false;
+
+  *request = slot->request;
+
+  // Hand the slot back to producers for the next lap
+  atomic_store_explicit(&slot->sequence, ring->head + ring->mask + 1,
+                        memory_order_release);
+  ring->head++;
+
+  return true;
 }
 
-syscall_t get_app_syscall(int *shm, int app_id) {
-  assert(shm != NULL);
-  return *(shm + 1 + (app_id * 2));
+bool arm_syscall_doorbell(syscall_ring_t *ring) {
+  atomic_store(&ring->doorbell_armed, 1);
+
+  // Check for a request published before the doorbell was armed
+  syscall_slot_t *slot = &ring->slots[ring->head & ring->mask];
+  if (atomic_load(&slot->sequence) == ring->head + 1) {
+    atomic_store(&ring->doorbell_armed, 0);
+    return false;
+  }
+
+  return true;
 }
 
-void set_app_counter(int *shm, int app_id, int value) {
-  assert(shm != NULL);
-  *(shm + (app_id * 2)) = value;
+void ring_syscall_doorbell(int doorbell_fd) {
+  uint64_t one = 1;
+
+  while (write(doorbell_fd, &one, sizeof(one)) == -1) {
+    // Counter saturated means the kernel will wake up anyway
+    if (errno != EINTR)
+      return;
+  }
 }
 
-void set_app_syscall(int *shm, int app_id, syscall_t call) {
-  assert(shm != NULL);
-  *(shm + 1 + (app_id * 2)) = (int)call;
+void signal_child_ready(int ready_fd) {
+  uint64_t one = 1;
+
+  while (write(ready_fd, &one, sizeof(one)) == -1 && errno == EINTR)
+    ;
+  close(ready_fd);
 }
 
-queue_t *create_queue(void) {
+queue_t *create_queue(int max_id) {
+  assert(max_id > 0);
+
+  // Leave room for stale slots, so compacting is rare
+  unsigned int capacity = 2;
+  while (capacity < 2 * (unsigned int)max_id) {
+    capacity <<= 1;
+  }
+
   queue_t *q = (queue_t *)malloc(sizeof(queue_t));
-  if (q == NULL) {
+  int *slots = (int *)malloc(sizeof(int) * capacity);
+  int *position = (int *)malloc(sizeof(int) * max_id);
+  if (q == NULL || slots == NULL || position == NULL) {
     fprintf(stderr, "Malloc error\n");
     exit(6);
   }
 
-  q->front = q->rear = NULL;
+  q->slots = slots;
+  q->position = position;
+  q->mask = capacity - 1;
+  q->head = q->tail = 0;
+  q->max_id = max_id;
+  q->length = 0;
+  memset(position, -1, sizeof(int) * max_id);
 
   return q;
 }
 
 void free_queue(queue_t *q) {
-  node_t *current = q->front;
-  node_t *next;
+  free(q->slots);
+  free(q->position);
+  free(q);
+}
 
-  while (current != NULL) {
-    next = current->next;
-    free(current);
-    current = next;
+// Whether the slot at the given ring position holds a queued app_id
+static inline bool is_live_slot(const queue_t *q, unsigned int pos) {
+  return q->position[q->slots[pos & q->mask]] == (int)(pos & q->mask);
+}
+
+// Advances the front past stale slots left by remove_from_queue
+static inline void skip_stale_slots(queue_t *q) {
+  while (q->head != q->tail && !is_live_slot(q, q->head)) {
+    q->head++;
   }
+}
 
-  free(q);
+// Moves all queued app_ids to the front of the ring, dropping stale slots.
+// Only called when every slot is taken
+static void compact_queue(queue_t *q) {
+  unsigned int write_pos = q->head;
+
+  for (unsigned int read_pos = q->head; read_pos != q->tail; read_pos++) {
+    if (is_live_slot(q, read_pos)) {
+      int value = q->slots[read_pos & q->mask];
+
+      q->slots[write_pos & q->mask] = value;
+      q->position[value] = (int)(write_pos & q->mask);
+      write_pos++;
+    }
+  }
+
+  q->tail = write_pos;
 }
 
 void enqueue(queue_t *q, int value) {
-  node_t *temp = (node_t *)malloc(sizeof(node_t));
-  if (temp == NULL) {
-    fprintf(stderr, "Malloc error\n");
-    exit(6);
-  }
-  temp->data = value;
-  temp->next = NULL;
+  assert(value >= 0 && value < q->max_id);
+  assert(q->position[value] == -1);
 
-  if (q->rear == NULL) {
-    q->front = q->rear = temp;
-    return;
+  if (q->tail - q->head > q->mask) {
+    compact_queue(q);
   }
 
-  q->rear->next = temp;
-  q->rear = temp;
+  q->slots[q->tail & q->mask] = value;
+  q->position[value] = (int)(q->tail & q->mask);
+  q->tail++;
+  q->length++;
 }
 
 int dequeue(queue_t *q) {
-  if (q->front == NULL)
+  skip_stale_slots(q);
+
+  if (q->head == q->tail)
     return -1;
 
-  node_t *temp = q->front;
-  int value = temp->data;
+  int value = q->slots[q->head & q->mask];
 
-  q->front = q->front->next;
+  q->position[value] = -1;
+  q->head++;
+  q->length--;
 
-  if (q->front == NULL)
-    q->rear = NULL;
+  return value;
+}
 
-  free(temp);
+int peek_queue(queue_t *q) {
+  skip_stale_slots(q);
 
-  return value;
+  if (q->head == q->tail)
+    return -1;
+
+  return q->slots[q->head & q->mask];
+}
+
+bool remove_from_queue(queue_t *q, int value) {
+  assert(value >= 0 && value < q->max_id);
+
+  if (q->position[value] == -1)
+    return false;
+
+  // The slot becomes stale and is skipped once it reaches the front
+  q->position[value] = -1;
+  q->length--;
+
+  return true;
+}
+
+int queue_items(const queue_t *q, int *values) {
+  int amount = 0;
+
+  for (unsigned int pos = q->head; pos != q->tail; pos++) {
+    if (is_live_slot(q, pos)) {
+      values[amount++] = q->slots[pos & q->mask];
+    }
+  }
+
+  return amount;
 }
@@ -1,33 +1,159 @@
 #pragma once
 
+#include "logger.h"
 #include "types.h"
+#include <time.h>
 
-// printf + timestamp
-void msg(const char *format, ...);
+// Current simulation time in nanoseconds: CLOCK_MONOTONIC time, or the
+// virtual clock once the discrete-event mode set it
+uint64_t get_time_ns(void);
 
-// printf + timestamp for DEBUG only
-void dmsg(const char *format, ...);
+// Current CLOCK_MONOTONIC time in nanoseconds, even in virtual time
+uint64_t get_real_time_ns(void);
+
+// Switches get_time_ns to the virtual clock and moves it to the given time.
+// Discrete-event mode only, the clock never goes back
+void set_virtual_time_ns(uint64_t time_ns);
+
+// Blocks while the futex word still holds the expected value, or until the
+// timeout expires if it isn't NULL
+void futex_wait(_Atomic uint32_t *addr, uint32_t expected,
+                const struct timespec *timeout);
+
+// Wakes up every process waiting on the futex word
+void futex_wake(_Atomic uint32_t *addr);
+
+// Creates, maps and initializes the shm segment between apps and kernel,
+// with app_amount context slots, the syscall ring, the switch mode apps
+// must follow and an area per app for its register file and working set.
+// Kernel only
+shm_t *create_shm(const char *name, int app_amount, switch_mode_t switch_mode,
+                  size_t working_set_size);
+
+// Maps the shm segment created by kernelsim and validates its version
+shm_t *attach_shm(const char *name);
+
+// Unmaps the shm segment
+void detach_shm(shm_t *shm);
+
+// Unmaps and removes the shm segment. Kernel only
+void destroy_shm(shm_t *shm, const char *name);
 
 // Get program counter value from shm for the given app_id
-int get_app_counter(int *shm, int app_id);
+static inline int get_app_counter(const shm_t *shm, int app_id) {
+  return shm->ctxs[app_id].counter;
+}
 
 // Get syscall request status from shm for the given app_id
-syscall_t get_app_syscall(int *shm, int app_id);
+static inline syscall_t get_app_syscall(const shm_t *shm, int app_id) {
+  return shm->ctxs[app_id].syscall;
+}
 
 // Set program counter value in shm for the given app_id
-void set_app_counter(int *shm, int app_id, int value);
+static inline void set_app_counter(shm_t *shm, int app_id, int value) {
+  shm->ctxs[app_id].counter = value;
+}
 
 // Set syscall request status in shm for the given app_id
-void set_app_syscall(int *shm, int app_id, syscall_t call);
+static inline void set_app_syscall(shm_t *shm, int app_id, syscall_t call) {
+  shm->ctxs[app_id].syscall = call;
+}
+
+// Get the syscall ring placed after the app contexts in shm
+static inline syscall_ring_t *get_syscall_ring(shm_t *shm) {
+  return (syscall_ring_t *)((char *)shm + shm->ring_offset);
+}
+
+// Get the large context area of the given app_id, after the syscall ring
+static inline app_area_t *get_app_area(shm_t *shm, int app_id) {
+  return (app_area_t *)((char *)shm + shm->area_offset +
+                        shm->area_stride * app_id);
+}
+
+// App side: claims the handshake before submitting a syscall.
+// Waits on a futex if the kernel is preempting the app at the same time
+void begin_app_syscall(app_ctx_t *ctx);
+
+// App side, fast-switch mode: tries to claim the handshake before
+// submitting a syscall. Returns false if the kernel is preempting the app,
+// which must park before trying again
+bool try_begin_app_syscall(app_ctx_t *ctx);
+
+// Kernel side: claims the handshake before preempting an app.
+// Returns false if the app has a pending syscall
+bool try_begin_preempt(app_ctx_t *ctx);
+
+// Kernel side: releases the handshake before continuing an app,
+// ending either the preemption or the syscall
+void end_app_handshake(app_ctx_t *ctx);
+
+// Kernel side, fast-switch mode: asks an app to park at its next safe
+// point. Used both to preempt it and to block it on a syscall
+void request_app_park(app_ctx_t *ctx);
 
-// Allocates a queue for storing app_ids as ints
-queue_t *create_queue(void);
+// Kernel side, fast-switch mode: waits until the app has parked
+void wait_app_parked(app_ctx_t *ctx);
+
+// Kernel side, fast-switch mode: resumes a parked app. The handshake
+// must be released first
+void resume_app(app_ctx_t *ctx);
+
+// App side, fast-switch mode: sleeps until the kernel asks us to park,
+// or the timeout expires if it isn't NULL. Returns whether we must park
+bool wait_park_request(app_ctx_t *ctx, const struct timespec *timeout);
+
+// App side, fast-switch mode: marks the app parked and waits until the
+// kernel resumes it. Records how long the park request took to be honored
+void park_app(app_ctx_t *ctx);
+
+// Initializes an empty syscall ring able to hold app_amount requests,
+// with the doorbell armed
+void init_syscall_ring(syscall_ring_t *ring, int app_amount);
+
+// Publishes a syscall request to the ring.
+// Returns whether the kernel must be woken up through the doorbell
+bool push_syscall_request(syscall_ring_t *ring, int app_id, syscall_t call);
+
+// Takes the oldest published request from the ring, kernel only.
+// Returns false if the ring is empty
+bool pop_syscall_request(syscall_ring_t *ring, syscall_request_t *request);
+
+// Arms the doorbell before the kernel goes to sleep, kernel only.
+// Returns false if a request was published meanwhile, in which case the
+// doorbell is left disarmed and the ring must be drained again
+bool arm_syscall_doorbell(syscall_ring_t *ring);
+
+// Wakes up the kernel by writing to the doorbell eventfd
+void ring_syscall_doorbell(int doorbell_fd);
+
+// Tells kernelsim a child finished booting by adding 1 to the readiness
+// eventfd, then closes it
+void signal_child_ready(int ready_fd);
+
+// Allocates a ring buffer queue for storing app_ids in [0, max_id).
+// This is the only allocation, queue operations never touch the heap
+queue_t *create_queue(int max_id);
 
 // Frees a queue
 void free_queue(queue_t *q);
 
-// Enqueues an app_id to the queue
+// Enqueues an app_id to the queue, which must not already be queued
 void enqueue(queue_t *q, int value);
 
-// Dequeues an app_id from the queue
+// Dequeues an app_id from the queue, or returns -1 if it's empty
 int dequeue(queue_t *q);
+
+// Returns the app_id at the front of the queue without dequeuing it,
+// or -1 if it's empty
+int peek_queue(queue_t *q);
+
+// Removes an app_id from anywhere in the queue.
+// Returns whether it was queued
+bool remove_from_queue(queue_t *q, int value);
+
+// Copies the queued app_ids into values, front first.
+// Returns how many there are
+int queue_items(const queue_t *q, int *values);
+
+// Returns how many app_ids are queued
+static inline int queue_length(const queue_t *q) { return q->length; }
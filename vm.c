@@ -0,0 +1,454 @@
+#include "vm.h"
+#include "config.h"
+#include "prng.h"
+#include "types.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Address space of an app
+typedef struct {
+  int32_t *frames;   // Page table, frame of each page or -1 if not present
+  prng_t prng;       // Draws its accesses
+  int hot_base;      // First page of the current hot pages
+  int phase_left;    // Accesses until the hot pages move
+  int pending_vpn;   // Page of the faulted access, or -1
+  uint64_t vtime;    // Accesses completed, the clock of the ws policy
+  vm_stats_t stats;
+} space_t;
+
+// Physical frame
+typedef struct {
+  int app_id;        // Owner, or -1 if free
+  int vpn;           // Page it holds
+  bool referenced;   // Accessed since the clock hand last passed
+  uint64_t last_use; // Owner's vtime at its last access
+  int prev;          // Neighbours in the LRU list, or -1
+  int next;
+} frame_t;
+
+// TLB entry, valid while app_id isn't -1
+typedef struct {
+  int app_id;
+  int vpn;
+  int frame;
+} tlb_entry_t;
+
+// TLB of a CPU, replaced in FIFO order. It has no address space tags, so
+// it's flushed whenever the CPU runs another app
+typedef struct {
+  tlb_entry_t *entries;
+  int next;   // Entry the next miss fills
+  int app_id; // App it last translated for, or -1
+} tlb_t;
+
+static space_t *spaces;
+static int app_amount;
+static frame_t *frames;
+// Stack of free frames
+static int *free_frames;
+static int free_amount;
+// Clock hand of the clock and ws policies
+static int hand = 0;
+// Used frames from most to least recently used, for the lru policy
+static int lru_head = -1;
+static int lru_tail = -1;
+static tlb_t *tlbs;
+static int tlb_amount;
+
+// Allocates a zeroed array, exiting on failure
+static void *alloc_array(size_t amount, size_t size) {
+  void *array = calloc(amount ? amount : 1, size);
+  if (array == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(6);
+  }
+
+  return array;
+}
+
+void vm_init(int apps, int cpu_amount, unsigned int seed) {
+  app_amount = apps;
+  spaces = (space_t *)alloc_array(app_amount, sizeof(space_t));
+  for (int i = 0; i < app_amount; i++) {
+    space_t *space = &spaces[i];
+
+    space->frames =
+        (int32_t *)alloc_array(config.vm_pages, sizeof(int32_t));
+    for (int p = 0; p < config.vm_pages; p++) {
+      space->frames[p] = -1;
+    }
+    prng_seed(&space->prng, seed, PRNG_STREAM_MEMORY + i);
+    space->hot_base = prng_below(&space->prng, config.vm_pages);
+    space->phase_left = config.vm_phase_accesses;
+    space->pending_vpn = -1;
+  }
+
+  frames = (frame_t *)alloc_array(config.vm_frames, sizeof(frame_t));
+  free_frames = (int *)alloc_array(config.vm_frames, sizeof(int));
+  // Free frames are taken from the lowest
+  for (int f = 0; f < config.vm_frames; f++) {
+    frames[f].app_id = -1;
+    free_frames[f] = config.vm_frames - 1 - f;
+  }
+  free_amount = config.vm_frames;
+
+  tlb_amount = cpu_amount;
+  tlbs = (tlb_t *)alloc_array(cpu_amount, sizeof(tlb_t));
+  for (int c = 0; c < cpu_amount; c++) {
+    tlbs[c].entries =
+        (tlb_entry_t *)alloc_array(config.vm_tlb_entries, sizeof(tlb_entry_t));
+    for (int e = 0; e < config.vm_tlb_entries; e++) {
+      tlbs[c].entries[e].app_id = -1;
+    }
+    tlbs[c].app_id = -1;
+  }
+}
+
+void vm_free(void) {
+  for (int i = 0; i < app_amount; i++) {
+    free(spaces[i].frames);
+  }
+  for (int c = 0; c < tlb_amount; c++) {
+    free(tlbs[c].entries);
+  }
+
+  free(spaces);
+  free(frames);
+  free(free_frames);
+  free(tlbs);
+}
+
+// LRU list
+
+static void lru_unlink(int f) {
+  frame_t *frame = &frames[f];
+
+  if (frame->prev != -1) {
+    frames[frame->prev].next = frame->next;
+  } else {
+    lru_head = frame->next;
+  }
+  if (frame->next != -1) {
+    frames[frame->next].prev = frame->prev;
+  } else {
+    lru_tail = frame->prev;
+  }
+}
+
+static void lru_push_head(int f) {
+  frames[f].prev = -1;
+  frames[f].next = lru_head;
+  if (lru_head != -1) {
+    frames[lru_head].prev = f;
+  } else {
+    lru_tail = f;
+  }
+  lru_head = f;
+}
+
+// Marks a frame as accessed by its owner
+static void touch_frame(int f) {
+  frame_t *frame = &frames[f];
+
+  frame->referenced = true;
+  frame->last_use = spaces[frame->app_id].vtime;
+  if (config.vm_replacement == VM_REPLACEMENT_LRU && lru_head != f) {
+    lru_unlink(f);
+    lru_push_head(f);
+  }
+}
+
+// Drops every TLB entry of an app's page, or of all its pages if vpn is -1
+static void tlb_shootdown(int app_id, int vpn) {
+  for (int c = 0; c < tlb_amount; c++) {
+    for (int e = 0; e < config.vm_tlb_entries; e++) {
+      tlb_entry_t *entry = &tlbs[c].entries[e];
+
+      if (entry->app_id == app_id && (vpn == -1 || entry->vpn == vpn)) {
+        entry->app_id = -1;
+      }
+    }
+  }
+}
+
+// Translates a page through a CPU's TLB. Returns its frame, or -1 on a miss
+static int tlb_lookup(tlb_t *tlb, int app_id, int vpn) {
+  for (int e = 0; e < config.vm_tlb_entries; e++) {
+    const tlb_entry_t *entry = &tlb->entries[e];
+
+    if (entry->app_id == app_id && entry->vpn == vpn)
+      return entry->frame;
+  }
+
+  return -1;
+}
+
+static void tlb_fill(tlb_t *tlb, int app_id, int vpn, int frame) {
+  tlb->entries[tlb->next] =
+      (tlb_entry_t){.app_id = app_id, .vpn = vpn, .frame = frame};
+  tlb->next = (tlb->next + 1) % config.vm_tlb_entries;
+}
+
+// Draws the page of an app's next access: one of its hot pages, or any
+// page, and moves the hot pages at the end of each phase
+static int next_vpn(space_t *space) {
+  int vpn;
+
+  if ((int)prng_below(&space->prng, 100) < config.vm_locality) {
+    vpn = (space->hot_base +
+           (int)prng_below(&space->prng, config.vm_hot_pages)) %
+          config.vm_pages;
+  } else {
+    vpn = prng_below(&space->prng, config.vm_pages);
+  }
+
+  if (--space->phase_left == 0) {
+    space->hot_base = prng_below(&space->prng, config.vm_pages);
+    space->phase_left = config.vm_phase_accesses;
+  }
+
+  return vpn;
+}
+
+bool vm_run_app(int cpu_id, int app_id, int accesses) {
+  space_t *space = &spaces[app_id];
+  tlb_t *tlb = &tlbs[cpu_id];
+
+  for (int i = 0; i < accesses; i++) {
+    int vpn = space->pending_vpn != -1 ? space->pending_vpn : next_vpn(space);
+    int frame = tlb_lookup(tlb, app_id, vpn);
+
+    space->pending_vpn = -1;
+    if (frame != -1) {
+      space->stats.tlb_hits++;
+    } else if ((frame = space->frames[vpn]) != -1) {
+      tlb_fill(tlb, app_id, vpn, frame);
+    } else {
+      // Counted once the kernel handles it, as an app starting a syscall
+      // can't block and retries the access at its next tick
+      space->pending_vpn = vpn;
+      return true;
+    }
+
+    space->vtime++;
+    space->stats.accesses++;
+    touch_frame(frame);
+  }
+
+  return false;
+}
+
+// Clock: the first frame the hand finds unreferenced, clearing the bits
+// of the referenced ones it passes
+static int clock_victim(void) {
+  while (frames[hand].referenced) {
+    frames[hand].referenced = false;
+    hand = (hand + 1) % config.vm_frames;
+  }
+
+  int victim = hand;
+  hand = (hand + 1) % config.vm_frames;
+  return victim;
+}
+
+// WSClock: the first frame the hand finds unreferenced and out of its
+// owner's working set window. If a whole sweep finds none, the frame
+// used longest ago by its owner
+static int ws_victim(void) {
+  int oldest = -1;
+  uint64_t oldest_age = 0;
+
+  for (int step = 0; step < 2 * config.vm_frames; step++) {
+    frame_t *frame = &frames[hand];
+    uint64_t age = spaces[frame->app_id].vtime - frame->last_use;
+    int f = hand;
+
+    hand = (hand + 1) % config.vm_frames;
+    if (frame->referenced) {
+      frame->referenced = false;
+      frame->last_use = spaces[frame->app_id].vtime;
+      continue;
+    }
+    if (age > (uint64_t)config.vm_ws_window)
+      return f;
+    if (oldest == -1 || age > oldest_age) {
+      oldest = f;
+      oldest_age = age;
+    }
+  }
+
+  return oldest;
+}
+
+// Takes a frame from the free ones, or evicts the page of the policy's
+// victim
+static int take_frame(void) {
+  int f;
+
+  if (free_amount > 0)
+    return free_frames[--free_amount];
+
+  switch (config.vm_replacement) {
+  case VM_REPLACEMENT_LRU:
+    f = lru_tail;
+    break;
+  case VM_REPLACEMENT_WS:
+    f = ws_victim();
+    break;
+  default:
+    f = clock_victim();
+    break;
+  }
+
+  frame_t *frame = &frames[f];
+  space_t *owner = &spaces[frame->app_id];
+
+  owner->frames[frame->vpn] = -1;
+  owner->stats.resident--;
+  owner->stats.evictions++;
+  tlb_shootdown(frame->app_id, frame->vpn);
+  if (config.vm_replacement == VM_REPLACEMENT_LRU) {
+    lru_unlink(f);
+  }
+
+  return f;
+}
+
+void vm_handle_fault(int app_id) {
+  space_t *space = &spaces[app_id];
+  int vpn = space->pending_vpn;
+  int f = take_frame();
+
+  assert(vpn != -1 && space->frames[vpn] == -1);
+  frames[f] = (frame_t){.app_id = app_id,
+                        .vpn = vpn,
+                        .referenced = true,
+                        .last_use = space->vtime};
+  if (config.vm_replacement == VM_REPLACEMENT_LRU) {
+    lru_push_head(f);
+  }
+  space->frames[vpn] = f;
+  space->stats.faults++;
+  space->stats.resident++;
+}
+
+void vm_switch(int cpu_id, int app_id) {
+  tlb_t *tlb = &tlbs[cpu_id];
+
+  if (tlb->app_id == app_id)
+    return;
+
+  for (int e = 0; e < config.vm_tlb_entries; e++) {
+    tlb->entries[e].app_id = -1;
+  }
+  tlb->app_id = app_id;
+}
+
+void vm_release(int app_id) {
+  space_t *space = &spaces[app_id];
+
+  for (int p = 0; p < config.vm_pages; p++) {
+    int f = space->frames[p];
+
+    if (f == -1)
+      continue;
+
+    if (config.vm_replacement == VM_REPLACEMENT_LRU) {
+      lru_unlink(f);
+    }
+    frames[f].app_id = -1;
+    frames[f].referenced = false;
+    free_frames[free_amount++] = f;
+    space->frames[p] = -1;
+  }
+
+  space->stats.resident = 0;
+  space->pending_vpn = -1;
+  tlb_shootdown(app_id, -1);
+}
+
+const vm_stats_t *vm_get_stats(int app_id) { return &spaces[app_id].stats; }
+
+// Frame pool state that isn't per frame
+typedef struct {
+  int free_amount;
+  int hand;
+  int lru_head;
+  int lru_tail;
+} vm_image_t;
+
+void vm_checkpoint(checkpoint_t *ckpt) {
+  vm_image_t image = {.free_amount = free_amount,
+                      .hand = hand,
+                      .lru_head = lru_head,
+                      .lru_tail = lru_tail};
+  size_t pages_size = config.vm_pages * sizeof(int32_t);
+  size_t tlb_size = config.vm_tlb_entries * sizeof(tlb_entry_t);
+
+  checkpoint_write(ckpt, "vm", &image, sizeof(image));
+  checkpoint_write(ckpt, "vm.frames", frames,
+                   config.vm_frames * sizeof(frame_t));
+  checkpoint_write(ckpt, "vm.free", free_frames,
+                   config.vm_frames * sizeof(int));
+  // Page tables and TLB entries are spread over allocations, so they're
+  // gathered into a single section each
+  uint8_t *buf = (uint8_t *)alloc_array(
+      app_amount * pages_size > tlb_amount * tlb_size
+          ? app_amount * pages_size
+          : tlb_amount * tlb_size,
+      1);
+
+  checkpoint_write(ckpt, "vm.spaces", spaces, app_amount * sizeof(space_t));
+  for (int i = 0; i < app_amount; i++) {
+    memcpy(buf + i * pages_size, spaces[i].frames, pages_size);
+  }
+  checkpoint_write(ckpt, "vm.page_tables", buf, app_amount * pages_size);
+  checkpoint_write(ckpt, "vm.tlbs", tlbs, tlb_amount * sizeof(tlb_t));
+  for (int c = 0; c < tlb_amount; c++) {
+    memcpy(buf + c * tlb_size, tlbs[c].entries, tlb_size);
+  }
+  checkpoint_write(ckpt, "vm.tlb_entries", buf, tlb_amount * tlb_size);
+
+  free(buf);
+}
+
+void vm_restore(const checkpoint_t *ckpt) {
+  vm_image_t image;
+  size_t pages_size = config.vm_pages * sizeof(int32_t);
+  size_t tlb_size = config.vm_tlb_entries * sizeof(tlb_entry_t);
+  const space_t *saved_spaces = (const space_t *)checkpoint_section(
+      ckpt, "vm.spaces", app_amount * sizeof(space_t));
+  const uint8_t *page_tables = (const uint8_t *)checkpoint_section(
+      ckpt, "vm.page_tables", app_amount * pages_size);
+  const tlb_t *saved_tlbs = (const tlb_t *)checkpoint_section(
+      ckpt, "vm.tlbs", tlb_amount * sizeof(tlb_t));
+  const uint8_t *tlb_entries = (const uint8_t *)checkpoint_section(
+      ckpt, "vm.tlb_entries", tlb_amount * tlb_size);
+
+  checkpoint_read(ckpt, "vm", &image, sizeof(image));
+  free_amount = image.free_amount;
+  hand = image.hand;
+  lru_head = image.lru_head;
+  lru_tail = image.lru_tail;
+  checkpoint_read(ckpt, "vm.frames", frames,
+                  config.vm_frames * sizeof(frame_t));
+  checkpoint_read(ckpt, "vm.free", free_frames, config.vm_frames * sizeof(int));
+
+  // Saved pointers are stale, each keeps its own allocation
+  for (int i = 0; i < app_amount; i++) {
+    int32_t *page_table = spaces[i].frames;
+
+    spaces[i] = saved_spaces[i];
+    spaces[i].frames = page_table;
+    memcpy(page_table, page_tables + i * pages_size, pages_size);
+  }
+  for (int c = 0; c < tlb_amount; c++) {
+    tlb_entry_t *entries = tlbs[c].entries;
+
+    tlbs[c] = saved_tlbs[c];
+    tlbs[c].entries = entries;
+    memcpy(entries, tlb_entries + c * tlb_size, tlb_size);
+  }
+}
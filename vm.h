@@ -0,0 +1,53 @@
+#pragma once
+
+#include "checkpoint.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Virtual memory model of the kernel: each app has a page table over
+// vm_pages virtual pages, mapped onto a pool of vm_frames physical frames
+// shared by every app. Running apps issue memory accesses with temporal
+// locality, drawn from their own PRNG stream, which go through the TLB of
+// their CPU, then the page table. An access to a page not in memory faults,
+// and the kernel blocks the app on the swap device while a replacement
+// policy frees a frame for the page
+
+// Memory counters of an app
+typedef struct {
+  uint64_t accesses;  // Accesses completed
+  uint64_t tlb_hits;  // Accesses translated by the TLB
+  uint64_t faults;    // Page faults taken
+  uint64_t evictions; // Of its pages, by any app's fault
+  int resident;       // Pages in memory
+} vm_stats_t;
+
+// Sets up empty page tables for every app, a TLB for each CPU and the
+// frame pool, sized by the vm_ configuration keys. Access streams come from
+// their own streams of the given seed
+void vm_init(int app_amount, int cpu_amount, unsigned int seed);
+
+void vm_free(void);
+
+// Issues the given amount of accesses of an app running on a CPU. Stops at
+// the first page fault and returns true, the access is retried once the
+// app runs again
+bool vm_run_app(int cpu_id, int app_id, int accesses);
+
+// Brings the page an app faulted on into memory, evicting a page chosen by
+// the replacement policy if no frame is free
+void vm_handle_fault(int app_id);
+
+// Flushes the TLB of a CPU if it was translating for another app, as it's
+// about to run the given one
+void vm_switch(int cpu_id, int app_id);
+
+// Frees the frames of a finished app
+void vm_release(int app_id);
+
+const vm_stats_t *vm_get_stats(int app_id);
+
+// Writes the page tables, frames, TLBs and access streams to a checkpoint
+void vm_checkpoint(checkpoint_t *ckpt);
+
+// Restores the state written by vm_checkpoint, right after vm_init
+void vm_restore(const checkpoint_t *ckpt);
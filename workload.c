@@ -0,0 +1,164 @@
+#include "workload.h"
+#include "config.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Indexed by workload_t, built from the configuration on first use
+static workload_profile_t profiles[WORKLOAD_AMOUNT];
+static bool profiles_built = false;
+
+// Builds every profile from the configuration
+static void build_profiles(void) {
+  int max_pc = config.app_max_pc;
+
+  profiles[WORKLOAD_UNIFORM] = (workload_profile_t){
+      .syscall_prob = config.app_syscall_prob, .run_steps = max_pc};
+  // Mostly executes, on either device
+  profiles[WORKLOAD_CPU] = (workload_profile_t){
+      .syscall_prob = config.workload_cpu_syscall_prob,
+      .run_steps = max_pc * 2};
+  // Reads and writes, mostly on D1
+  profiles[WORKLOAD_IO] = (workload_profile_t){
+      .syscall_prob = config.workload_io_syscall_prob, .run_steps = max_pc};
+  // Starts with a CPU phase
+  profiles[WORKLOAD_BURSTY] = (workload_profile_t){
+      .syscall_prob = config.workload_bursty_syscall_prob,
+      .burst_prob = config.workload_bursty_burst_prob,
+      .phase_steps = config.workload_phase_steps,
+      .run_steps = max_pc * 2};
+  profiles[WORKLOAD_HEAVY_TAIL] = (workload_profile_t){
+      .syscall_prob = config.workload_heavytail_syscall_prob,
+      .run_steps = max_pc,
+      .tail_alpha = config.workload_tail_alpha};
+  for (int w = 0; w < WORKLOAD_AMOUNT; w++) {
+    memcpy(profiles[w].syscall_weights, config.workload_weights[w],
+           sizeof(profiles[w].syscall_weights));
+  }
+  profiles_built = true;
+}
+
+// Device syscalls, in the order of the profile weights
+static const syscall_t SYSCALLS[WORKLOAD_SYSCALLS] = {
+    SYSCALL_D1_R, SYSCALL_D1_W, SYSCALL_D1_X, SYSCALL_D2_R, SYSCALL_D2_W,
+    SYSCALL_D2_X};
+
+bool workload_parse_mix(const char *spec, workload_mix_t *mix) {
+  char buf[256];
+  char *save, *pair;
+  int total = 0;
+
+  if (strlen(spec) >= sizeof(buf))
+    return false;
+  strcpy(buf, spec);
+  memset(mix, 0, sizeof(*mix));
+
+  for (pair = strtok_r(buf, ",", &save); pair != NULL;
+       pair = strtok_r(NULL, ",", &save)) {
+    char *colon = strchr(pair, ':');
+    int weight = 1;
+
+    if (colon != NULL) {
+      char *end;
+
+      *colon = '\0';
+      weight = strtol(colon + 1, &end, 10);
+      if (*end != '\0' || end == colon + 1 || weight < 0)
+        return false;
+    }
+
+    int w = 0;
+    while (w < WORKLOAD_AMOUNT && strcmp(pair, WORKLOAD_STR[w]) != 0) {
+      w++;
+    }
+    if (w == WORKLOAD_AMOUNT)
+      return false;
+
+    mix->weights[w] += weight;
+    total += weight;
+  }
+
+  return total > 0;
+}
+
+void workload_assign(const workload_mix_t *mix, shm_t *shm) {
+  int current[WORKLOAD_AMOUNT] = {0};
+  int total = 0;
+
+  for (int w = 0; w < WORKLOAD_AMOUNT; w++) {
+    total += mix->weights[w];
+  }
+
+  // Smooth weighted round-robin: every profile earns its weight on each
+  // app, and the richest one is picked and pays the total
+  for (uint32_t i = 0; i < shm->app_amount; i++) {
+    int best = 0;
+
+    for (int w = 0; w < WORKLOAD_AMOUNT; w++) {
+      current[w] += mix->weights[w];
+      if (current[w] > current[best]) {
+        best = w;
+      }
+    }
+
+    current[best] -= total;
+    shm->ctxs[i].workload = best;
+  }
+}
+
+const workload_profile_t *workload_profile(workload_t workload) {
+  if (workload >= WORKLOAD_AMOUNT) {
+    fprintf(stderr, "Invalid workload profile\n");
+    exit(16);
+  }
+  if (!profiles_built) {
+    build_profiles();
+  }
+
+  return &profiles[workload];
+}
+
+int workload_run_steps(const workload_profile_t *profile, prng_t *prng) {
+  if (profile->tail_alpha <= 0)
+    return profile->run_steps;
+
+  // Inverse transform of a Pareto with the run steps as its minimum
+  double u = 1.0 - prng_unit(prng);
+  double steps = profile->run_steps * pow(u, -1.0 / profile->tail_alpha);
+  double max_steps =
+      (double)profile->run_steps * config.workload_tail_max_factor;
+
+  return steps < max_steps ? (int)steps : (int)max_steps;
+}
+
+bool workload_wants_syscall(const workload_profile_t *profile, int counter,
+                            prng_t *prng) {
+  int prob = profile->syscall_prob;
+
+  // Even phases are CPU phases, odd ones are I/O phases
+  if (profile->phase_steps > 0 && (counter / profile->phase_steps) % 2 == 1) {
+    prob = profile->burst_prob;
+  }
+
+  return prng_below(prng, 100) < (uint64_t)prob;
+}
+
+syscall_t workload_pick_syscall(const workload_profile_t *profile,
+                                prng_t *prng) {
+  int total = 0;
+
+  for (int i = 0; i < WORKLOAD_SYSCALLS; i++) {
+    total += profile->syscall_weights[i];
+  }
+
+  int r = prng_below(prng, total);
+  for (int i = 0; i < WORKLOAD_SYSCALLS; i++) {
+    if (r < profile->syscall_weights[i])
+      return SYSCALLS[i];
+    r -= profile->syscall_weights[i];
+  }
+
+  fprintf(stderr, "Workload syscall error\n");
+  exit(5);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "prng.h"
+#include "types.h"
+#include <stdbool.h>
+
+// Workload profiles: how long an app runs, how often it sends syscalls and
+// which ones. The kernel assigns a profile to each app from a mix such as
+// "cpu:3,io:1" and stores it in the app's shm context slot before it boots
+
+// What an app does on each iteration of its loop
+typedef struct {
+  int syscall_prob;  // Percentage chance of a syscall per iteration
+  int burst_prob;    // Same, on the I/O phases of bursty apps
+  int phase_steps;   // Iterations of each phase, 0 for a single phase
+  int run_steps;     // Iterations until finishing, the minimum with tails
+  double tail_alpha; // Pareto shape of the run length, 0 for fixed
+  // Relative odds of D1 R/W/X then D2 R/W/X
+  int syscall_weights[WORKLOAD_SYSCALLS];
+} workload_profile_t;
+
+// Ratio of each profile among the apps
+typedef struct {
+  int weights[WORKLOAD_AMOUNT];
+} workload_mix_t;
+
+// Parses a mix of comma separated profile:weight pairs, the weight
+// defaulting to 1. Returns false if the mix is invalid or empty
+bool workload_parse_mix(const char *spec, workload_mix_t *mix);
+
+// Stores a profile in each context slot following the mix ratio. Profiles
+// are interleaved, so any run of consecutive apps, and so each CPU's
+// initial share of them, follows the ratio too
+void workload_assign(const workload_mix_t *mix, shm_t *shm);
+
+// Returns the profile of the given workload
+const workload_profile_t *workload_profile(workload_t workload);
+
+// Iterations the app runs before finishing, drawn for heavy tails
+int workload_run_steps(const workload_profile_t *profile, prng_t *prng);
+
+// Whether the app sends a syscall on the iteration at the given counter
+bool workload_wants_syscall(const workload_profile_t *profile, int counter,
+                            prng_t *prng);
+
+// Draws a device syscall following the profile's mix
+syscall_t workload_pick_syscall(const workload_profile_t *profile,
+                                prng_t *prng);